@@ -0,0 +1,133 @@
+/*! \file bench_codec.cpp
+    \brief Measures compression ratio and throughput of image payload codecs.
+
+    Encodes and decodes synthetic frames that mimic typical content: an RGB frame
+    of smooth gradients with sensor noise, a gray frame of a rendered scene with
+    uniform areas and a depth frame with invalid (zero) regions and quantized
+    distances. Throughput refers to uncompressed bytes. Depth frames are also
+    encoded by the dedicated depth codec.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Small deterministic noise generator. */
+struct noise {
+  unsigned state;
+
+  inline noise() : state(1) {}
+
+  inline int operator()(int amplitude)
+  {
+    state = state * 1103515245 + 12345;
+    return static_cast<int>((state >> 16) % (2 * amplitude + 1)) - amplitude;
+  }
+};
+
+/** RGB frame of smooth gradients with low sensor noise. */
+ib::image make_rgb(int w, int h)
+{
+  ib::image img(w, h, w * 3);
+  img.set_format(ib::image::FORMAT_RGB_888);
+  noise n;
+  unsigned char *p = img.ptr<unsigned char>();
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      const int v = (x * 255) / w;
+      const int noisy = (x % 8 == 0) ? v + n(2) : v;
+      p[y * w * 3 + x * 3 + 0] = static_cast<unsigned char>(std::max(0, std::min(255, noisy)));
+      p[y * w * 3 + x * 3 + 1] = static_cast<unsigned char>((y * 255) / h);
+      p[y * w * 3 + x * 3 + 2] = 128;
+    }
+  }
+  return img;
+}
+
+/** Gray frame of uniform blocks as found in rendered or thresholded images. */
+ib::image make_gray(int w, int h)
+{
+  ib::image img(w, h, w);
+  img.set_format(ib::image::FORMAT_GRAY_8);
+  unsigned char *p = img.ptr<unsigned char>();
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      p[y * w + x] = static_cast<unsigned char>(((x / 40) * 37 + (y / 30) * 91) % 256);
+    }
+  }
+  return img;
+}
+
+/** Depth frame in millimeters with invalid regions and a curved surface with sensor noise. */
+ib::image make_depth(int w, int h)
+{
+  ib::image img(w, h, w * 2);
+  img.set_format(ib::image::FORMAT_DEPTH_16);
+  noise n;
+  uint16_t *p = img.ptr<uint16_t>();
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      const bool invalid = x < w / 10 || (x > w / 2 && x < w / 2 + 40 && y > h / 3);
+      p[y * w + x] = invalid ? 0 : static_cast<uint16_t>(800 + y * 2 + x / 3 + (x * x) / 2000 + n(2));
+    }
+  }
+  return img;
+}
+
+/** Encode and decode the image repeatedly and print ratio and throughput. */
+void run(const char *name, const ib::image &img, ib::codec &c, int iterations)
+{
+  const ib::codec_layout l = {img.get_width(), img.get_height(), img.get_step(), img.get_format()};
+  std::vector<char> coded(c.get_max_encoded_size(l, img.size()));
+  std::vector<char> decoded(img.size());
+
+  size_t bytes = 0;
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    bytes = c.encode(l, img.ptr<char>(), img.size(), coded.data(), coded.size());
+  }
+  const double encode_s = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+  bool ok = true;
+  start = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    ok = c.decode(l, coded.data(), bytes, decoded.data(), decoded.size()) && ok;
+  }
+  const double decode_s = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+  ok = ok && memcmp(decoded.data(), img.ptr<char>(), img.size()) == 0;
+
+  const double mb = img.size() * static_cast<double>(iterations) / (1024 * 1024);
+  std::cout << "  " << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(2)
+            << std::setw(8) << static_cast<double>(img.size()) / bytes << "\t"
+            << std::setprecision(0) << std::setw(8) << mb / encode_s << "\t"
+            << std::setw(8) << mb / decode_s << "\t"
+            << std::setw(8) << encode_s * 1e6 / iterations
+            << (ok ? "" : "\tMISMATCH") << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 50;
+
+  std::cout << "codec throughput of 640x480 frames, " << iterations << " iterations" << std::endl;
+  std::cout << "  frame/codec     ratio\tencode MB/s\tdecode MB/s\tencode us/frame" << std::endl;
+
+  ib::lz_codec lz;
+  ib::rvl_codec rvl;
+  const ib::image depth = make_depth(640, 480);
+  run("rgb/lz", make_rgb(640, 480), lz, iterations);
+  run("gray/lz", make_gray(640, 480), lz, iterations);
+  run("depth/lz", depth, lz, iterations);
+  run("depth/rvl", depth, rvl, iterations);
+
+  return 0;
+}
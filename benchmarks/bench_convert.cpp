@@ -0,0 +1,87 @@
+/*! \file bench_convert.cpp
+    \brief Measures pixel format conversions per instruction set.
+
+    Converts 1920x1080 frames between common formats using the portable
+    implementation and each instruction set supported by the processor, on one
+    thread. Reports the time per frame and the speedup over portable code.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Convert the frame repeatedly and return the time per frame in milliseconds. */
+double measure(const ib::image &src, ib::image::eformat to, int iterations)
+{
+  ib::convert_options o;
+  o.num_threads = 1;
+  o.depth_max = 4000;
+
+  ib::image dst(src.get_width(), src.get_height(), src.get_width() * ib::get_bytes_per_pixel(to), to);
+  ib::convert_pixels(src.ptr<void>(), src.get_step(), src.get_format(), 
+                     dst.ptr<void>(), dst.get_step(), to, src.get_width(), src.get_height(), o);
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    ib::convert_pixels(src.ptr<void>(), src.get_step(), src.get_format(), 
+                       dst.ptr<void>(), dst.get_step(), to, src.get_width(), src.get_height(), o);
+  }
+  return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count() / iterations;
+}
+
+/** Print times of a conversion for each instruction set. */
+void run(const char *name, ib::image::eformat from, ib::image::eformat to, int iterations)
+{
+  const int w = 1920, h = 1080;
+  ib::image src(w, h, w * ib::get_bytes_per_pixel(from), from);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src.ptr<unsigned char>()[i] = static_cast<unsigned char>((i * 7) ^ (i >> 11));
+  }
+
+  const ib::esimd levels[] = {ib::SIMD_NONE, ib::SIMD_SSSE3, ib::SIMD_AVX2, ib::SIMD_NEON};
+  const char *names[] = {"scalar", "ssse3", "avx2", "neon"};
+
+  double scalar = 0;
+  std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2);
+  for (int l = 0; l < 4; ++l) {
+    ib::set_simd_limit(levels[l]);
+    if (l > 0 && ib::get_simd_level() < levels[l]) {
+      continue;
+    }
+    const double ms = measure(src, to, iterations);
+    if (l == 0) {
+      scalar = ms;
+    }
+    std::cout << "\t" << names[l] << " " << ms << " ms";
+    if (l > 0) {
+      std::cout << " (" << scalar / ms << "x)";
+    }
+  }
+  ib::set_simd_limit(ib::SIMD_NEON);
+  std::cout << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 20;
+
+  std::cout << "pixel format conversion of 1920x1080 frames, one thread, " << iterations << " iterations" << std::endl;
+  run("rgb>bgr", ib::image::FORMAT_RGB_888, ib::image::FORMAT_BGR_888, iterations);
+  run("rgba>bgr", ib::image::FORMAT_RGBA_8888, ib::image::FORMAT_BGR_888, iterations);
+  run("bgr>bgra", ib::image::FORMAT_BGR_888, ib::image::FORMAT_BGRA_8888, iterations);
+  run("bgr>gray", ib::image::FORMAT_BGR_888, ib::image::FORMAT_GRAY_8, iterations);
+  run("depth>gray", ib::image::FORMAT_DEPTH_16, ib::image::FORMAT_GRAY_8, iterations);
+  run("yuyv>bgr", ib::image::FORMAT_YUYV, ib::image::FORMAT_BGR_888, iterations);
+  run("nv12>bgr", ib::image::FORMAT_NV12, ib::image::FORMAT_BGR_888, iterations);
+  run("i420>bgra", ib::image::FORMAT_I420, ib::image::FORMAT_BGRA_8888, iterations);
+
+  return 0;
+}
@@ -0,0 +1,58 @@
+/*! \file bench_demosaic.cpp
+    \brief Measures the cost of demosaicing raw Bayer frames on the receiving side.
+
+    Demosaics synthetic 8 and 16 bit Bayer frames to BGR using one thread and one
+    thread per core. Reports the time per frame and the bytes saved on the wire
+    compared to sending BGR.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <imagebabble/conversion/bayer.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Demosaic the frame repeatedly and print the time per frame. */
+void run(const char *name, ib::image::eformat f, int w, int h, int threads, int iterations)
+{
+  const int size = ib::get_bayer_sample_size(f);
+  ib::image raw(w, h, w * size);
+  raw.set_format(f);
+  unsigned char *p = raw.ptr<unsigned char>();
+  for (size_t i = 0; i < raw.size(); ++i) {
+    p[i] = static_cast<unsigned char>((i * 7) ^ (i >> 9));
+  }
+
+  ib::image bgr;
+  ib::demosaic(raw, bgr, threads);
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    ib::demosaic(raw, bgr, threads);
+  }
+  const double ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count() / iterations;
+
+  std::cout << "  " << name << "\t" << w << "x" << h << "\t" 
+            << (threads == 0 ? static_cast<int>(std::thread::hardware_concurrency()) : threads) << "\t"
+            << ms << " ms\t" << raw.size() / 1024 << " KB vs " << bgr.size() / 1024 << " KB" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 50;
+
+  std::cout << "bilinear demosaic to BGR, " << iterations << " iterations" << std::endl;
+  std::cout << "  frame\tsize\t\tthreads\ttime\t\twire" << std::endl;
+  run("bayer8", ib::image::FORMAT_BAYER_RGGB_8, 1920, 1080, 1, iterations);
+  run("bayer8", ib::image::FORMAT_BAYER_RGGB_8, 1920, 1080, 0, iterations);
+  run("bayer16", ib::image::FORMAT_BAYER_RGGB_16, 1920, 1080, 1, iterations);
+  run("bayer16", ib::image::FORMAT_BAYER_RGGB_16, 1920, 1080, 0, iterations);
+
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*! \file bench_fast_most_recent.cpp
+    \brief Measures the cost of forwarding to the most recent message with a slow consumer.
+
+    A publisher sends frames as fast as possible while a consumer receives only
+    every few milliseconds. The fast client in most-recent mode drains queued
+    messages without decoding them. For comparison, draining is also done by
+    decoding every queued message as earlier releases did.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+/** Frame with text encoding, which is expensive to decode. */
+struct frame {
+  std::vector<double> values;
+};
+
+std::ostream &operator<<(std::ostream &os, const frame &f)
+{
+  os << f.values.size();
+  for (size_t i = 0; i < f.values.size(); ++i) {
+    os << " " << f.values[i];
+  }
+  return os;
+}
+
+std::istream &operator>>(std::istream &is, frame &f)
+{
+  size_t n = 0;
+  is >> n;
+  f.values.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    is >> f.values[i];
+  }
+  return is;
+}
+
+/** Publish frames until stopped. */
+void publisher(const std::string &addr, std::atomic<bool> &stop)
+{
+  ib::fast_server<frame> s;
+  s.startup(addr);
+
+  frame f;
+  f.values.assign(1000, 3.14159);
+  while (!stop) {
+    s.publish(f);
+  }
+
+  s.shutdown();
+}
+
+/** Drain by decoding each queued message, bounded by the receive high water mark. */
+bool receive_decode_all(zmq::socket_t &s, frame &f)
+{
+  int k = 1000;
+  zmq::message_t topic;
+  std::string version;
+  while (k >= 0 && ib::io::recv_topic(s, topic, ZMQ_DONTWAIT)) {
+    ib::io::recv(s, version, ZMQ_DONTWAIT);
+    ib::io::recv(s, f, ZMQ_DONTWAIT);
+    --k;
+  }
+  return k != 1000;
+}
+
+/** Run slow consumer and return mean time per receive call in microseconds. */
+template<class F>
+double consume(F receive, int calls, int sleep_ms)
+{
+  double total_us = 0;
+  int n = 0;
+  while (n < calls) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+
+    bench_clock::time_point start = bench_clock::now();
+    const bool ok = receive();
+    bench_clock::time_point end = bench_clock::now();
+
+    if (ok) {
+      total_us += std::chrono::duration<double, std::micro>(end - start).count();
+      ++n;
+    }
+  }
+  return total_us / calls;
+}
+
+int main(int argc, char *argv[])
+{
+  const int calls = (argc > 1) ? atoi(argv[1]) : 100;
+  const int sleep_ms = 5;
+  const std::string addr = "tcp://127.0.0.1:6300";
+
+  std::atomic<bool> stop(false);
+  std::thread p(publisher, addr, std::ref(stop));
+
+  frame f;
+
+  ib::fast_client<frame> c;
+  c.set_enable_most_recent(true);
+  c.startup(addr);
+  const double skip_us = consume([&]() { return c.receive(f, 0); }, calls, sleep_ms);
+  c.shutdown();
+
+  zmq::context_t ctx(1);
+  zmq::socket_t s(ctx, ZMQ_SUB);
+  s.setsockopt(ZMQ_SUBSCRIBE, 0, 0);
+  s.connect(addr.c_str());
+  const double decode_us = consume([&]() { return receive_decode_all(s, f); }, calls, sleep_ms);
+  s.close();
+
+  stop = true;
+  p.join();
+
+  std::cout << "slow consumer receiving every " << sleep_ms << " ms, "
+            << calls << " calls, frames of " << f.values.size() << " numbers as text" << std::endl;
+  std::cout << "  decode every queued message: " << decode_us << " us/receive" << std::endl;
+  std::cout << "  decode most recent only:     " << skip_us << " us/receive" << std::endl;
+
+  return 0;
+}
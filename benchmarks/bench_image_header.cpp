@@ -0,0 +1,101 @@
+/*! \file bench_image_header.cpp
+    \brief Measures the per-frame cost of encoding and decoding image headers.
+
+    Compares the textual header of ImageBabble 0.1.x with the fixed-layout binary
+    header. Both variants include building the ZMQ message part as done by 
+    io::send and parsing it back as done by io::recv.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+/** Legacy text header encode and decode. */
+inline long text_roundtrip(const ib::image &v)
+{
+  std::ostringstream ostr;
+  ostr << v.get_width() << " "
+       << v.get_height() << " "
+       << v.get_step() << " "
+       << v.get_external_type() << " "
+       << v.get_format();
+
+  const std::string &str = ostr.str();
+  zmq::message_t msg(str.size());
+  memcpy(msg.data(), str.c_str(), str.size());
+
+  ib::io::in_memory_buffer mb(static_cast<char*>(msg.data()), msg.size());
+  std::istream is(&mb);
+  int w, h, step, type, format;
+  is >> w >> h >> step >> type >> format;
+
+  return w + h + step + type + format;
+}
+
+/** Binary header encode and decode. */
+inline long binary_roundtrip(const ib::image &v)
+{
+  ib::io::image_header h;
+  h.format = static_cast<uint8_t>(v.get_format());
+  h.flags = v.get_flags();
+  h.width = v.get_width();
+  h.height = v.get_height();
+  h.step = v.get_step();
+  h.external_type = v.get_external_type();
+  h.sequence = v.get_sequence();
+  h.timestamp = v.get_timestamp();
+
+  zmq::message_t msg(ib::io::image_header::wire_size);
+  h.store(msg.data());
+
+  ib::io::image_header r;
+  r.load(msg.data(), msg.size());
+
+  return r.width + r.height + r.step + r.external_type + r.format;
+}
+
+template<class F>
+double measure_ns(F f, const ib::image &img, int iterations, long &checksum)
+{
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    checksum += f(img);
+  }
+  bench_clock::time_point stop = bench_clock::now();
+
+  return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+int main(int argc, char *argv[]) 
+{
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  ib::image img(1920, 1080, 1920 * 3);
+  img.set_format(ib::image::FORMAT_BGR_888);
+  img.set_external_type(16);
+  img.set_sequence(123456);
+  img.set_timestamp(1381832400000000ULL);
+
+  long checksum = 0;
+  const double text_ns = measure_ns(text_roundtrip, img, iterations, checksum);
+  const double binary_ns = measure_ns(binary_roundtrip, img, iterations, checksum);
+
+  // Share of the frame budget of a single stream at 1000 frames per second.
+  const double budget_ns = 1e6;
+
+  std::cout << "image header encode+decode, " << iterations << " iterations" << std::endl;
+  std::cout << "  text:   " << text_ns << " ns/frame (" 
+            << 100.0 * text_ns / budget_ns << "% of 1000 fps budget)" << std::endl;
+  std::cout << "  binary: " << binary_ns << " ns/frame (" 
+            << 100.0 * binary_ns / budget_ns << "% of 1000 fps budget)" << std::endl;
+  std::cout << "  speedup " << text_ns / binary_ns << "x" << std::endl;
+
+  return checksum == 0 ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+/*! \file bench_inproc_pointers.cpp
+    \brief Compares serialized and pointer passing delivery of custom data in-process.
+
+    A fast server publishes a text encoded data structure to several clients in the
+    same thread. Over tcp every frame is serialized once and deserialized by each
+    client. Over inproc a shared pointer to the data is passed instead.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Frame with text encoding, which is expensive to serialize. */
+struct frame {
+  std::vector<double> values;
+};
+
+std::ostream &operator<<(std::ostream &os, const frame &f)
+{
+  os << f.values.size();
+  for (size_t i = 0; i < f.values.size(); ++i) {
+    os << " " << f.values[i];
+  }
+  return os;
+}
+
+std::istream &operator>>(std::istream &is, frame &f)
+{
+  size_t n = 0;
+  is >> n;
+  f.values.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    is >> f.values[i];
+  }
+  return is;
+}
+
+/** Deliver frames to n clients and return the mean time per frame in microseconds. */
+double run(const std::string &addr, size_t n, int frames)
+{
+  ib::context_ptr ctx(new zmq::context_t(1));
+
+  ib::fast_server<frame> s(ctx);
+  s.startup(addr);
+
+  std::vector< std::shared_ptr< ib::fast_client<frame> > > clients;
+  for (size_t i = 0; i < n; ++i) {
+    clients.push_back(std::make_shared< ib::fast_client<frame> >(ctx));
+    clients.back()->startup(addr);
+  }
+
+  std::shared_ptr<frame> f = std::make_shared<frame>();
+  f->values.assign(1000, 3.14159);
+  std::shared_ptr<const frame> p = f, q;
+
+  // Wait for subscriptions to be established.
+  for (size_t i = 0; i < n; ++i) {
+    while (!clients[i]->receive(q, 10)) {
+      s.publish(p);
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    while (clients[i]->receive(q, 0)) {}
+  }
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    s.publish(p);
+    for (size_t j = 0; j < n; ++j) {
+      clients[j]->receive(q, 1000);
+    }
+  }
+  bench_clock::time_point end = bench_clock::now();
+
+  for (size_t i = 0; i < n; ++i) {
+    clients[i]->shutdown();
+  }
+  s.shutdown();
+
+  return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+  const int frames = (argc > 1) ? atoi(argv[1]) : 200;
+  const size_t counts[] = {1, 4};
+
+  std::cout << "fast delivery of 1000 numbers as text in us/frame, " << frames << " frames" << std::endl;
+  std::cout << "  clients\ttcp\tinproc" << std::endl;
+
+  int port = 6600;
+  for (size_t i = 0; i < sizeof(counts) / sizeof(size_t); ++i) {
+    std::ostringstream tcp, inproc;
+    tcp << "tcp://127.0.0.1:" << port++;
+    inproc << "inproc://bench-pointers-" << i;
+
+    std::cout << "  " << counts[i] << "\t\t" 
+              << static_cast<long>(run(tcp.str(), counts[i], frames)) << "\t" << std::flush
+              << run(inproc.str(), counts[i], frames) << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*! \file bench_io_threads.cpp
+    \brief Measures aggregate throughput of multiple streams versus the number of I/O threads.
+
+    Eight streams each consist of a fast server and a fast client connected via tcp.
+    All servers share one context and all clients share another one, each created
+    with N I/O threads. Streams are assigned round robin to the I/O threads using
+    socket affinity. Each server publishes from its own thread, each client receives 
+    on its own thread.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+typedef std::vector<float> frame;
+
+const size_t nstreams = 8;
+const size_t frame_size = 1024 * 1024 / sizeof(float);
+
+/** Publish frames until stopped. */
+void publisher(ib::context_ptr ctx, uint64_t affinity, const std::string &addr, std::atomic<bool> &stop)
+{
+  ib::fast_server<frame> s(ctx);
+  s.set_max_pending_outbound(4);
+  s.set_io_affinity(affinity);
+  s.startup(addr);
+
+  const frame f(frame_size, 1.f);
+  while (!stop) {
+    if (!s.publish(f)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  s.shutdown();
+}
+
+/** Count received frames until stopped. */
+void subscriber(ib::context_ptr ctx, uint64_t affinity, const std::string &addr, 
+                std::atomic<bool> &measure, std::atomic<bool> &stop, std::atomic<size_t> &count)
+{
+  ib::fast_client<frame> c(ctx);
+  c.set_io_affinity(affinity);
+  c.startup(addr);
+
+  frame f;
+  while (!stop) {
+    if (c.receive(f, 50) && measure) {
+      ++count;
+    }
+  }
+
+  c.shutdown();
+}
+
+/** Run all streams and return the aggregate throughput in MB/s. */
+double run(int port, int io_threads, int seconds)
+{
+  ib::context_factory factory;
+  factory.set_io_threads(io_threads);
+  ib::context_ptr server_ctx = factory.create();
+  ib::context_ptr client_ctx = factory.create();
+
+  std::atomic<bool> measure(false), stop(false);
+  std::atomic<size_t> count(0);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < nstreams; ++i) {
+    std::ostringstream addr;
+    addr << "tcp://127.0.0.1:" << port + i;
+    const uint64_t affinity = uint64_t(1) << (i % io_threads);
+
+    threads.push_back(std::thread(publisher, server_ctx, affinity, addr.str(), std::ref(stop)));
+    threads.push_back(std::thread(subscriber, client_ctx, affinity, addr.str(), 
+                                  std::ref(measure), std::ref(stop), std::ref(count)));
+  }
+
+  // Let connections settle before measuring.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  measure = true;
+  bench_clock::time_point start = bench_clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  measure = false;
+  bench_clock::time_point end = bench_clock::now();
+
+  stop = true;
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  const double mb = count * frame_size * sizeof(float) / (1024. * 1024.);
+  return mb / std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  const int seconds = (argc > 1) ? atoi(argv[1]) : 2;
+  const int io_threads[] = {1, 2, 4};
+
+  std::cout << nstreams << " streams of 1 MB frames via tcp, " << seconds << " s" << std::endl;
+
+  int port = 6500;
+  for (size_t i = 0; i < sizeof(io_threads) / sizeof(int); ++i) {
+    std::cout << "  io_threads=" << io_threads[i] << ": " 
+              << static_cast<long>(run(port, io_threads[i], seconds)) << " MB/s" << std::endl;
+    port += nstreams;
+  }
+
+  return 0;
+}
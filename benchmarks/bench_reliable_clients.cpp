@@ -0,0 +1,114 @@
+/*! \file bench_reliable_clients.cpp
+    \brief Measures reliable publishing cost versus the number of clients.
+
+    A server publishes small frames to 10, 100 and 1000 local clients. To keep the
+    number of threads low, clients are emulated by raw DEALER sockets that share a
+    single context and are serviced by one thread speaking the reliable protocol.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Service emulated clients until stopped. */
+void clients(const std::string &addr, size_t n, std::atomic<bool> &stop)
+{
+  zmq::context_t ctx(1);
+  zmq_ctx_set(static_cast<void*>(ctx), ZMQ_MAX_SOCKETS, static_cast<int>(n + 16));
+
+  std::vector<zmq::socket_t*> sockets;
+  std::vector<zmq::pollitem_t> items;
+  for (size_t i = 0; i < n; ++i) {
+    zmq::socket_t *s = new zmq::socket_t(ctx, ZMQ_DEALER);
+    int linger = 0;
+    s->setsockopt(ZMQ_LINGER, &linger, sizeof(int));
+    s->connect(addr.c_str());
+    ib::io::send(*s, IB_EXCHANGE_PROTO_RELIABLE_VERSION, ZMQ_SNDMORE);
+    ib::io::send(*s, IB_EXCHANGE_PROTO_RELIABLE_REGISTER, 0);
+
+    zmq::pollitem_t item = {static_cast<void*>(*s), 0, ZMQ_POLLIN, 0};
+    sockets.push_back(s);
+    items.push_back(item);
+  }
+
+  while (!stop) {
+    zmq::poll(&items[0], items.size(), 50);
+    for (size_t i = 0; i < n; ++i) {
+      if (!(items[i].revents & ZMQ_POLLIN)) {
+        continue;
+      }
+
+      // version, type, id, slot, data
+      zmq::message_t parts[5];
+      for (int j = 0; j < 5; ++j) {
+        sockets[i]->recv(&parts[j]);
+      }
+      ib::io::discard_remainder(*sockets[i]);
+
+      ib::io::send(*sockets[i], IB_EXCHANGE_PROTO_RELIABLE_VERSION, ZMQ_SNDMORE);
+      ib::io::send(*sockets[i], IB_EXCHANGE_PROTO_RELIABLE_ACK, ZMQ_SNDMORE);
+      sockets[i]->send(parts[2], ZMQ_SNDMORE);
+      sockets[i]->send(parts[3], 0);
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    delete sockets[i];
+  }
+}
+
+/** Publish frames to n clients and return the mean time per frame in microseconds. */
+double run(int port, size_t n, int frames)
+{
+  std::ostringstream addr;
+  addr << "tcp://127.0.0.1:" << port;
+
+  ib::reliable_server< std::vector<float> > s;
+  s.startup(addr.str());
+
+  std::atomic<bool> stop(false);
+  std::thread c(clients, addr.str(), n, std::ref(stop));
+
+  std::vector<float> data(256, 1.f);
+
+  // Wait for all clients to register.
+  s.publish(data, -1, n);
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    s.publish(data, -1, n);
+  }
+  bench_clock::time_point end = bench_clock::now();
+
+  stop = true;
+  c.join();
+  s.shutdown();
+
+  return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+  const int frames = (argc > 1) ? atoi(argv[1]) : 200;
+  const size_t counts[] = {10, 100, 1000};
+
+  std::cout << "reliable publish with N clients, " << frames << " frames" << std::endl;
+
+  int port = 6200;
+  for (size_t i = 0; i < sizeof(counts) / sizeof(size_t); ++i) {
+    const double us = run(port++, counts[i], frames);
+    std::cout << "  N=" << counts[i] << ": " << us << " us/frame, "
+              << us / counts[i] << " us/client" << std::endl;
+  }
+
+  return 0;
+}
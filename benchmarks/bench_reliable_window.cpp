@@ -0,0 +1,179 @@
+/*! \file bench_reliable_window.cpp
+    \brief Measures reliable publishing throughput versus round trip time and window size.
+
+    A server publishes images to a single client through a proxy that delays every
+    message by half the configured round trip time in each direction. Stop-and-wait
+    publishing (window size 1) is limited to one frame per round trip, larger windows
+    keep multiple frames in flight.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <thread>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** A complete multi-part message scheduled for delivery. */
+struct delayed_message {
+  bench_clock::time_point due;
+  std::vector<zmq::message_t> parts;
+};
+
+/** Read a complete multi-part message. */
+inline void read_parts(zmq::socket_t &s, std::vector<zmq::message_t> &parts)
+{
+  int64_t more = 0;
+  size_t more_size = sizeof(more);
+  do {
+    parts.push_back(zmq::message_t());
+    s.recv(&parts.back());
+    s.getsockopt(ZMQ_RCVMORE, &more, &more_size);
+  } while (more);
+}
+
+/** Write a complete multi-part message. */
+inline void write_parts(zmq::socket_t &s, std::vector<zmq::message_t> &parts)
+{
+  for (size_t i = 0; i < parts.size(); ++i) {
+    s.send(parts[i], (i + 1 < parts.size()) ? ZMQ_SNDMORE : 0);
+  }
+}
+
+/** Forward messages between a single client and the server with a fixed delay
+  * in each direction. */
+void delay_proxy(zmq::context_t &ctx, const std::string &front, const std::string &back,
+                 std::chrono::microseconds delay, std::atomic<bool> &stop)
+{
+  zmq::socket_t f(ctx, ZMQ_ROUTER), b(ctx, ZMQ_DEALER);
+  int linger = 0;
+  f.setsockopt(ZMQ_LINGER, &linger, sizeof(int));
+  b.setsockopt(ZMQ_LINGER, &linger, sizeof(int));
+  f.bind(front.c_str());
+  b.connect(back.c_str());
+
+  zmq::message_t client_id;
+  std::deque<delayed_message> upstream, downstream;
+
+  while (!stop) {
+    const bench_clock::time_point now = bench_clock::now();
+
+    while (!upstream.empty() && upstream.front().due <= now) {
+      write_parts(b, upstream.front().parts);
+      upstream.pop_front();
+    }
+    while (!downstream.empty() && downstream.front().due <= now) {
+      zmq::message_t id;
+      id.copy(&client_id);
+      f.send(id, ZMQ_SNDMORE);
+      write_parts(f, downstream.front().parts);
+      downstream.pop_front();
+    }
+
+    bench_clock::time_point next = now + std::chrono::milliseconds(10);
+    if (!upstream.empty() && upstream.front().due < next) next = upstream.front().due;
+    if (!downstream.empty() && downstream.front().due < next) next = downstream.front().due;
+    long wait_ms = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count());
+
+    zmq::pollitem_t items[] = { {f, 0, ZMQ_POLLIN, 0}, {b, 0, ZMQ_POLLIN, 0} };
+    zmq::poll(items, 2, wait_ms);
+
+    if (items[0].revents & ZMQ_POLLIN) {
+      delayed_message m;
+      read_parts(f, m.parts);
+      client_id.copy(&m.parts.front());
+      m.parts.erase(m.parts.begin());
+      m.due = bench_clock::now() + delay;
+      upstream.push_back(std::move(m));
+    }
+    if (items[1].revents & ZMQ_POLLIN) {
+      delayed_message m;
+      read_parts(b, m.parts);
+      m.due = bench_clock::now() + delay;
+      downstream.push_back(std::move(m));
+    }
+  }
+}
+
+/** Receive until stopped. */
+void client(const std::string &addr, std::atomic<bool> &stop)
+{
+  ib::reliable_client<ib::image> c;
+  c.startup(addr);
+
+  ib::image img;
+  while (!stop) {
+    c.receive(img, 50);
+  }
+  c.shutdown();
+}
+
+/** Publish frames and return throughput in frames per second. */
+double run(int port, int rtt_ms, size_t window, int frames)
+{
+  std::ostringstream server_addr, proxy_addr;
+  server_addr << "tcp://127.0.0.1:" << port;
+  proxy_addr << "tcp://127.0.0.1:" << port + 1;
+
+  zmq::context_t proxy_ctx(1);
+  std::atomic<bool> stop_proxy(false), stop_client(false);
+
+  ib::reliable_server<ib::image> s;
+  s.set_window_size(window);
+  s.startup(server_addr.str());
+
+  std::thread p(delay_proxy, std::ref(proxy_ctx), proxy_addr.str(), server_addr.str(),
+                std::chrono::microseconds(rtt_ms * 500), std::ref(stop_proxy));
+  std::thread c(client, proxy_addr.str(), std::ref(stop_client));
+
+  ib::image img(640, 480, 640);
+
+  // Wait for the client to register.
+  s.publish(img, -1, 1);
+  s.flush();
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    s.publish(img, -1, 1);
+  }
+  s.flush();
+  bench_clock::time_point stop = bench_clock::now();
+
+  stop_client = true;
+  c.join();
+  s.shutdown();
+  stop_proxy = true;
+  p.join();
+
+  return frames / std::chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  const int frames = (argc > 1) ? atoi(argv[1]) : 200;
+  const int rtts[] = {0, 1, 2, 5};
+  const size_t windows[] = {1, 4, 16};
+
+  std::cout << "reliable publish throughput of 640x480 frames in frames/s, "
+            << frames << " frames" << std::endl;
+  std::cout << "  rtt [ms]\tW=1\tW=4\tW=16" << std::endl;
+
+  int port = 6100;
+  for (size_t i = 0; i < sizeof(rtts) / sizeof(int); ++i) {
+    std::cout << "  " << rtts[i];
+    for (size_t j = 0; j < sizeof(windows) / sizeof(size_t); ++j) {
+      std::cout << "\t" << static_cast<long>(run(port, rtts[i], windows[j], frames)) << std::flush;
+      port += 2;
+    }
+    std::cout << std::endl;
+  }
+
+  return 0;
+}
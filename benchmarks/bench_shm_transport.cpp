@@ -0,0 +1,76 @@
+/*! \file bench_shm_transport.cpp
+    \brief Measures the time to deliver an image from a fast server to a fast client.
+
+    Images of increasing size are published over tcp and over shared memory. With 
+    shared memory, images are either copied into a slot by the server or filled in 
+    place after allocating them from the ring. Server and client share a thread, so
+    each frame is received before the next one is published.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Deliver frames and return the mean time per frame in microseconds. */
+double run(const std::string &addr, int w, int h, int frames, bool in_place)
+{
+  ib::fast_server<ib::image> s;
+  s.set_shm_options(4, static_cast<size_t>(w) * h * 3);
+  s.startup(addr);
+
+  ib::fast_client<ib::image> c;
+  c.startup(addr);
+
+  ib::image img(w, h, w * 3), recv_img;
+
+  // Wait for subscription to be established.
+  while (!c.receive(recv_img, 10)) {
+    s.publish(img);
+  }
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    if (in_place) {
+      s.get_shm_ring()->allocate_image(w, h, w * 3, img);
+      img.ptr<char>()[0] = static_cast<char>(i);
+    }
+    s.publish(img);
+    c.receive(recv_img, 1000);
+  }
+  bench_clock::time_point end = bench_clock::now();
+
+  c.shutdown();
+  s.shutdown();
+
+  return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+  const int frames = (argc > 1) ? atoi(argv[1]) : 100;
+  const int sizes[][2] = {{640, 480}, {1920, 1080}, {3840, 2160}};
+
+  std::cout << "fast transport of RGB images in us/frame, " << frames << " frames" << std::endl;
+  std::cout << "  size\t\ttcp\tshm copy\tshm in place" << std::endl;
+
+  int port = 6500;
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    const int w = sizes[i][0], h = sizes[i][1];
+    std::ostringstream tcp;
+    tcp << "tcp://127.0.0.1:" << port++;
+
+    std::cout << "  " << w << "x" << h << "\t" 
+              << static_cast<long>(run(tcp.str(), w, h, frames, false)) << "\t" << std::flush
+              << static_cast<long>(run("shm://ib-bench", w, h, frames, false)) << "\t\t" << std::flush
+              << static_cast<long>(run("shm://ib-bench", w, h, frames, true)) << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*! \file bench_tile_delta.cpp
+    \brief Measures bandwidth and cost of tile delta encoding on mostly static scenes.
+
+    Simulates a fixed camera observing a static scene in which a small object moves
+    and a few pixels flicker with sensor noise. Reports the mean number of bytes sent
+    per frame including keyframes, relative to the uncompressed frame, and the time
+    to encode and decode a frame.
+
+    \copyright Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    \license This project is released under the New BSD License.
+*/
+
+#include <imagebabble/imagebabble.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace ib = imagebabble;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/** Render frame k: a static gradient, a moving 48x48 box and a flickering pixel per row block. */
+void render(ib::image &img, int k, int bpp)
+{
+  const int w = img.get_width(), h = img.get_height(), step = img.get_step();
+  unsigned char *p = img.ptr<unsigned char>();
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w * bpp; ++x) {
+      p[y * step + x] = static_cast<unsigned char>((x + y) / 8);
+    }
+  }
+
+  const int bx = (k * 4) % (w - 48), by = h / 2;
+  for (int y = by; y < by + 48; ++y) {
+    memset(p + y * step + bx * bpp, 255, 48 * bpp);
+  }
+
+  for (int y = 0; y < h; y += 64) {
+    p[y * step + (k * 131) % (w * bpp)] ^= 1;
+  }
+}
+
+/** Run frames through encoder and decoder and print statistics. */
+void run(const char *name, int bpp, int keyframe_interval, int frames)
+{
+  ib::image img(640, 480, 640 * bpp);
+  const ib::codec_layout l = {img.get_width(), img.get_height(), img.get_step(), img.get_format()};
+
+  ib::tile_delta_codec enc(keyframe_interval), dec;
+  std::vector<char> coded(enc.get_max_encoded_size(l, img.size()));
+  std::vector<char> decoded(img.size());
+
+  double encode_us = 0, decode_us = 0, bytes = 0;
+  bool ok = true;
+  for (int k = 0; k < frames; ++k) {
+    render(img, k, bpp);
+
+    bench_clock::time_point start = bench_clock::now();
+    const size_t n = enc.encode(l, img.ptr<char>(), img.size(), coded.data(), coded.size());
+    bench_clock::time_point mid = bench_clock::now();
+    ok = dec.decode(l, coded.data(), n, decoded.data(), decoded.size()) && ok;
+    bench_clock::time_point end = bench_clock::now();
+
+    encode_us += std::chrono::duration<double, std::micro>(mid - start).count();
+    decode_us += std::chrono::duration<double, std::micro>(end - mid).count();
+    bytes += n;
+  }
+  ok = ok && memcmp(decoded.data(), img.ptr<char>(), img.size()) == 0;
+
+  std::cout << "  " << name << "\t" << keyframe_interval << "\t"
+            << static_cast<long>(bytes / frames) << " B/frame ("
+            << img.size() * static_cast<double>(frames) / bytes << "x)\t"
+            << encode_us / frames << " us\t" << decode_us / frames << " us"
+            << (ok ? "" : "\tMISMATCH") << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const int frames = (argc > 1) ? atoi(argv[1]) : 300;
+
+  std::cout << "tile delta on a mostly static 640x480 scene, " << frames << " frames" << std::endl;
+  std::cout << "  frame\tkey\tsent\t\t\t\tencode\tdecode" << std::endl;
+  run("gray", 1, 30, frames);
+  run("rgb", 3, 30, frames);
+  run("rgb", 3, 300, frames);
+
+  return 0;
+}
@@ -27,27 +27,32 @@ struct person {
 namespace imagebabble {
   namespace io {
 
-    /** Send a person */
+    /** Serializes a person */
     template<>
-    bool send(zmq::socket_t &s, const person &p, int flags)
-    {
-      IB_FIRST_PART(io::send(s, p.name, flags | ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(s, p.age, flags | ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(s, p.friends, flags));
-
-      return true;
-    }
-
-    /** Receive a person */
-    template<>
-    bool recv(zmq::socket_t &s, person &p, int flags)
-    {
-      IB_FIRST_PART(io::recv(s, p.name, flags));
-      IB_NEXT_PART(io::recv(s, p.age, flags));
-      IB_NEXT_PART(io::recv(s, p.friends, flags));
-
-      return true;
-    }
+    struct serializer<person> {
+
+      /** Send a person */
+      template<class S>
+      static bool send(S &s, const person &p, int flags)
+      {
+        IB_FIRST_PART(io::send(s, p.name, flags | ZMQ_SNDMORE));
+        IB_NEXT_PART(io::send(s, p.age, flags | ZMQ_SNDMORE));
+        IB_NEXT_PART(io::send(s, p.friends, flags));
+
+        return true;
+      }
+
+      /** Receive a person */
+      template<class S>
+      static bool recv(S &s, person &p, int flags)
+      {
+        IB_FIRST_PART(io::recv(s, p.name, flags));
+        IB_NEXT_PART(io::recv(s, p.age, flags));
+        IB_NEXT_PART(io::recv(s, p.friends, flags));
+
+        return true;
+      }
+    };
 
   }
 }
@@ -0,0 +1,483 @@
+/*! \file async.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#ifndef __IMAGE_BABBLE_ASYNC_HPP_INCLUDED__
+#define __IMAGE_BABBLE_ASYNC_HPP_INCLUDED__
+
+#include "core.hpp"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+
+namespace imagebabble {
+
+  /** Asynchronous server wrapper. Publishing is performed by a dedicated I/O thread
+    * that owns the socket of the wrapped server. Callers enqueue data by
+    * async_server::publish_async and never touch ZMQ sockets themselves.
+    *
+    * Data waiting to be published is kept in a bounded queue. When the queue is full,
+    * the queue policy decides whether the oldest pending data is dropped, the new data
+    * is dropped or the caller blocks until space becomes available. Dropped data
+    * completes with false.
+    *
+    * \note Images are queued as shallow copies sharing the image data. Do not modify
+    *       the data of a queued image before its publish operation has completed.
+    *
+    * \tparam Server Server type, such as reliable_server<image> or fast_server<image>.
+    */
+  template<class Server>
+  class async_server {
+  public:
+
+    /** Data type published. */
+    typedef typename Server::value_type value_type;
+
+    /** Queue policies applied when the queue is full. */
+    enum epolicy {
+      POLICY_DROP_OLDEST, ///< Drop the oldest pending data.
+      POLICY_DROP_NEWEST, ///< Drop the data to be enqueued.
+      POLICY_BLOCK        ///< Block the caller until space is available.
+    };
+
+    /** Construct with queue capacity and policy. */
+    async_server(size_t capacity = 4, epolicy policy = POLICY_DROP_OLDEST)
+      : _capacity(capacity), _policy(policy), _running(false), _stop(false)
+    {
+      IB_ASSERT(capacity > 0, ib_error::EPARAMRANGE);
+    }
+
+    /** Construct wrapping a server created from an existing context. */
+    explicit async_server(const context_ptr &ctx, size_t capacity = 4, epolicy policy = POLICY_DROP_OLDEST)
+      : _server(ctx), _capacity(capacity), _policy(policy), _running(false), _stop(false)
+    {
+      IB_ASSERT(capacity > 0, ib_error::EPARAMRANGE);
+    }
+
+    /** Destructor. */
+    ~async_server()
+    {
+      shutdown();
+    }
+
+    /** Access the wrapped server to apply options. Must not be used
+      * between startup and shutdown. */
+    Server &get_server()
+    {
+      return _server;
+    }
+
+    /** Start the I/O thread and bind the wrapped server to the given endpoint.
+      * Calling this method more than once restarts the I/O thread.
+      *
+      * \param[in] addr address to bind to.
+      * \throws ib_error on error
+      */
+    void startup(const std::string &addr = "tcp://127.0.0.1:6000")
+    {
+      shutdown();
+
+      std::promise<void> ready;
+      std::future<void> started = ready.get_future();
+
+      _stop = false;
+      _thread = std::thread(&async_server::run, this, addr, &ready);
+
+      try {
+        started.get();
+      } catch (...) {
+        _thread.join();
+        throw;
+      }
+
+      _running = true;
+    }
+
+    /** Stop the I/O thread and shutdown the wrapped server. Data not yet
+      * published completes with false. Waits for the publish operation in
+      * progress to finish. */
+    void shutdown()
+    {
+      if (_thread.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _stop = true;
+        }
+        _not_empty.notify_all();
+        _not_full.notify_all();
+        _thread.join();
+      }
+      _running = false;
+    }
+
+    /** Enqueue data to be published by the I/O thread.
+      *
+      * \param[in] t data to be published.
+      * \param[in] timeout_ms passed on to the wrapped server's publish method.
+      * \param[in] min_serve passed on to the wrapped server's publish method.
+      * \returns future holding the result of the wrapped server's publish method,
+      *          or false if the data was dropped.
+      * \throws ib_error on error.
+      */
+    std::future<bool> publish_async(const value_type &t, int timeout_ms = -1, size_t min_serve = 1)
+    {
+      std::unique_ptr<job> j(new job());
+      j->data = t;
+      j->timeout_ms = timeout_ms;
+      j->min_serve = min_serve;
+      return enqueue(std::move(j));
+    }
+
+#ifdef IB_HAS_RVALUE_REFS
+
+    /** Enqueue data to be published by the I/O thread. See async_server::publish_async. */
+    std::future<bool> publish_async(value_type &&t, int timeout_ms = -1, size_t min_serve = 1)
+    {
+      std::unique_ptr<job> j(new job());
+      j->data = std::move(t);
+      j->timeout_ms = timeout_ms;
+      j->min_serve = min_serve;
+      return enqueue(std::move(j));
+    }
+
+#endif
+
+    /** Get the number of queued elements not yet taken by the I/O thread. */
+    size_t get_pending() const
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _queue.size();
+    }
+
+  private:
+
+    /** Pending publish operation. */
+    struct job {
+      value_type data;
+      int timeout_ms;
+      size_t min_serve;
+      std::promise<bool> done;
+    };
+
+    typedef std::deque< std::unique_ptr<job> > job_queue;
+
+    /** Apply queue policy and enqueue job. */
+    std::future<bool> enqueue(std::unique_ptr<job> j)
+    {
+      IB_ASSERT(_running, ib_error::EINVALIDSOCKET);
+
+      std::future<bool> f = j->done.get_future();
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      if (_queue.size() >= _capacity) {
+        if (_policy == POLICY_DROP_NEWEST) {
+          j->done.set_value(false);
+          return f;
+        } else if (_policy == POLICY_DROP_OLDEST) {
+          _queue.front()->done.set_value(false);
+          _queue.pop_front();
+        } else {
+          while (_queue.size() >= _capacity && !_stop) {
+            _not_full.wait(lock);
+          }
+          if (_stop) {
+            j->done.set_value(false);
+            return f;
+          }
+        }
+      }
+
+      _queue.push_back(std::move(j));
+      lock.unlock();
+      _not_empty.notify_one();
+
+      return f;
+    }
+
+    /** I/O thread main loop. */
+    void run(std::string addr, std::promise<void> *ready)
+    {
+      try {
+        _server.startup(addr);
+      } catch (...) {
+        ready->set_exception(std::current_exception());
+        return;
+      }
+      ready->set_value();
+
+      for (;;) {
+        std::unique_ptr<job> j;
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          while (_queue.empty() && !_stop) {
+            _not_empty.wait(lock);
+          }
+          if (_stop) {
+            break;
+          }
+          j = std::move(_queue.front());
+          _queue.pop_front();
+        }
+        _not_full.notify_one();
+
+        try {
+          j->done.set_value(_server.publish(std::move(j->data), j->timeout_ms, j->min_serve));
+        } catch (...) {
+          j->done.set_exception(std::current_exception());
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (typename job_queue::iterator i = _queue.begin(); i != _queue.end(); ++i) {
+          (*i)->done.set_value(false);
+        }
+        _queue.clear();
+      }
+
+      _server.shutdown();
+    }
+
+    Server _server;
+    size_t _capacity;
+    epolicy _policy;
+    bool _running;
+    bool _stop;
+    job_queue _queue;
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+
+    /** Disabled copy constructor */
+    async_server (const async_server &);
+    /** Disabled assignment operator */
+    async_server &operator = (const async_server &);
+  };
+
+  /** Asynchronous client wrapper. A dedicated I/O thread owns the socket of the wrapped
+    * client and continuously receives data into a lock-free triple buffer. Calling 
+    * async_client::receive returns the newest complete data in constant time without
+    * system calls, so consumers may poll at their own rate without queue build-up. 
+    * Data received in between two calls to receive is discarded.
+    *
+    * \note Images are returned as shallow copies sharing the received data. 
+    *
+    * \tparam Client Client type, such as fast_client<image>.
+    */
+  template<class Client>
+  class async_client {
+  public:
+
+    /** Data type received. */
+    typedef typename Client::value_type value_type;
+
+    /** Default constructor. */
+    async_client()
+      : _state(1), _back(0), _front(2), _waiters(0), _stop(false)
+    {}
+
+    /** Construct wrapping a client created from an existing context. */
+    explicit async_client(const context_ptr &ctx)
+      : _client(ctx), _state(1), _back(0), _front(2), _waiters(0), _stop(false)
+    {}
+
+    /** Destructor. */
+    ~async_client()
+    {
+      shutdown();
+    }
+
+    /** Access the wrapped client to apply options. Must not be used
+      * between startup and shutdown. */
+    Client &get_client()
+    {
+      return _client;
+    }
+
+    /** Start the I/O thread and connect the wrapped client to the given endpoint. 
+      * Calling this method more than once restarts the I/O thread, which then 
+      * connects to all endpoints given so far.
+      *
+      * \param [in] addr endpoint address to connect to
+      * \throws ib_error on error
+      */
+    void startup(const std::string &addr = "tcp://127.0.0.1:6000")
+    {
+      std::vector<std::string> endpoints = _endpoints;
+      endpoints.push_back(addr);
+
+      shutdown();
+
+      std::promise<void> ready;
+      std::future<void> started = ready.get_future();
+
+      _stop = false;
+      _error = std::exception_ptr();
+      _thread = std::thread(&async_client::run, this, endpoints, &ready);
+
+      try {
+        started.get();
+      } catch (...) {
+        _thread.join();
+        throw;
+      }
+
+      _endpoints = endpoints;
+    }
+
+    /** Stop the I/O thread and shutdown the wrapped client. */
+    void shutdown()
+    {
+      if (_thread.joinable()) {
+        _stop = true;
+        _thread.join();
+      }
+      _endpoints.clear();
+    }
+
+    /** Receive newest data. 
+      *
+      * \param [in,out] t data to be received
+      * \param [in] timeout_ms Maximum wait time in milliseconds for new data to arrive.
+      *             Returns immediately by default.
+      * \returns true if new data was received since the last call.
+      * \returns false when timeout occurred.
+      * \throws ib_error when the I/O thread failed.
+      */
+    bool receive(value_type &t, int timeout_ms = 0)
+    {
+      if (!(_state.load() & fresh_bit) && timeout_ms != 0) {
+        wait_fresh(timeout_ms);
+      }
+
+      if (!(_state.load() & fresh_bit)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_error) {
+          std::rethrow_exception(_error);
+        }
+        return false;
+      }
+
+      _front = _state.exchange(_front) & index_mask;
+      t = _slots[_front];
+      return true;
+    }
+
+  private:
+
+    enum {
+      /** Mask of slot index in state. */
+      index_mask = 3,
+      /** Set in state when the middle slot holds data not yet seen by the reader. */
+      fresh_bit = 4
+    };
+
+    /** Wait until fresh data is available or timeout occurs. */
+    void wait_fresh(int timeout_ms)
+    {
+      ++_waiters;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!(_state.load() & fresh_bit) && !_error) {
+          if (timeout_ms < 0) {
+            _fresh.wait(lock);
+          } else if (_fresh.wait_for(lock, std::chrono::milliseconds(timeout_ms)) == std::cv_status::timeout) {
+            break;
+          }
+        }
+      }
+      --_waiters;
+    }
+
+    /** I/O thread main loop. */
+    void run(std::vector<std::string> endpoints, std::promise<void> *ready)
+    {
+      try {
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+          _client.startup(endpoints[i]);
+        }
+      } catch (...) {
+        _client.shutdown();
+        ready->set_exception(std::current_exception());
+        return;
+      }
+      ready->set_value();
+
+      try {
+        while (!_stop) {
+          if (_client.receive(_slots[_back], 100)) {
+            // Publish back slot and take over the previous middle slot.
+            _back = _state.exchange(_back | fresh_bit) & index_mask;
+            notify_waiters();
+          }
+        }
+      } catch (...) {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _error = std::current_exception();
+        }
+        notify_waiters();
+      }
+
+      _client.shutdown();
+    }
+
+    /** Wake up readers waiting for data. */
+    void notify_waiters()
+    {
+      if (_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _fresh.notify_all();
+      }
+    }
+
+    Client _client;
+    value_type _slots[3];
+    std::atomic<unsigned> _state;   ///< Middle slot index and fresh flag
+    unsigned _back;                 ///< Slot owned by I/O thread
+    unsigned _front;                ///< Slot owned by reader
+    std::atomic<int> _waiters;
+    std::atomic<bool> _stop;
+    std::exception_ptr _error;
+    std::vector<std::string> _endpoints;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _fresh;
+
+    /** Disabled copy constructor */
+    async_client (const async_client &);
+    /** Disabled assignment operator */
+    async_client &operator = (const async_client &);
+  };
+
+}
+
+#endif
@@ -0,0 +1,185 @@
+/*! \file buffer_pool.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#ifndef __IMAGE_BABBLE_BUFFER_POOL_HPP_INCLUDED__
+#define __IMAGE_BABBLE_BUFFER_POOL_HPP_INCLUDED__
+
+#include "core.hpp"
+#include <map>
+#include <mutex>
+#include <cstdlib>
+#include <new>
+
+namespace imagebabble {
+
+  class buffer_pool;
+
+  /** Shared pointer to buffer pool. */
+  typedef std::shared_ptr<buffer_pool> buffer_pool_ptr;
+
+  /** Pool of reusable data buffers. Buffers are grouped into size classes and aligned 
+    * to 64 byte boundaries. Buffers handed out by buffer_pool::allocate are returned 
+    * to the pool by buffer_pool::release, which matches the signature of a ZMQ free 
+    * function. A message constructed from a pooled buffer thus returns the buffer to
+    * the pool once its reference count drops to zero.
+    *
+    * Outstanding buffers keep the pool alive. Allocation and release are thread-safe.
+    * Pools must be created by a buffer_pool_ptr.
+    */
+  class buffer_pool : public std::enable_shared_from_this<buffer_pool> {
+  public:
+
+    enum {
+      /** Alignment of buffers in bytes. */
+      alignment = 64,
+      /** Smallest size class in bytes. */
+      min_size = 4096
+    };
+
+    /** Construct pool keeping at most the given number of unused buffers per size class. */
+    inline explicit buffer_pool(size_t max_cached = 4)
+      : _max_cached(max_cached), _nallocs(0)
+    {}
+
+    /** Destructor. Frees all unused buffers. */
+    inline ~buffer_pool()
+    {
+      for (free_map::iterator i = _free.begin(); i != _free.end(); ++i) {
+        for (size_t j = 0; j < i->second.size(); ++j) {
+          std::free(i->second[j]->raw);
+        }
+      }
+    }
+
+    /** Get a buffer of at least n bytes. The buffer must be returned by buffer_pool::release. */
+    inline void *allocate(size_t n)
+    {
+      const size_t cls = size_class(n);
+      block_header *b = 0;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<block_header*> &list = _free[cls];
+        if (!list.empty()) {
+          b = list.back();
+          list.pop_back();
+        }
+      }
+
+      if (!b) {
+        void *raw = std::malloc(cls + sizeof(block_header) + alignment - 1);
+        IB_ASSERT(raw != 0, ib_error::EBUFFERTOOSMALL);
+
+        const size_t addr = reinterpret_cast<size_t>(raw);
+        b = reinterpret_cast<block_header*>((addr + alignment - 1) & ~static_cast<size_t>(alignment - 1));
+        b->raw = raw;
+        b->size = cls;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_nallocs;
+      }
+
+      new (&b->owner) buffer_pool_ptr(shared_from_this());
+      return reinterpret_cast<char*>(b) + sizeof(block_header);
+    }
+
+    /** Return a buffer obtained by buffer_pool::allocate to its pool. 
+      * Signature matches zmq::free_fn, the hint is unused. */
+    static inline void release(void *data, void * /*hint*/)
+    {
+      block_header *b = reinterpret_cast<block_header*>(static_cast<char*>(data) - sizeof(block_header));
+
+      // Keep pool alive while recycling.
+      buffer_pool_ptr owner(b->owner);
+      b->owner.~buffer_pool_ptr();
+      owner->recycle(b);
+    }
+
+    /** Get the size of the size class the given number of bytes falls into. Classes are
+      * spaced by a quarter of the next lower power of two. */
+    static inline size_t size_class(size_t n)
+    {
+      if (n <= min_size) {
+        return min_size;
+      }
+
+      size_t p = min_size;
+      while (p * 2 < n) {
+        p *= 2;
+      }
+      const size_t step = p / 4;
+      return ((n + step - 1) / step) * step;
+    }
+
+    /** Get the number of buffers allocated from the system so far. */
+    inline size_t get_num_allocations() const
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _nallocs;
+    }
+
+  private:
+
+    /** Bookkeeping stored in front of each buffer. Its size keeps buffers aligned. */
+    struct block_header {
+      void *raw;
+      size_t size;
+      buffer_pool_ptr owner;
+      char padding[alignment - sizeof(void*) - sizeof(size_t) - sizeof(buffer_pool_ptr)];
+    };
+
+    typedef std::map<size_t, std::vector<block_header*> > free_map;
+
+    /** Keep buffer for reuse or free it. */
+    inline void recycle(block_header *b)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::vector<block_header*> &list = _free[b->size];
+      if (list.size() < _max_cached) {
+        if (list.capacity() < _max_cached) {
+          list.reserve(_max_cached);
+        }
+        list.push_back(b);
+      } else {
+        std::free(b->raw);
+      }
+    }
+
+    size_t _max_cached;
+    size_t _nallocs;
+    free_map _free;
+    mutable std::mutex _mutex;
+
+    /** Disabled copy constructor */
+    buffer_pool (const buffer_pool &);
+    /** Disabled assignment operator */
+    buffer_pool &operator = (const buffer_pool &);
+  };
+
+}
+
+#endif
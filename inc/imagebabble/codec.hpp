@@ -0,0 +1,1017 @@
+/*! \file codec.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#ifndef __IMAGE_BABBLE_CODEC_HPP_INCLUDED__
+#define __IMAGE_BABBLE_CODEC_HPP_INCLUDED__
+
+#include "core.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+/** Whether SSE2 instructions are available at compile time. */
+#define IB_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace imagebabble {
+
+  /** Identifiers of image payload codecs as transmitted in the image header.
+    * Identifiers from CODEC_USER upwards are free for application codecs. */
+  enum ecodec {
+    /** Payload is sent as is. */
+    CODEC_NONE = 0,
+    /** Built-in byte-oriented LZ77 compression, see lz_codec. */
+    CODEC_LZ = 1,
+    /** Built-in temporal delta of changed tiles, see tile_delta_codec. */
+    CODEC_TILE_DELTA = 2,
+    /** Built-in run-length and variable-length delta coding of depth images, see rvl_codec. */
+    CODEC_RVL = 3,
+    /** First identifier available to application codecs. */
+    CODEC_USER = 128
+  };
+
+  /** Layout of the image payload handed to a codec. */
+  struct codec_layout {
+    /** Number of pixels in width. */
+    int width;
+    /** Number of pixels in height. */
+    int height;
+    /** Number of bytes between two subsequent rows. */
+    int step;
+    /** Value of image::eformat. */
+    int format;
+  };
+
+  /** Lossless transformation of image payloads. A codec attached to an image via
+    * image::set_codec encodes the payload when sending. Receivers look up the codec
+    * by the identifier found in the image header and decode transparently.
+    *
+    * Codec instances may keep state between frames and are not thread-safe. Use one
+    * instance per stream on each side.
+    */
+  class codec {
+  public:
+
+    /** Destructor */
+    virtual ~codec()
+    {}
+
+    /** Get the identifier transmitted in the image header. */
+    virtual uint8_t get_id() const = 0;
+
+    /** Get the maximum number of bytes encode may produce for n input bytes. */
+    virtual size_t get_max_encoded_size(const codec_layout &l, size_t n) const = 0;
+
+    /** Encode n bytes from src into dst of given capacity.
+      * \returns number of bytes written or zero to send the payload uncompressed,
+      *          e.g. because it does not shrink. */
+    virtual size_t encode(const codec_layout &l, const void *src, size_t n, void *dst, size_t capacity) = 0;
+
+    /** Decode n bytes from src into dst of exactly raw bytes.
+      * \returns false if the input is malformed, does not decode to raw bytes or 
+      *          refers to data the codec has not seen. */
+    virtual bool decode(const codec_layout &l, const void *src, size_t n, void *dst, size_t raw) = 0;
+
+    /** Encode the next frame such that it decodes without frames encoded before. 
+      * Codecs keeping no state between frames ignore the request. */
+    virtual void request_keyframe()
+    {}
+
+    /** Test if n encoded bytes decode without frames encoded before. */
+    virtual bool is_keyframe(const void * /*src*/, size_t /*n*/) const
+    {
+      return true;
+    }
+  };
+
+  /** Shared pointer to codec. */
+  typedef std::shared_ptr<codec> codec_ptr;
+
+  /** Fast lossless LZ77 compression in the spirit of LZ4. The output is a sequence of
+    * literal runs and back-references with 16 bit offsets, each introduced by a token
+    * byte holding the literal and match lengths in its upper and lower nibble. Lengths
+    * that do not fit into a nibble continue in bytes of 255. The final sequence consists
+    * of literals only.
+    *
+    * Compression works well on images with large uniform areas, synthetic content and
+    * masked depth maps. Noisy camera images usually do not shrink, in which case the
+    * payload is sent uncompressed.
+    */
+  class lz_codec : public codec {
+  public:
+
+    /** Construct codec. */
+    inline lz_codec()
+      : _table(hash_size)
+    {}
+
+    /** Get the identifier transmitted in the image header. */
+    inline uint8_t get_id() const
+    {
+      return CODEC_LZ;
+    }
+
+    /** Get the maximum number of bytes encode may produce for n input bytes. */
+    inline size_t get_max_encoded_size(const codec_layout &, size_t n) const
+    {
+      return n + n / 255 + 16;
+    }
+
+    /** Encode n bytes from src into dst of given capacity. Returns zero if the 
+      * output would not be smaller than the input. */
+    inline size_t encode(const codec_layout &, const void *src, size_t n, void *dst, size_t capacity)
+    {
+      const unsigned char *in = static_cast<const unsigned char*>(src);
+      unsigned char *out = static_cast<unsigned char*>(dst);
+      unsigned char *const out_end = out + std::min(capacity, n > 0 ? n - 1 : 0);
+
+      size_t anchor = 0;
+
+      if (n > min_input) {
+        std::fill(_table.begin(), _table.end(), 0);
+
+        const size_t limit = n - match_guard;
+        const size_t match_limit = n - last_literals;
+        size_t ip = 1;
+
+        while (ip < limit) {
+          const uint32_t seq = load32(in + ip);
+          uint32_t &slot = _table[hash(seq)];
+          size_t ref = slot;
+          slot = static_cast<uint32_t>(ip);
+
+          if (ip - ref > max_offset || load32(in + ref) != seq) {
+            // Skip faster through incompressible regions.
+            ip += 1 + ((ip - anchor) >> skip_shift);
+            continue;
+          }
+
+          while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+            --ip;
+            --ref;
+          }
+
+          size_t len = min_match;
+          while (ip + len + 8 <= match_limit && load64(in + ip + len) == load64(in + ref + len)) {
+            len += 8;
+          }
+          while (ip + len < match_limit && in[ip + len] == in[ref + len]) {
+            ++len;
+          }
+
+          out = put_sequence(out, out_end, in + anchor, ip - anchor, ip - ref, len);
+          if (!out) {
+            return 0;
+          }
+
+          ip += len;
+          anchor = ip;
+
+          if (ip - 2 < limit) {
+            _table[hash(load32(in + ip - 2))] = static_cast<uint32_t>(ip - 2);
+          }
+        }
+      }
+
+      out = put_sequence(out, out_end, in + anchor, n - anchor, 0, 0);
+      if (!out) {
+        return 0;
+      }
+      return out - static_cast<unsigned char*>(dst);
+    }
+
+    /** Decode n bytes from src into dst of exactly raw bytes. */
+    inline bool decode(const codec_layout &, const void *src, size_t n, void *dst, size_t raw)
+    {
+      const unsigned char *in = static_cast<const unsigned char*>(src);
+      const unsigned char *const in_end = in + n;
+      unsigned char *out = static_cast<unsigned char*>(dst);
+      unsigned char *const out_begin = out;
+      unsigned char *const out_end = out + raw;
+
+      for (;;) {
+        if (in == in_end) {
+          return false;
+        }
+        const unsigned token = *in++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(in, in_end, lit)) {
+          return false;
+        }
+        if (lit > static_cast<size_t>(in_end - in) || lit > static_cast<size_t>(out_end - out)) {
+          return false;
+        }
+        memcpy(out, in, lit);
+        in += lit;
+        out += lit;
+
+        if (in == in_end) {
+          return out == out_end;
+        }
+
+        if (in_end - in < 2) {
+          return false;
+        }
+        const size_t offset = io::load_le<uint16_t>(in);
+        in += 2;
+        if (offset == 0 || offset > static_cast<size_t>(out - out_begin)) {
+          return false;
+        }
+
+        size_t len = token & 15;
+        if (len == 15 && !get_length(in, in_end, len)) {
+          return false;
+        }
+        len += min_match;
+        if (len > static_cast<size_t>(out_end - out)) {
+          return false;
+        }
+
+        // The distance to the reference doubles with every copy, which
+        // replicates short periodic patterns in few steps.
+        const unsigned char *ref = out - offset;
+        while (len > 0) {
+          const size_t chunk = std::min(len, static_cast<size_t>(out - ref));
+          memcpy(out, ref, chunk);
+          out += chunk;
+          len -= chunk;
+        }
+      }
+    }
+
+  private:
+
+    enum {
+      /** Number of hash table entries as a power of two. */
+      hash_bits = 14,
+      hash_size = 1 << hash_bits,
+      /** Shortest back-reference. */
+      min_match = 4,
+      /** Largest back-reference distance. */
+      max_offset = 65535,
+      /** Number of trailing bytes always sent as literals. */
+      last_literals = 5,
+      /** No match starts within this many bytes of the end. */
+      match_guard = 12,
+      /** Inputs of this size or less are stored as literals. */
+      min_input = 16,
+      /** Controls how quickly the search accelerates in literal runs. */
+      skip_shift = 6
+    };
+
+    /** Load 4 bytes in host byte order. */
+    static inline uint32_t load32(const unsigned char *p)
+    {
+      uint32_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+
+    /** Load 8 bytes in host byte order. */
+    static inline uint64_t load64(const unsigned char *p)
+    {
+      uint64_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+
+    /** Hash 4 bytes to a table index. */
+    static inline size_t hash(uint32_t v)
+    {
+      return (v * 2654435761U) >> (32 - hash_bits);
+    }
+
+    /** Write the continuation bytes of a length that exceeds its nibble. */
+    static inline unsigned char *put_length(unsigned char *out, size_t len)
+    {
+      while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+      }
+      *out++ = static_cast<unsigned char>(len);
+      return out;
+    }
+
+    /** Read the continuation bytes of a length. */
+    static inline bool get_length(const unsigned char *&in, const unsigned char *in_end, size_t &len)
+    {
+      unsigned b;
+      do {
+        if (in == in_end) {
+          return false;
+        }
+        b = *in++;
+        len += b;
+      } while (b == 255);
+      return true;
+    }
+
+    /** Write a sequence of literals followed by a match. A match length of zero
+      * writes the final literal-only sequence. Returns null if out of space. */
+    static inline unsigned char *put_sequence(
+      unsigned char *out, unsigned char *out_end,
+      const unsigned char *lit, size_t nlit, size_t offset, size_t len)
+    {
+      const size_t need = 1 + nlit / 255 + 1 + nlit + 2 + len / 255 + 1;
+      if (need > static_cast<size_t>(out_end - out)) {
+        return 0;
+      }
+
+      unsigned char *token = out++;
+      *token = static_cast<unsigned char>(std::min<size_t>(nlit, 15) << 4);
+      if (nlit >= 15) {
+        out = put_length(out, nlit - 15);
+      }
+      memcpy(out, lit, nlit);
+      out += nlit;
+
+      if (len > 0) {
+        io::store_le<uint16_t>(out, static_cast<uint16_t>(offset));
+        out += 2;
+        len -= min_match;
+        *token |= static_cast<unsigned char>(std::min<size_t>(len, 15));
+        if (len >= 15) {
+          out = put_length(out, len - 15);
+        }
+      }
+      return out;
+    }
+
+    std::vector<uint32_t> _table;
+  };
+
+  /** Temporal delta compression for mostly static scenes. The image is divided into 
+    * tiles of a fixed number of bytes per row and rows. Each frame is compared tile by
+    * tile against the previous one and only changed tiles are transmitted. Every 
+    * keyframe interval, and whenever the image layout changes, the complete image is
+    * sent so that receivers joining late or missing frames resynchronize.
+    *
+    * Encoded frames start with a 16 byte little-endian header
+    *  - bytes 0-3 frame number
+    *  - byte  4 frame kind, 0 for keyframes and 1 for delta frames
+    *  - byte  5 reserved, zero
+    *  - bytes 6-7 tile width in bytes
+    *  - bytes 8-9 tile height in rows
+    *  - bytes 10-11 reserved, zero
+    *  - bytes 12-15 number of changed tiles
+    *
+    * Keyframes continue with the image data. Delta frames continue with a bitmap of 
+    * one bit per tile in row-major order, followed by the rows of each changed tile. 
+    * Tiles at the right and bottom border are clipped to the image.
+    *
+    * A delta frame only decodes if the previous frame was decoded by the same codec 
+    * instance. The fast_client keeps decoders per topic. Other receivers keep the 
+    * decoder in the image received into, so receive into the same image each time.
+    * Skipping frames, e.g. through fast_client::set_enable_most_recent, suspends 
+    * decoding until the next keyframe.
+    */
+  class tile_delta_codec : public codec {
+  public:
+
+    enum {
+      /** Number of bytes of the frame header. */
+      header_size = 16
+    };
+
+    /** Construct codec.
+      * \param [in] keyframe_interval send a keyframe every this many frames.
+      * \param [in] tile_width width of tiles in bytes.
+      * \param [in] tile_height height of tiles in rows. */
+    inline explicit tile_delta_codec(int keyframe_interval = 30, int tile_width = 64, int tile_height = 16)
+      : _keyframe_interval(keyframe_interval), _tile_w(tile_width), _tile_h(tile_height),
+        _enc_frame(0), _enc_since_key(0), _enc_valid(false), _dec_frame(0), _dec_valid(false)
+    {
+      IB_ASSERT(keyframe_interval > 0 && tile_width > 0 && tile_width <= 0xffff && 
+                tile_height > 0 && tile_height <= 0xffff, ib_error::EPARAMRANGE);
+    }
+
+    /** Get the identifier transmitted in the image header. */
+    inline uint8_t get_id() const
+    {
+      return CODEC_TILE_DELTA;
+    }
+
+    /** Get the maximum number of bytes encode may produce for n input bytes. */
+    inline size_t get_max_encoded_size(const codec_layout &l, size_t n) const
+    {
+      return header_size + bitmap_size(num_tiles(l, _tile_w, _tile_h)) + n;
+    }
+
+    /** Send a keyframe next. */
+    inline void request_keyframe()
+    {
+      _enc_valid = false;
+    }
+
+    /** Test if n encoded bytes hold a keyframe. */
+    inline bool is_keyframe(const void *src, size_t n) const
+    {
+      return n >= header_size && io::load_le<uint8_t>(static_cast<const char*>(src) + 4) == 0;
+    }
+
+    /** Encode n bytes from src into dst of given capacity. */
+    inline size_t encode(const codec_layout &l, const void *src, size_t n, void *dst, size_t capacity)
+    {
+      if (!is_valid_layout(l, n) || capacity < get_max_encoded_size(l, n)) {
+        return 0;
+      }
+
+      const unsigned char *in = static_cast<const unsigned char*>(src);
+      unsigned char *out = static_cast<unsigned char*>(dst);
+
+      const bool key = !_enc_valid || _enc_since_key + 1 >= _keyframe_interval ||
+                       _enc_layout.step != l.step || _enc_layout.height != l.height;
+
+      uint32_t changed = 0;
+      unsigned char *p = out + header_size;
+
+      if (key) {
+        _enc_ref.assign(in, in + n);
+        _enc_layout = l;
+        _enc_since_key = 0;
+        _enc_valid = true;
+        memcpy(p, in, n);
+        p += n;
+        changed = static_cast<uint32_t>(num_tiles(l, _tile_w, _tile_h));
+      } else {
+        ++_enc_since_key;
+
+        const size_t step = static_cast<size_t>(l.step);
+        const size_t cols = (step + _tile_w - 1) / _tile_w;
+        const size_t rows = (static_cast<size_t>(l.height) + _tile_h - 1) / _tile_h;
+        unsigned char *bitmap = p;
+        memset(bitmap, 0, bitmap_size(cols * rows));
+        p += bitmap_size(cols * rows);
+
+        _dirty.resize(cols);
+        for (size_t ty = 0; ty < rows; ++ty) {
+          const size_t y0 = ty * _tile_h;
+          const size_t y1 = std::min(y0 + _tile_h, static_cast<size_t>(l.height));
+
+          // Walk rows in memory order and stop comparing tiles known to differ.
+          std::fill(_dirty.begin(), _dirty.end(), 0);
+          for (size_t y = y0; y < y1; ++y) {
+            const unsigned char *a = in + y * step;
+            const unsigned char *b = &_enc_ref[y * step];
+            for (size_t tx = 0; tx < cols; ++tx) {
+              if (!_dirty[tx]) {
+                const size_t x0 = tx * _tile_w;
+                _dirty[tx] = !is_equal(a + x0, b + x0, std::min<size_t>(_tile_w, step - x0));
+              }
+            }
+          }
+
+          for (size_t tx = 0; tx < cols; ++tx) {
+            if (!_dirty[tx]) {
+              continue;
+            }
+            const size_t t = ty * cols + tx;
+            bitmap[t >> 3] |= static_cast<unsigned char>(1 << (t & 7));
+            ++changed;
+
+            const size_t x0 = tx * _tile_w;
+            const size_t w = std::min<size_t>(_tile_w, step - x0);
+            for (size_t y = y0; y < y1; ++y) {
+              memcpy(p, in + y * step + x0, w);
+              memcpy(&_enc_ref[y * step + x0], p, w);
+              p += w;
+            }
+          }
+        }
+      }
+
+      ++_enc_frame;
+      store_header(out, _enc_frame, key, changed);
+      return p - out;
+    }
+
+    /** Decode n bytes from src into dst of exactly raw bytes. */
+    inline bool decode(const codec_layout &l, const void *src, size_t n, void *dst, size_t raw)
+    {
+      const unsigned char *in = static_cast<const unsigned char*>(src);
+      if (n < header_size || !is_valid_layout(l, raw)) {
+        return false;
+      }
+
+      const uint32_t frame = io::load_le<uint32_t>(in);
+      const uint8_t kind = io::load_le<uint8_t>(in + 4);
+      const size_t tile_w = io::load_le<uint16_t>(in + 6);
+      const size_t tile_h = io::load_le<uint16_t>(in + 8);
+      in += header_size;
+      n -= header_size;
+
+      if (kind == 0) {
+        if (n != raw) {
+          return false;
+        }
+        _dec_ref.assign(in, in + n);
+        _dec_layout = l;
+        _dec_frame = frame;
+        _dec_valid = true;
+        memcpy(dst, in, n);
+        return true;
+      }
+
+      if (kind != 1 || tile_w == 0 || tile_h == 0 || !_dec_valid || frame != _dec_frame + 1 ||
+          _dec_layout.step != l.step || _dec_layout.height != l.height) 
+      {
+        _dec_valid = false;
+        return false;
+      }
+
+      const size_t step = static_cast<size_t>(l.step);
+      const size_t cols = (step + tile_w - 1) / tile_w;
+      const size_t rows = (static_cast<size_t>(l.height) + tile_h - 1) / tile_h;
+      const size_t nbitmap = bitmap_size(cols * rows);
+      if (n < nbitmap) {
+        _dec_valid = false;
+        return false;
+      }
+
+      const unsigned char *bitmap = in;
+      const unsigned char *p = in + nbitmap;
+      const unsigned char *const end = in + n;
+
+      for (size_t t = 0; t < cols * rows; ++t) {
+        if (!(bitmap[t >> 3] & (1 << (t & 7)))) {
+          continue;
+        }
+
+        const size_t x0 = (t % cols) * tile_w;
+        const size_t y0 = (t / cols) * tile_h;
+        const size_t w = std::min(tile_w, step - x0);
+        const size_t y1 = std::min(y0 + tile_h, static_cast<size_t>(l.height));
+        if (static_cast<size_t>(end - p) < w * (y1 - y0)) {
+          _dec_valid = false;
+          return false;
+        }
+
+        for (size_t y = y0; y < y1; ++y) {
+          memcpy(&_dec_ref[y * step + x0], p, w);
+          p += w;
+        }
+      }
+
+      if (p != end) {
+        _dec_valid = false;
+        return false;
+      }
+
+      _dec_frame = frame;
+      memcpy(dst, _dec_ref.data(), raw);
+      return true;
+    }
+
+  private:
+
+    /** Test that the payload consists of height rows of step bytes. */
+    static inline bool is_valid_layout(const codec_layout &l, size_t n)
+    {
+      return l.step > 0 && l.height > 0 && 
+             static_cast<size_t>(l.step) * static_cast<size_t>(l.height) == n;
+    }
+
+    /** Get the number of tiles covering the image. */
+    static inline size_t num_tiles(const codec_layout &l, size_t tile_w, size_t tile_h)
+    {
+      if (l.step <= 0 || l.height <= 0) {
+        return 0;
+      }
+      return ((l.step + tile_w - 1) / tile_w) * ((l.height + tile_h - 1) / tile_h);
+    }
+
+    /** Get the number of bytes of a bitmap with one bit per tile. */
+    static inline size_t bitmap_size(size_t tiles)
+    {
+      return (tiles + 7) / 8;
+    }
+
+    /** Compare n bytes. */
+    static inline bool is_equal(const unsigned char *a, const unsigned char *b, size_t n)
+    {
+#ifdef IB_HAS_SSE2
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) {
+          return false;
+        }
+      }
+      return memcmp(a + i, b + i, n - i) == 0;
+#else
+      return memcmp(a, b, n) == 0;
+#endif
+    }
+
+    /** Write frame header. */
+    inline void store_header(unsigned char *p, uint32_t frame, bool key, uint32_t changed) const
+    {
+      memset(p, 0, header_size);
+      io::store_le<uint32_t>(p, frame);
+      io::store_le<uint8_t>(p + 4, key ? 0 : 1);
+      io::store_le<uint16_t>(p + 6, static_cast<uint16_t>(_tile_w));
+      io::store_le<uint16_t>(p + 8, static_cast<uint16_t>(_tile_h));
+      io::store_le<uint32_t>(p + 12, changed);
+    }
+
+    int _keyframe_interval;
+    size_t _tile_w, _tile_h;
+
+    std::vector<unsigned char> _enc_ref;
+    codec_layout _enc_layout;
+    uint32_t _enc_frame;
+    int _enc_since_key;
+    bool _enc_valid;
+    std::vector<unsigned char> _dirty;
+
+    std::vector<unsigned char> _dec_ref;
+    codec_layout _dec_layout;
+    uint32_t _dec_frame;
+    bool _dec_valid;
+  };
+
+  /** Lossless compression of 16 bit depth images following the RVL scheme by Wilson 
+    * (Fast Lossless Depth Image Compression, ISS 2017). Pixels are visited in row-major 
+    * order and split into alternating runs of invalid (zero) and valid pixels. Each run 
+    * is introduced by its length, valid pixels are stored as the difference to the 
+    * previous valid pixel. Lengths and zigzag mapped differences are written as 
+    * variable-length sequences of 4 bit nibbles holding 3 data bits and a continuation
+    * bit. Nibbles are packed into little-endian 32 bit words starting with the most
+    * significant nibble.
+    *
+    * Smooth surfaces produce differences that fit into a single nibble, which typically
+    * yields 3-6 times smaller frames at a cost of about a millisecond per VGA frame.
+    * The codec keeps no state and is used by default for image::FORMAT_DEPTH_16, see
+    * image::set_default_codec. Images whose rows are padded are sent uncompressed.
+    */
+  class rvl_codec : public codec {
+  public:
+
+    /** Get the identifier transmitted in the image header. */
+    inline uint8_t get_id() const
+    {
+      return CODEC_RVL;
+    }
+
+    /** Get the maximum number of bytes encode may produce for n input bytes. */
+    inline size_t get_max_encoded_size(const codec_layout &, size_t n) const
+    {
+      // At most six nibbles per difference plus two lengths per run.
+      return (n / 2) * 3 + n + 16;
+    }
+
+    /** Encode n bytes from src into dst of given capacity. Returns zero if the 
+      * output would not be smaller than the input. */
+    inline size_t encode(const codec_layout &l, const void *src, size_t n, void *dst, size_t capacity)
+    {
+      if (!is_valid_layout(l, n)) {
+        return 0;
+      }
+
+      const unsigned char *in = static_cast<const unsigned char*>(src);
+      const size_t npixels = n / 2;
+      nibble_writer w(static_cast<unsigned char*>(dst), std::min(capacity, n - 1));
+
+      uint16_t previous = 0;
+      size_t i = 0;
+      while (i < npixels) {
+        const size_t zeros = count_zeros(in, i, npixels);
+        i += zeros;
+        const size_t valid = count_valid(in, i, npixels);
+
+        // Lengths take at most 11 nibbles, differences at most 6.
+        if (!w.reserve(22 + valid * 6)) {
+          return 0;
+        }
+        w.put(static_cast<uint32_t>(zeros));
+        w.put(static_cast<uint32_t>(valid));
+        for (size_t k = 0; k < valid; ++k, ++i) {
+          const uint16_t current = io::load_le<uint16_t>(in + 2 * i);
+          const int32_t delta = static_cast<int32_t>(current) - static_cast<int32_t>(previous);
+          w.put((static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+          previous = current;
+        }
+      }
+
+      if (!w.reserve(8)) {
+        return 0;
+      }
+      return w.finish();
+    }
+
+    /** Decode n bytes from src into dst of exactly raw bytes. */
+    inline bool decode(const codec_layout &l, const void *src, size_t n, void *dst, size_t raw)
+    {
+      if (!is_valid_layout(l, raw) || n % 4 != 0) {
+        return false;
+      }
+
+      unsigned char *out = static_cast<unsigned char*>(dst);
+      const size_t npixels = raw / 2;
+      nibble_reader r(static_cast<const unsigned char*>(src), n);
+
+      uint16_t previous = 0;
+      size_t i = 0;
+      while (i < npixels) {
+        uint32_t zeros, valid;
+        if (!r.get(zeros) || zeros > npixels - i) {
+          return false;
+        }
+        memset(out + 2 * i, 0, 2 * zeros);
+        i += zeros;
+
+        if (!r.get(valid) || valid > npixels - i || (zeros == 0 && valid == 0)) {
+          return false;
+        }
+        for (uint32_t k = 0; k < valid; ++k, ++i) {
+          uint32_t positive;
+          if (!r.get(positive)) {
+            return false;
+          }
+          const int32_t delta = static_cast<int32_t>(positive >> 1) ^ -static_cast<int32_t>(positive & 1);
+          previous = static_cast<uint16_t>(previous + delta);
+          io::store_le<uint16_t>(out + 2 * i, previous);
+        }
+      }
+
+      return r.is_done();
+    }
+
+  private:
+
+    /** Writes variable-length values as nibbles packed into 32 bit words. */
+    class nibble_writer {
+    public:
+
+      inline nibble_writer(unsigned char *dst, size_t capacity)
+        : _begin(dst), _p(dst), _end(dst + capacity), _word(0), _nibbles(0)
+      {}
+
+      /** Test for space of the given number of nibbles. */
+      inline bool reserve(size_t nibbles) const
+      {
+        return (_nibbles + nibbles + 7) / 8 * 4 <= static_cast<size_t>(_end - _p);
+      }
+
+      /** Write value. Space must have been reserved. */
+      inline void put(uint32_t v)
+      {
+        do {
+          uint32_t nibble = v & 0x7;
+          v >>= 3;
+          if (v) {
+            nibble |= 0x8;
+          }
+          _word = (_word << 4) | nibble;
+          if (++_nibbles == 8) {
+            io::store_le<uint32_t>(_p, _word);
+            _p += 4;
+            _word = 0;
+            _nibbles = 0;
+          }
+        } while (v);
+      }
+
+      /** Flush pending nibbles. Returns the number of bytes written. */
+      inline size_t finish()
+      {
+        if (_nibbles > 0) {
+          io::store_le<uint32_t>(_p, _word << (4 * (8 - _nibbles)));
+          _p += 4;
+        }
+        return _p - _begin;
+      }
+
+    private:
+      unsigned char *_begin, *_p, *_end;
+      uint32_t _word;
+      size_t _nibbles;
+    };
+
+    /** Reads variable-length values written by nibble_writer. */
+    class nibble_reader {
+    public:
+
+      inline nibble_reader(const unsigned char *src, size_t n)
+        : _p(src), _end(src + n), _word(0), _nibbles(0)
+      {}
+
+      /** Read value. Returns false at the end of input or for overlong values. */
+      inline bool get(uint32_t &v)
+      {
+        v = 0;
+        for (int shift = 0; shift < 33; shift += 3) {
+          if (_nibbles == 0) {
+            if (_p == _end) {
+              return false;
+            }
+            _word = io::load_le<uint32_t>(_p);
+            _p += 4;
+            _nibbles = 8;
+          }
+          const uint32_t nibble = _word >> 28;
+          _word <<= 4;
+          --_nibbles;
+
+          v |= (nibble & 0x7) << shift;
+          if (!(nibble & 0x8)) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /** Test that all words were consumed. */
+      inline bool is_done() const
+      {
+        return _p == _end;
+      }
+
+    private:
+      const unsigned char *_p, *_end;
+      uint32_t _word;
+      int _nibbles;
+    };
+
+    /** Test that the payload consists of unpadded rows of 16 bit pixels. */
+    static inline bool is_valid_layout(const codec_layout &l, size_t n)
+    {
+      return l.width > 0 && l.height > 0 && l.step == 2 * l.width &&
+             static_cast<size_t>(l.step) * static_cast<size_t>(l.height) == n;
+    }
+
+    /** Count invalid pixels starting at pixel i. */
+    static inline size_t count_zeros(const unsigned char *in, size_t i, size_t npixels)
+    {
+      const size_t start = i;
+#ifdef IB_HAS_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      while (i + 8 <= npixels) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) != 0xffff) {
+          break;
+        }
+        i += 8;
+      }
+#endif
+      while (i < npixels && in[2 * i] == 0 && in[2 * i + 1] == 0) {
+        ++i;
+      }
+      return i - start;
+    }
+
+    /** Count valid pixels starting at pixel i. */
+    static inline size_t count_valid(const unsigned char *in, size_t i, size_t npixels)
+    {
+      const size_t start = i;
+#ifdef IB_HAS_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      while (i + 8 <= npixels) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) != 0) {
+          break;
+        }
+        i += 8;
+      }
+#endif
+      while (i < npixels && (in[2 * i] != 0 || in[2 * i + 1] != 0)) {
+        ++i;
+      }
+      return i - start;
+    }
+  };
+
+  /** Registry mapping codec identifiers to factories. Receivers use the registry to
+    * create a decoder for the identifier found in an image header. Built-in codecs
+    * are registered by default. Applications register their own codecs under
+    * identifiers from CODEC_USER upwards before receiving. */
+  class codec_registry {
+  public:
+
+    /** Factory function creating a new codec instance. */
+    typedef codec_ptr factory_fn();
+
+    /** Register factory for the given identifier. Replaces any previous registration.
+      * Passing a null factory removes the registration. */
+    static inline void add(uint8_t id, factory_fn *f)
+    {
+      std::lock_guard<std::mutex> lock(get_mutex());
+      get_factories()[id] = f;
+    }
+
+    /** Create a new codec for the given identifier.
+      * \returns empty pointer if no codec is registered under this identifier. */
+    static inline codec_ptr create(uint8_t id)
+    {
+      factory_fn *f = 0;
+      {
+        std::lock_guard<std::mutex> lock(get_mutex());
+        f = get_factories()[id];
+      }
+      return f ? f() : codec_ptr();
+    }
+
+  private:
+
+    /** Create the built-in LZ codec. */
+    static inline codec_ptr create_lz()
+    {
+      return codec_ptr(new lz_codec());
+    }
+
+    /** Get the factory table with built-in codecs registered. */
+    static inline std::vector<factory_fn*> &get_factories()
+    {
+      static std::vector<factory_fn*> factories = make_factories();
+      return factories;
+    }
+
+    /** Create the built-in tile delta codec. Decoders take the tile size 
+      * from the stream. */
+    static inline codec_ptr create_tile_delta()
+    {
+      return codec_ptr(new tile_delta_codec());
+    }
+
+    /** Create the built-in depth codec. */
+    static inline codec_ptr create_rvl()
+    {
+      return codec_ptr(new rvl_codec());
+    }
+
+    /** Build the initial factory table. */
+    static inline std::vector<factory_fn*> make_factories()
+    {
+      std::vector<factory_fn*> f(256, static_cast<factory_fn*>(0));
+      f[CODEC_LZ] = &codec_registry::create_lz;
+      f[CODEC_TILE_DELTA] = &codec_registry::create_tile_delta;
+      f[CODEC_RVL] = &codec_registry::create_rvl;
+      return f;
+    }
+
+    /** Get the mutex guarding the factory table. */
+    static inline std::mutex &get_mutex()
+    {
+      static std::mutex m;
+      return m;
+    }
+  };
+
+  /** Decoders of a single stream by codec identifier. Decoders are created through
+    * the codec_registry on first use and kept, so that stateful codecs continue 
+    * decoding across frames. */
+  class codec_cache {
+  public:
+
+    /** Get the decoder for the given identifier.
+      * \returns empty pointer if no codec is registered under this identifier. */
+    inline const codec_ptr &get(uint8_t id)
+    {
+      codec_ptr &c = _codecs[id];
+      if (!c) {
+        c = codec_registry::create(id);
+      }
+      return c;
+    }
+
+    /** Drop all decoders. */
+    inline void clear()
+    {
+      _codecs.clear();
+    }
+
+  private:
+    std::map<uint8_t, codec_ptr> _codecs;
+  };
+
+}
+
+#endif
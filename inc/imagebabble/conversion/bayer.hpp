@@ -0,0 +1,340 @@
+/*! \file bayer.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#ifndef __IMAGE_BABBLE_CVT_BAYER_HPP_INCLUDED__
+#define __IMAGE_BABBLE_CVT_BAYER_HPP_INCLUDED__
+
+#include "../core.hpp"
+#include "../image_support.hpp"
+#include "../convert.hpp"
+
+namespace imagebabble {
+
+  /** Test whether the format describes a raw Bayer mosaic. */
+  inline bool is_bayer_format(image::eformat f)
+  {
+    return f >= image::FORMAT_BAYER_RGGB_8 && f <= image::FORMAT_BAYER_GBRG_16;
+  }
+
+  /** Get the number of bytes per sample of a Bayer format. */
+  inline int get_bayer_sample_size(image::eformat f)
+  {
+    return (f >= image::FORMAT_BAYER_RGGB_16) ? 2 : 1;
+  }
+
+  namespace bayer {
+
+    /** Color filter at a pixel position. */
+    enum esite {
+      /** Red filter. */
+      SITE_RED,
+      /** Blue filter. */
+      SITE_BLUE,
+      /** Green filter in a row with red filters. */
+      SITE_GREEN_RED_ROW,
+      /** Green filter in a row with blue filters. */
+      SITE_GREEN_BLUE_ROW
+    };
+
+    /** Position of the red filter in the 2x2 cell of a Bayer pattern. */
+    struct pattern {
+      int red_x, red_y;
+
+      /** Get the pattern of a Bayer format. */
+      static inline pattern from_format(image::eformat f)
+      {
+        IB_ASSERT(is_bayer_format(f), ib_error::ECONVERSION);
+        pattern p;
+        switch ((f - image::FORMAT_BAYER_RGGB_8) % 4) {
+        case 0: p.red_x = 0; p.red_y = 0; break;
+        case 1: p.red_x = 1; p.red_y = 1; break;
+        case 2: p.red_x = 1; p.red_y = 0; break;
+        default: p.red_x = 0; p.red_y = 1; break;
+        }
+        return p;
+      }
+
+      /** Get the filter at the given position. */
+      inline esite site(int x, int y) const
+      {
+        const bool red_row = (y & 1) == red_y;
+        const bool red_col = (x & 1) == red_x;
+        if (red_row) {
+          return red_col ? SITE_RED : SITE_GREEN_RED_ROW;
+        } else {
+          return red_col ? SITE_GREEN_BLUE_ROW : SITE_BLUE;
+        }
+      }
+    };
+
+    /** Mirror index at the borders so that the color parity is kept. */
+    inline int reflect(int i, int n)
+    {
+      return (i < 0) ? -i : ((i >= n) ? 2 * n - 2 - i : i);
+    }
+
+    /** Bilinear interpolation from the center sample c, the sum h of the horizontal
+      * neighbors, the sum v of the vertical neighbors and the sum d of the diagonal
+      * neighbors. */
+    template<class T>
+    inline void interpolate(esite s, uint32_t c, uint32_t h, uint32_t v, uint32_t d, T *bgr)
+    {
+      switch (s) {
+      case SITE_RED:
+        bgr[0] = static_cast<T>((d + 2) >> 2);
+        bgr[1] = static_cast<T>((h + v + 2) >> 2);
+        bgr[2] = static_cast<T>(c);
+        break;
+      case SITE_BLUE:
+        bgr[0] = static_cast<T>(c);
+        bgr[1] = static_cast<T>((h + v + 2) >> 2);
+        bgr[2] = static_cast<T>((d + 2) >> 2);
+        break;
+      case SITE_GREEN_RED_ROW:
+        bgr[0] = static_cast<T>((v + 1) >> 1);
+        bgr[1] = static_cast<T>(c);
+        bgr[2] = static_cast<T>((h + 1) >> 1);
+        break;
+      default:
+        bgr[0] = static_cast<T>((h + 1) >> 1);
+        bgr[1] = static_cast<T>(c);
+        bgr[2] = static_cast<T>((v + 1) >> 1);
+        break;
+      }
+    }
+
+    /** Demosaic pixels [x0, x1) of a row given the rows above and below. Columns outside
+      * the image are mirrored. */
+    template<class T>
+    inline void demosaic_span(const T *up, const T *cur, const T *dn, int w, int y,
+                              int x0, int x1, const pattern &p, T *out)
+    {
+      for (int x = x0; x < x1; ++x) {
+        const int l = reflect(x - 1, w), r = reflect(x + 1, w);
+        interpolate(p.site(x, y), cur[x],
+                    uint32_t(cur[l]) + cur[r],
+                    uint32_t(up[x]) + dn[x],
+                    uint32_t(up[l]) + up[r] + dn[l] + dn[r],
+                    out + 3 * x);
+      }
+    }
+
+    /** Vectorized part of a row. Returns the first pixel not processed. */
+    template<class T>
+    inline int demosaic_simd(const T *, const T *, const T *, int, int, const pattern &, T *)
+    {
+      return 0;
+    }
+
+#ifdef IB_HAS_SSE2
+
+    /** Bilinear interpolation of 8 pixels of the same filter in 16 bit lanes. */
+    inline void interpolate(esite s, __m128i c, __m128i h, __m128i v, __m128i d, __m128i &b, __m128i &g, __m128i &r)
+    {
+      const __m128i one = _mm_set1_epi16(1);
+      const __m128i two = _mm_set1_epi16(2);
+      switch (s) {
+      case SITE_RED:
+        b = _mm_srli_epi16(_mm_add_epi16(d, two), 2);
+        g = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(h, v), two), 2);
+        r = c;
+        break;
+      case SITE_BLUE:
+        b = c;
+        g = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(h, v), two), 2);
+        r = _mm_srli_epi16(_mm_add_epi16(d, two), 2);
+        break;
+      case SITE_GREEN_RED_ROW:
+        b = _mm_srli_epi16(_mm_add_epi16(v, one), 1);
+        g = c;
+        r = _mm_srli_epi16(_mm_add_epi16(h, one), 1);
+        break;
+      default:
+        b = _mm_srli_epi16(_mm_add_epi16(h, one), 1);
+        g = c;
+        r = _mm_srli_epi16(_mm_add_epi16(v, one), 1);
+        break;
+      }
+    }
+
+    /** Vectorized part of a row of 8 bit samples. Processes 16 pixels per iteration,
+      * split into even and odd pixels held in 16 bit lanes. Starts at pixel 2 so that
+      * neighbors to the left are inside the image. */
+    inline int demosaic_simd(const uint8_t *up, const uint8_t *cur, const uint8_t *dn,
+                             int w, int y, const pattern &p, uint8_t *out)
+    {
+      const esite se = p.site(0, y), so = p.site(1, y);
+      const __m128i even = _mm_set1_epi16(0x00ff);
+
+      int x = 2;
+      for (; x + 17 <= w; x += 16) {
+        const __m128i um = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x - 1));
+        const __m128i u0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+        const __m128i up1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x + 1));
+        const __m128i cm = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x - 1));
+        const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x));
+        const __m128i cp1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x + 1));
+        const __m128i dm = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dn + x - 1));
+        const __m128i d0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dn + x));
+        const __m128i dp1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dn + x + 1));
+
+        // Lane i of even/odd vectors holds pixel x + 2i and x + 2i + 1.
+        const __m128i ce = _mm_and_si128(c0, even), co = _mm_srli_epi16(c0, 8);
+        const __m128i ue = _mm_and_si128(u0, even), uo = _mm_srli_epi16(u0, 8);
+        const __m128i de = _mm_and_si128(d0, even), dO = _mm_srli_epi16(d0, 8);
+
+        const __m128i he = _mm_add_epi16(_mm_and_si128(cm, even), co);
+        const __m128i ho = _mm_add_epi16(ce, _mm_srli_epi16(cp1, 8));
+        const __m128i ve = _mm_add_epi16(ue, de);
+        const __m128i vo = _mm_add_epi16(uo, dO);
+        const __m128i ge = _mm_add_epi16(
+          _mm_add_epi16(_mm_and_si128(um, even), uo),
+          _mm_add_epi16(_mm_and_si128(dm, even), dO));
+        const __m128i go = _mm_add_epi16(
+          _mm_add_epi16(ue, _mm_srli_epi16(up1, 8)),
+          _mm_add_epi16(de, _mm_srli_epi16(dp1, 8)));
+
+        __m128i be, gre, re, bo, gro, ro;
+        interpolate(se, ce, he, ve, ge, be, gre, re);
+        interpolate(so, co, ho, vo, go, bo, gro, ro);
+
+        // Merge even and odd lanes back into pixel order.
+        uint8_t planes[3][16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[0]), _mm_or_si128(be, _mm_slli_epi16(bo, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[1]), _mm_or_si128(gre, _mm_slli_epi16(gro, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[2]), _mm_or_si128(re, _mm_slli_epi16(ro, 8)));
+
+        uint8_t *o = out + 3 * x;
+        for (int i = 0; i < 16; ++i) {
+          o[3 * i + 0] = planes[0][i];
+          o[3 * i + 1] = planes[1][i];
+          o[3 * i + 2] = planes[2][i];
+        }
+      }
+      return x;
+    }
+
+#endif
+
+    /** Demosaic rows [y0, y1). */
+    template<class T>
+    inline void demosaic_rows(const T *src, size_t src_step, int w, int h, const pattern &p,
+                              T *dst, size_t dst_step, int y0, int y1)
+    {
+      for (int y = y0; y < y1; ++y) {
+        const T *up = reinterpret_cast<const T*>(reinterpret_cast<const char*>(src) + reflect(y - 1, h) * src_step);
+        const T *cur = reinterpret_cast<const T*>(reinterpret_cast<const char*>(src) + y * src_step);
+        const T *dn = reinterpret_cast<const T*>(reinterpret_cast<const char*>(src) + reflect(y + 1, h) * src_step);
+        T *out = reinterpret_cast<T*>(reinterpret_cast<char*>(dst) + y * dst_step);
+
+        const int x = demosaic_simd(up, cur, dn, w, y, p, out);
+        if (x > 0) {
+          demosaic_span(up, cur, dn, w, y, 0, 2, p, out);
+          demosaic_span(up, cur, dn, w, y, x, w, p, out);
+        } else {
+          demosaic_span(up, cur, dn, w, y, 0, w, p, out);
+        }
+      }
+    }
+
+    /** Demosaic a band of rows, see parallel_rows. */
+    template<class T>
+    struct band {
+      const T *src;
+      size_t src_step;
+      int w, h;
+      pattern p;
+      T *dst;
+      size_t dst_step;
+
+      inline void operator()(int y0, int y1) const
+      {
+        demosaic_rows(src, src_step, w, h, p, dst, dst_step, y0, y1);
+      }
+    };
+  }
+
+  /** Demosaic a raw Bayer mosaic into interleaved BGR samples by bilinear interpolation.
+    * 8 bit samples are processed using SSE2 when available. Rows are split among
+    * threads.
+    *
+    * \param [in] src first sample of the mosaic.
+    * \param [in] src_step number of bytes between two rows of the mosaic.
+    * \param [in] w number of pixels in width, at least 2.
+    * \param [in] h number of pixels in height, at least 2.
+    * \param [in] f Bayer format describing the filter arrangement.
+    * \param [out] dst first sample of the BGR output of w*h*3 samples.
+    * \param [in] dst_step number of bytes between two rows of the output.
+    * \param [in] num_threads number of threads to use, zero to decide by image size.
+    * \throws ib_error if the format is not a Bayer format or the image is too small.
+    */
+  template<class T>
+  inline void demosaic_bgr(const T *src, size_t src_step, int w, int h, image::eformat f,
+                           T *dst, size_t dst_step, int num_threads = 0)
+  {
+    IB_ASSERT(w >= 2 && h >= 2, ib_error::EPARAMRANGE);
+    const bayer::pattern p = bayer::pattern::from_format(f);
+
+    const bayer::band<T> b = {src, src_step, w, h, p, dst, dst_step};
+    parallel_rows(w, h, num_threads, b);
+  }
+
+  /** Demosaic a Bayer image into a newly allocated BGR image. Images of 8 bit samples
+    * result in image::FORMAT_BGR_888, images of 16 bit samples in three interleaved
+    * 16 bit channels of image::FORMAT_UNKNOWN. Flags, sequence number and timestamp
+    * are kept. \see demosaic_bgr
+    */
+  inline void demosaic(const image &src, image &dst, int num_threads = 0)
+  {
+    IB_ASSERT(is_bayer_format(src.get_format()), ib_error::ECONVERSION);
+
+    const int w = src.get_width(), h = src.get_height();
+    const int size = get_bayer_sample_size(src.get_format());
+    IB_ASSERT(src.size() >= static_cast<size_t>(src.get_step()) * h &&
+              src.get_step() >= w * size, ib_error::ECONVERSION);
+
+    image out(w, h, w * 3 * size);
+    out.set_format(size == 1 ? image::FORMAT_BGR_888 : image::FORMAT_UNKNOWN);
+    out.set_flags(src.get_flags());
+    out.set_sequence(src.get_sequence());
+    out.set_timestamp(src.get_timestamp());
+
+    if (size == 1) {
+      demosaic_bgr(src.ptr<uint8_t>(), src.get_step(), w, h, src.get_format(),
+                   out.ptr<uint8_t>(), out.get_step(), num_threads);
+    } else {
+      demosaic_bgr(src.ptr<uint16_t>(), src.get_step(), w, h, src.get_format(),
+                   out.ptr<uint16_t>(), out.get_step(), num_threads);
+    }
+
+    dst = out;
+  }
+
+}
+
+#endif
@@ -31,6 +31,8 @@
 
 #include "../core.hpp"
 #include "../image_support.hpp"
+#include "../convert.hpp"
+#include "bayer.hpp"
 
 #include <opencv2/core/core.hpp>
 
@@ -45,6 +47,9 @@ namespace imagebabble {
       case CV_8UC3:
         to.set_format(image::FORMAT_BGR_888);
         break;
+      case CV_8UC4:
+        to.set_format(image::FORMAT_BGRA_8888);
+        break;
       case CV_8UC1:
         to.set_format(image::FORMAT_GRAY_8);
         break;
@@ -52,20 +57,72 @@ namespace imagebabble {
     to.set_external_type(src.type());
   }
 
-  /** Convert from image to OpenCV matrix. */
+  /** Demosaic a Bayer image into a BGR OpenCV matrix of 8 or 16 bit channels. */
+  inline void cvt_bayer_image(const image &src, cv::Mat &to, int num_threads = 0)
+  {
+    const int size = get_bayer_sample_size(src.get_format());
+    if (src.size() < static_cast<size_t>(src.get_step()) * src.get_height() ||
+        src.get_step() < src.get_width() * size) 
+    {
+      throw ib_error(ib_error::ECONVERSION);
+    }
+
+    if (size == 1) {
+      to.create(src.get_height(), src.get_width(), CV_8UC3);
+      demosaic_bgr(src.ptr<uint8_t>(), src.get_step(), src.get_width(), src.get_height(), 
+                   src.get_format(), to.ptr<uint8_t>(), to.step, num_threads);
+    } else {
+      to.create(src.get_height(), src.get_width(), CV_16UC3);
+      demosaic_bgr(src.ptr<uint16_t>(), src.get_step(), src.get_width(), src.get_height(), 
+                   src.get_format(), to.ptr<uint16_t>(), to.step, num_threads);
+    }
+  }
+
+  /** Convert an image whose pixel layout has no OpenCV counterpart to BGR, or BGRA if
+    * the image has an alpha channel. */
+  inline void cvt_foreign_image(const image &src, cv::Mat &to)
+  {
+    const image::eformat f = src.get_format();
+    if (is_bayer_format(f)) {
+      cvt_bayer_image(src, to);
+      return;
+    }
+
+    const image::eformat target = (f == image::FORMAT_RGBA_8888) ? image::FORMAT_BGRA_8888 : image::FORMAT_BGR_888;
+    if (!can_convert(f, target) || 
+        src.size() < image::get_buffer_size(f, src.get_height(), src.get_step())) 
+    {
+      throw ib_error(ib_error::ECONVERSION);
+    }
+
+    to.create(src.get_height(), src.get_width(), (target == image::FORMAT_BGR_888) ? CV_8UC3 : CV_8UC4);
+    convert_pixels(src.ptr<void>(), src.get_step(), f, to.data, to.step, target, 
+                   src.get_width(), src.get_height());
+  }
+
+  /** Convert from image to OpenCV matrix. Bayer, RGB and YUV images are converted to BGR,
+    * RGBA images to BGRA. */
   inline void cvt_image(const image &src, cv::Mat &to, const copy_mem &m) 
   {
     switch (src.get_format()) {
     case image::FORMAT_BGR_888:
-    case image::FORMAT_RGB_888:
       to.create(src.get_height(), src.get_width(), CV_8UC3);
       break;
+    case image::FORMAT_BGRA_8888:
+      to.create(src.get_height(), src.get_width(), CV_8UC4);
+      break;
     case image::FORMAT_GRAY_8:
       to.create(src.get_height(), src.get_width(), CV_8UC1);
       break;
+    case image::FORMAT_DEPTH_16:
+      to.create(src.get_height(), src.get_width(), CV_16UC1);
+      break;
     case image::FORMAT_UNKNOWN:
       to.create(src.get_height(), src.get_width(), src.get_external_type());
       break;
+    default:
+      cvt_foreign_image(src, to);
+      return;
     }
 
     if ((to.rows * to.step) != src.size()) {
@@ -75,19 +132,22 @@ namespace imagebabble {
     memcpy(to.data, src.ptr<void>(), src.size());    
   }
 
-  /** Convert from image to OpenCV matrix. */
+  /** Convert from image to OpenCV matrix. Bayer, RGB and YUV images cannot share memory, 
+    * they are converted to BGR into newly allocated memory instead, RGBA images to BGRA. */
   inline void cvt_image(const image &src, cv::Mat &to, const share_mem &m) 
   {
     int type = -1;
 
     switch (src.get_format()) {
     case image::FORMAT_BGR_888:
-    case image::FORMAT_RGB_888:
       type = CV_8UC3;
       break;
     case image::FORMAT_GRAY_8:
       type = CV_8UC1;
       break;
+    case image::FORMAT_BGRA_8888:
+      type = CV_8UC4;
+      break;
     case image::FORMAT_DEPTH_16:
       type = CV_16UC1;
       break;
@@ -96,7 +156,8 @@ namespace imagebabble {
       type = src.get_external_type();
       break;
     default:
-      throw ib_error(ib_error::ECONVERSION);
+      cvt_foreign_image(src, to);
+      return;
     }
 
     to = cv::Mat( 
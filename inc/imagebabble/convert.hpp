@@ -0,0 +1,825 @@
+/*! \file convert.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+
+#ifndef __IMAGE_BABBLE_CONVERT_HPP_INCLUDED__
+#define __IMAGE_BABBLE_CONVERT_HPP_INCLUDED__
+
+#include "core.hpp"
+#include "image_support.hpp"
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#if defined(IB_HAS_SSE2) && (defined(__GNUC__) || defined(_MSC_VER))
+/** Whether SSSE3 and AVX2 kernels are compiled and selected at runtime. */
+#define IB_HAS_X86_DISPATCH
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define IB_TARGET_SSSE3
+#define IB_TARGET_AVX2
+#else
+#define IB_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define IB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+/** Whether NEON instructions are available at compile time. */
+#define IB_HAS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace imagebabble {
+
+  /** Instruction sets used by pixel format conversions, in ascending order of preference. */
+  enum esimd {
+    /** Portable scalar code. */
+    SIMD_NONE,
+    /** x86 SSE2. */
+    SIMD_SSE2,
+    /** x86 SSSE3. */
+    SIMD_SSSE3,
+    /** x86 AVX2. */
+    SIMD_AVX2,
+    /** ARM NEON. */
+    SIMD_NEON
+  };
+
+  namespace pixel {
+
+    /** Query the instruction sets supported by the running processor. */
+    inline esimd detect_simd()
+    {
+#if defined(IB_HAS_X86_DISPATCH) && defined(_MSC_VER)
+      int r[4];
+      __cpuid(r, 1);
+      const bool ssse3 = (r[2] & (1 << 9)) != 0;
+      const bool avx = (r[2] & (1 << 27)) != 0 && (r[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+      __cpuidex(r, 7, 0);
+      const bool avx2 = avx && (r[1] & (1 << 5)) != 0;
+      return avx2 ? SIMD_AVX2 : (ssse3 ? SIMD_SSSE3 : SIMD_SSE2);
+#elif defined(IB_HAS_X86_DISPATCH)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+      }
+      return __builtin_cpu_supports("ssse3") ? SIMD_SSSE3 : SIMD_SSE2;
+#elif defined(IB_HAS_NEON)
+      return SIMD_NEON;
+#else
+      return SIMD_NONE;
+#endif
+    }
+
+    /** Get the highest instruction set conversions may use. */
+    inline esimd &get_simd_limit()
+    {
+      static esimd limit = SIMD_NEON;
+      return limit;
+    }
+
+  }
+
+  /** Get the instruction set used by pixel format conversions. */
+  inline esimd get_simd_level()
+  {
+    static const esimd detected = pixel::detect_simd();
+    return std::min(detected, pixel::get_simd_limit());
+  }
+
+  /** Restrict the instruction set used by pixel format conversions. Pass SIMD_NONE to
+    * select the portable implementation, for example to compare results. */
+  inline void set_simd_limit(esimd limit)
+  {
+    pixel::get_simd_limit() = limit;
+  }
+
+  /** Run f(y0, y1) over bands of rows [0, h) of an image of w pixels in width. Without
+    * an explicit number of threads, frames of at least 256k pixels are split into one
+    * band per core. Bands span at least 64 rows. The calling thread processes the
+    * first band. */
+  template<class F>
+  inline void parallel_rows(int w, int h, int num_threads, const F &f)
+  {
+    if (num_threads <= 0) {
+      num_threads = (static_cast<size_t>(w) * h >= (1u << 18)) ?
+        static_cast<int>(std::thread::hardware_concurrency()) : 1;
+    }
+    num_threads = std::max(1, std::min(num_threads, h / 64));
+
+    std::vector<std::thread> threads;
+    const int band = (h + num_threads - 1) / num_threads;
+    for (int i = 1; i < num_threads; ++i) {
+      const int y0 = i * band, y1 = std::min(h, y0 + band);
+      if (y0 < y1) {
+        threads.push_back(std::thread(f, y0, y1));
+      }
+    }
+    f(0, std::min(h, band));
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+      threads[i].join();
+    }
+  }
+
+  namespace pixel {
+
+    /** Rearrangement of bytes from one packed 8 bit format into another. */
+    struct shuffle_spec {
+      /** Bytes per source pixel. */
+      int src_bpp;
+      /** Bytes per destination pixel. */
+      int dst_bpp;
+      /** Source byte per destination byte, -1 for an opaque alpha value. */
+      int index[4];
+    };
+
+    /** Byte offsets of blue, green, red and alpha in a pixel, -1 if absent. */
+    struct channels {
+      int bpp;
+      int pos[4];
+    };
+
+    /** Get channel offsets of RGB family formats. Gray provides the same byte for all colors. */
+    inline bool get_channels(image::eformat f, channels &c)
+    {
+      static const int table[5][5] = {
+        {3, 2, 1, 0, -1},   // RGB
+        {3, 0, 1, 2, -1},   // BGR
+        {4, 2, 1, 0, 3},    // RGBA
+        {4, 0, 1, 2, 3},    // BGRA
+        {1, 0, 0, 0, -1}    // GRAY
+      };
+      int row;
+      switch (f) {
+      case image::FORMAT_RGB_888: row = 0; break;
+      case image::FORMAT_BGR_888: row = 1; break;
+      case image::FORMAT_RGBA_8888: row = 2; break;
+      case image::FORMAT_BGRA_8888: row = 3; break;
+      case image::FORMAT_GRAY_8: row = 4; break;
+      default: return false;
+      }
+      c.bpp = table[row][0];
+      std::copy(table[row] + 1, table[row] + 5, c.pos);
+      return true;
+    }
+
+    /** Test for packed YUV 4:2:2 formats. */
+    inline bool is_packed_yuv(image::eformat f)
+    {
+      return f == image::FORMAT_YUYV || f == image::FORMAT_UYVY;
+    }
+
+    /** Test for planar YUV 4:2:0 formats. */
+    inline bool is_planar_yuv(image::eformat f)
+    {
+      return f == image::FORMAT_NV12 || f == image::FORMAT_I420;
+    }
+
+    /** Describe a conversion that only moves bytes. */
+    inline bool make_shuffle(image::eformat from, image::eformat to, shuffle_spec &s)
+    {
+      channels cf = channels(), ct = channels();
+      if (get_channels(from, cf) && get_channels(to, ct) && to != image::FORMAT_GRAY_8) {
+        s.src_bpp = cf.bpp;
+        s.dst_bpp = ct.bpp;
+        for (int c = 0; c < 4; ++c) {
+          if (ct.pos[c] >= 0) {
+            s.index[ct.pos[c]] = cf.pos[c];
+          }
+        }
+        return true;
+      }
+
+      // Packed YUV is treated as two bytes per pixel, the luma byte followed or preceeded by chroma.
+      if (is_packed_yuv(from) && (is_packed_yuv(to) || to == image::FORMAT_GRAY_8)) {
+        const int y = (from == image::FORMAT_YUYV) ? 0 : 1;
+        s.src_bpp = 2;
+        s.dst_bpp = (to == image::FORMAT_GRAY_8) ? 1 : 2;
+        s.index[0] = (to == image::FORMAT_UYVY) ? 1 - y : y;
+        s.index[1] = 1 - s.index[0];
+        return true;
+      }
+      return false;
+    }
+
+    /** Build the byte shuffle control for a group of n pixels in 16 bytes. Unused
+      * destination bytes are zeroed, alpha bytes are set by or-ing with the alpha mask. */
+    inline void make_shuffle_mask(const shuffle_spec &s, int n, uint8_t mask[16], uint8_t alpha[16])
+    {
+      memset(mask, 0x80, 16);
+      memset(alpha, 0, 16);
+      for (int p = 0; p < n; ++p) {
+        for (int k = 0; k < s.dst_bpp; ++k) {
+          if (s.index[k] < 0) {
+            alpha[p * s.dst_bpp + k] = 0xff;
+          } else {
+            mask[p * s.dst_bpp + k] = static_cast<uint8_t>(p * s.src_bpp + s.index[k]);
+          }
+        }
+      }
+    }
+
+    /** Get the number of pixels moved by one 16 byte shuffle. */
+    inline int get_shuffle_group(const shuffle_spec &s)
+    {
+      return std::min(16 / s.src_bpp, 16 / s.dst_bpp);
+    }
+
+    /** Luma weights of blue, green and red, summing to 128. */
+    enum { WEIGHT_B = 15, WEIGHT_G = 75, WEIGHT_R = 38 };
+
+    /** Gray value of a color. */
+    inline uint8_t to_gray(int b, int g, int r)
+    {
+      return static_cast<uint8_t>((WEIGHT_B * b + WEIGHT_G * g + WEIGHT_R * r + 64) >> 7);
+    }
+
+    /** Gray value of a depth value given the 16 bit fixed point scale. */
+    inline uint8_t to_gray(uint16_t d, uint32_t scale)
+    {
+      return static_cast<uint8_t>(std::min<uint32_t>(255, (d * scale) >> 16));
+    }
+
+    /** Limit to 8 bits. */
+    inline uint8_t saturate(int v)
+    {
+      return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+
+    /** BT.601 limited range YUV to BGRA with 6 bit fixed point coefficients. */
+    inline void yuv_to_bgra(int y, int u, int v, uint8_t *out)
+    {
+      const int c = 75 * (y - 16) + 32, d = u - 128, e = v - 128;
+      out[0] = saturate((c + 129 * d) >> 6);
+      out[1] = saturate((c - 25 * d - 52 * e) >> 6);
+      out[2] = saturate((c + 102 * e) >> 6);
+      out[3] = 255;
+    }
+
+#ifdef IB_HAS_X86_DISPATCH
+
+    IB_TARGET_SSSE3
+    inline int shuffle_row_ssse3(const uint8_t *s, uint8_t *d, int n, const shuffle_spec &sp, int i)
+    {
+      const int g = get_shuffle_group(sp);
+      uint8_t m[16], a[16];
+      make_shuffle_mask(sp, g, m, a);
+      const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m));
+      const __m128i alpha = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+
+      // Stores write 16 bytes of which the trailing ones are overwritten by the next group.
+      for (; i * sp.src_bpp + 16 <= n * sp.src_bpp && i * sp.dst_bpp + 16 <= n * sp.dst_bpp; i += g) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * sp.src_bpp));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i * sp.dst_bpp),
+                         _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+      }
+      return i;
+    }
+
+    IB_TARGET_AVX2
+    inline int shuffle_row_avx2(const uint8_t *s, uint8_t *d, int n, const shuffle_spec &sp, int i)
+    {
+      const int g = get_shuffle_group(sp);
+      uint8_t m[16], a[16];
+      make_shuffle_mask(sp, g, m, a);
+      const __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m)));
+      const __m256i alpha = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)));
+
+      // Each 128 bit lane holds one group of pixels.
+      for (; (i + g) * sp.src_bpp + 16 <= n * sp.src_bpp && (i + g) * sp.dst_bpp + 16 <= n * sp.dst_bpp; i += 2 * g) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * sp.src_bpp));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + (i + g) * sp.src_bpp));
+        const __m256i v = _mm256_or_si256(
+          _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), mask), alpha);
+        if (g * sp.dst_bpp == 16) {
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i * sp.dst_bpp), v);
+        } else {
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i * sp.dst_bpp), _mm256_castsi256_si128(v));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(d + (i + g) * sp.dst_bpp), _mm256_extracti128_si256(v, 1));
+        }
+      }
+      return i;
+    }
+
+    /** Build the control that spreads four pixels to blue, green, red and zero bytes. */
+    inline void make_gray_mask(const channels &c, uint8_t mask[16])
+    {
+      for (int p = 0; p < 4; ++p) {
+        for (int k = 0; k < 3; ++k) {
+          mask[p * 4 + k] = static_cast<uint8_t>(p * c.bpp + c.pos[k]);
+        }
+        mask[p * 4 + 3] = 0x80;
+      }
+    }
+
+    IB_TARGET_SSSE3
+    inline int gray_row_ssse3(const uint8_t *s, uint8_t *d, int n, const channels &c, int i)
+    {
+      uint8_t m[16];
+      make_gray_mask(c, m);
+      const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m));
+      const __m128i weights = _mm_set1_epi32(WEIGHT_B | (WEIGHT_G << 8) | (WEIGHT_R << 16));
+      const __m128i round = _mm_set1_epi16(64);
+
+      for (; (i + 4) * c.bpp + 16 <= n * c.bpp && i + 8 <= n; i += 8) {
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * c.bpp)), mask);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + (i + 4) * c.bpp)), mask);
+        // Pairwise products give blue+green and red per pixel, the horizontal add completes the sum.
+        __m128i y = _mm_hadd_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights));
+        y = _mm_srli_epi16(_mm_add_epi16(y, round), 7);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(d + i), _mm_packus_epi16(y, y));
+      }
+      return i;
+    }
+
+    IB_TARGET_AVX2
+    inline int gray_row_avx2(const uint8_t *s, uint8_t *d, int n, const channels &c, int i)
+    {
+      uint8_t m[16];
+      make_gray_mask(c, m);
+      const __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m)));
+      const __m256i weights = _mm256_set1_epi32(WEIGHT_B | (WEIGHT_G << 8) | (WEIGHT_R << 16));
+      const __m256i round = _mm256_set1_epi16(64);
+
+      for (; (i + 12) * c.bpp + 16 <= n * c.bpp && i + 16 <= n; i += 16) {
+        // Lanes hold pixels 0-3 and 8-11 respectively 4-7 and 12-15, so that the
+        // lane-wise horizontal add yields pixels in order.
+        const __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * c.bpp))),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + (i + 8) * c.bpp)), 1);
+        const __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + (i + 4) * c.bpp))),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + (i + 12) * c.bpp)), 1);
+        __m256i y = _mm256_hadd_epi16(
+          _mm256_maddubs_epi16(_mm256_shuffle_epi8(a, mask), weights),
+          _mm256_maddubs_epi16(_mm256_shuffle_epi8(b, mask), weights));
+        y = _mm256_srli_epi16(_mm256_add_epi16(y, round), 7);
+        y = _mm256_permute4x64_epi64(_mm256_packus_epi16(y, _mm256_setzero_si256()), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm256_castsi256_si128(y));
+      }
+      return i;
+    }
+
+    inline int depth_row_sse2(const uint16_t *s, uint8_t *d, int n, uint32_t scale, int i)
+    {
+      const __m128i k = _mm_set1_epi16(static_cast<short>(scale));
+      const __m128i max = _mm_set1_epi16(255);
+      for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)), k);
+        __m128i b = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 8)), k);
+        // Unsigned minimum by saturating subtraction.
+        a = _mm_subs_epu16(a, _mm_subs_epu16(a, max));
+        b = _mm_subs_epu16(b, _mm_subs_epu16(b, max));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_packus_epi16(a, b));
+      }
+      return i;
+    }
+
+    IB_TARGET_AVX2
+    inline int depth_row_avx2(const uint16_t *s, uint8_t *d, int n, uint32_t scale, int i)
+    {
+      const __m256i k = _mm256_set1_epi16(static_cast<short>(scale));
+      const __m256i max = _mm256_set1_epi16(255);
+      for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_min_epu16(_mm256_mulhi_epu16(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)), k), max);
+        const __m256i b = _mm256_min_epu16(_mm256_mulhi_epu16(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 16)), k), max);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i),
+          _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+      }
+      return i;
+    }
+
+    /** Convert eight pixels of 16 bit Y, U and V lanes to BGRA. */
+    inline void yuv_to_bgra_sse2(__m128i y, __m128i u, __m128i v, uint8_t *out)
+    {
+      const __m128i c = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(75)), _mm_set1_epi16(32));
+      const __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+      const __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+      // Blue may exceed 16 bits only when it saturates anyway.
+      const __m128i b = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129))), 6);
+      const __m128i g = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25))),
+                                                     _mm_mullo_epi16(e, _mm_set1_epi16(52))), 6);
+      const __m128i r = _mm_srai_epi16(_mm_add_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102))), 6);
+
+      const __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+      const __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_set1_epi8(-1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(bg, ra));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    /** Duplicate U respectively V of interleaved 16 bit chroma lanes U0 V0 U1 V1 .. to each pixel. */
+    inline void split_chroma_sse2(__m128i uv, __m128i &u, __m128i &v)
+    {
+      u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+      v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    }
+
+    inline int packed_yuv_row_sse2(const uint8_t *s, bool yuyv, uint8_t *d, int n)
+    {
+      const __m128i low = _mm_set1_epi16(0x00ff);
+      int i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 2));
+        const __m128i lo = _mm_and_si128(p, low), hi = _mm_srli_epi16(p, 8);
+        __m128i u, v;
+        split_chroma_sse2(yuyv ? hi : lo, u, v);
+        yuv_to_bgra_sse2(yuyv ? lo : hi, u, v, d + i * 4);
+      }
+      return i;
+    }
+
+    inline int planar_yuv_row_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool nv12, uint8_t *d, int n)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      int i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + i)), zero);
+        __m128i uu, vv;
+        if (nv12) {
+          split_chroma_sse2(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + i)), zero), uu, vv);
+        } else {
+          int32_t u4, v4;
+          memcpy(&u4, u + i / 2, 4);
+          memcpy(&v4, v + i / 2, 4);
+          uu = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), zero);
+          vv = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero);
+          uu = _mm_unpacklo_epi16(uu, uu);
+          vv = _mm_unpacklo_epi16(vv, vv);
+        }
+        yuv_to_bgra_sse2(yy, uu, vv, d + i * 4);
+      }
+      return i;
+    }
+
+#endif
+
+#ifdef IB_HAS_NEON
+
+    inline int shuffle_row_neon(const uint8_t *s, uint8_t *d, int n, const shuffle_spec &sp, int i)
+    {
+      const int g = get_shuffle_group(sp);
+      uint8_t m[16], a[16];
+      make_shuffle_mask(sp, g, m, a);
+      const uint8x16_t mask = vld1q_u8(m), alpha = vld1q_u8(a);
+      for (; i * sp.src_bpp + 16 <= n * sp.src_bpp && i * sp.dst_bpp + 16 <= n * sp.dst_bpp; i += g) {
+        vst1q_u8(d + i * sp.dst_bpp, vorrq_u8(vqtbl1q_u8(vld1q_u8(s + i * sp.src_bpp), mask), alpha));
+      }
+      return i;
+    }
+
+    inline int depth_row_neon(const uint16_t *s, uint8_t *d, int n, uint32_t scale, int i)
+    {
+      const uint16x4_t k = vdup_n_u16(static_cast<uint16_t>(scale));
+      for (; i + 8 <= n; i += 8) {
+        const uint16x8_t v = vld1q_u16(s + i);
+        const uint16x8_t p = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(v), k), 16),
+                                          vshrn_n_u32(vmull_u16(vget_high_u16(v), k), 16));
+        vst1_u8(d + i, vqmovn_u16(p));
+      }
+      return i;
+    }
+
+#endif
+
+    /** Move bytes of n pixels. */
+    inline void shuffle_row(const uint8_t *s, uint8_t *d, int n, const shuffle_spec &sp, esimd level)
+    {
+      int i = 0;
+#if defined(IB_HAS_X86_DISPATCH)
+      if (level >= SIMD_AVX2) {
+        i = shuffle_row_avx2(s, d, n, sp, i);
+      }
+      if (level >= SIMD_SSSE3) {
+        i = shuffle_row_ssse3(s, d, n, sp, i);
+      }
+#elif defined(IB_HAS_NEON)
+      if (level >= SIMD_NEON) {
+        i = shuffle_row_neon(s, d, n, sp, i);
+      }
+#endif
+      for (; i < n; ++i) {
+        for (int k = 0; k < sp.dst_bpp; ++k) {
+          d[i * sp.dst_bpp + k] = (sp.index[k] < 0) ? 255 : s[i * sp.src_bpp + sp.index[k]];
+        }
+      }
+    }
+
+    /** Convert n color pixels to gray. */
+    inline void gray_row(const uint8_t *s, uint8_t *d, int n, const channels &c, esimd level)
+    {
+      int i = 0;
+#if defined(IB_HAS_X86_DISPATCH)
+      if (level >= SIMD_AVX2) {
+        i = gray_row_avx2(s, d, n, c, i);
+      }
+      if (level >= SIMD_SSSE3) {
+        i = gray_row_ssse3(s, d, n, c, i);
+      }
+#endif
+      for (; i < n; ++i) {
+        const uint8_t *p = s + i * c.bpp;
+        d[i] = to_gray(p[c.pos[0]], p[c.pos[1]], p[c.pos[2]]);
+      }
+    }
+
+    /** Scale n depth values to gray. */
+    inline void depth_row(const uint16_t *s, uint8_t *d, int n, uint32_t scale, esimd level)
+    {
+      int i = 0;
+#if defined(IB_HAS_X86_DISPATCH)
+      if (level >= SIMD_AVX2) {
+        i = depth_row_avx2(s, d, n, scale, i);
+      }
+      if (level >= SIMD_SSE2) {
+        i = depth_row_sse2(s, d, n, scale, i);
+      }
+#elif defined(IB_HAS_NEON)
+      if (level >= SIMD_NEON) {
+        i = depth_row_neon(s, d, n, scale, i);
+      }
+#endif
+      for (; i < n; ++i) {
+        d[i] = to_gray(s[i], scale);
+      }
+    }
+
+    /** Convert n packed YUV 4:2:2 pixels to BGRA. */
+    inline void packed_yuv_row(const uint8_t *s, bool yuyv, uint8_t *d, int n, esimd level)
+    {
+      int i = 0;
+#if defined(IB_HAS_X86_DISPATCH)
+      if (level >= SIMD_SSE2) {
+        i = packed_yuv_row_sse2(s, yuyv, d, n);
+      }
+#endif
+      const int y = yuyv ? 0 : 1, c = 1 - y;
+      for (; i < n; i += 2) {
+        const uint8_t *p = s + i * 2;
+        yuv_to_bgra(p[y], p[c], p[c + 2], d + i * 4);
+        yuv_to_bgra(p[y + 2], p[c], p[c + 2], d + i * 4 + 4);
+      }
+    }
+
+    /** Convert n planar YUV 4:2:0 pixels to BGRA. For NV12, u points to interleaved chroma. */
+    inline void planar_yuv_row(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool nv12,
+                               uint8_t *d, int n, esimd level)
+    {
+      int i = 0;
+#if defined(IB_HAS_X86_DISPATCH)
+      if (level >= SIMD_SSE2) {
+        i = planar_yuv_row_sse2(y, u, v, nv12, d, n);
+      }
+#endif
+      for (; i < n; i += 2) {
+        const int cu = nv12 ? u[i] : u[i / 2], cv = nv12 ? u[i + 1] : v[i / 2];
+        yuv_to_bgra(y[i], cu, cv, d + i * 4);
+        yuv_to_bgra(y[i + 1], cu, cv, d + i * 4 + 4);
+      }
+    }
+
+    /** Steps of a conversion. */
+    enum ekind {
+      /** Copy rows of a packed format. */
+      KIND_COPY,
+      /** Copy luma and chroma rows of a planar format. */
+      KIND_COPY_PLANAR,
+      /** Move bytes. */
+      KIND_SHUFFLE,
+      /** Weight colors to gray. */
+      KIND_GRAY,
+      /** Scale depth to gray, then move bytes unless the target is gray. */
+      KIND_DEPTH,
+      /** Convert YUV to BGRA, then move bytes unless the target is BGRA. */
+      KIND_YUV
+    };
+
+    /** A conversion of rows between two formats. */
+    struct job {
+      ekind kind;
+      image::eformat from, to;
+      const uint8_t *src;
+      size_t src_step;
+      uint8_t *dst;
+      size_t dst_step;
+      int w, h;
+      shuffle_spec shuffle;
+      channels colors;
+      uint32_t depth_scale;
+      esimd level;
+
+      /** Plan the conversion. Returns false if the formats are not supported. */
+      inline bool plan(image::eformat f, image::eformat t)
+      {
+        from = f;
+        to = t;
+        if (f == t) {
+          kind = is_planar_yuv(f) ? KIND_COPY_PLANAR : KIND_COPY;
+          return f != image::FORMAT_UNKNOWN;
+        }
+        if (make_shuffle(f, t, shuffle)) {
+          kind = KIND_SHUFFLE;
+          return true;
+        }
+        if (t == image::FORMAT_GRAY_8 && get_channels(f, colors)) {
+          kind = KIND_GRAY;
+          return true;
+        }
+        if (t == image::FORMAT_GRAY_8 && is_planar_yuv(f)) {
+          kind = KIND_COPY;
+          return true;
+        }
+        if (f == image::FORMAT_DEPTH_16) {
+          kind = KIND_DEPTH;
+          return make_shuffle(image::FORMAT_GRAY_8, t, shuffle) || t == image::FORMAT_GRAY_8;
+        }
+        if (is_packed_yuv(f) || is_planar_yuv(f)) {
+          kind = KIND_YUV;
+          return make_shuffle(image::FORMAT_BGRA_8888, t, shuffle) || t == image::FORMAT_BGRA_8888;
+        }
+        return false;
+      }
+
+      /** Convert rows [y0, y1). */
+      inline void operator()(int y0, int y1) const
+      {
+        std::vector<uint8_t> tmp;
+        if (kind == KIND_DEPTH || kind == KIND_YUV) {
+          tmp.resize(static_cast<size_t>(w) * 4);
+        }
+
+        const size_t chroma_rows = static_cast<size_t>(h + 1) / 2;
+        const uint8_t *chroma = src + src_step * h;
+
+        for (int y = y0; y < y1; ++y) {
+          const uint8_t *s = src + y * src_step;
+          uint8_t *d = dst + y * dst_step;
+
+          switch (kind) {
+          case KIND_COPY:
+            memcpy(d, s, static_cast<size_t>(w) * get_bytes_per_pixel(from));
+            break;
+          case KIND_COPY_PLANAR:
+            memcpy(d, s, w);
+            if ((y & 1) == 0 && from == image::FORMAT_NV12) {
+              memcpy(dst + dst_step * h + (y / 2) * dst_step, chroma + (y / 2) * src_step, w);
+            } else if ((y & 1) == 0) {
+              const size_t ss = src_step / 2, ds = dst_step / 2;
+              uint8_t *dc = dst + dst_step * h;
+              memcpy(dc + (y / 2) * ds, chroma + (y / 2) * ss, w / 2);
+              memcpy(dc + chroma_rows * ds + (y / 2) * ds, chroma + chroma_rows * ss + (y / 2) * ss, w / 2);
+            }
+            break;
+          case KIND_SHUFFLE:
+            shuffle_row(s, d, w, shuffle, level);
+            break;
+          case KIND_GRAY:
+            gray_row(s, d, w, colors, level);
+            break;
+          case KIND_DEPTH:
+            if (to == image::FORMAT_GRAY_8) {
+              depth_row(reinterpret_cast<const uint16_t*>(s), d, w, depth_scale, level);
+            } else {
+              depth_row(reinterpret_cast<const uint16_t*>(s), &tmp[0], w, depth_scale, level);
+              shuffle_row(&tmp[0], d, w, shuffle, level);
+            }
+            break;
+          case KIND_YUV: {
+            uint8_t *bgra = (to == image::FORMAT_BGRA_8888) ? d : &tmp[0];
+            if (is_packed_yuv(from)) {
+              packed_yuv_row(s, from == image::FORMAT_YUYV, bgra, w, level);
+            } else if (from == image::FORMAT_NV12) {
+              planar_yuv_row(s, chroma + (y / 2) * src_step, 0, true, bgra, w, level);
+            } else {
+              const size_t ss = src_step / 2;
+              planar_yuv_row(s, chroma + (y / 2) * ss, chroma + chroma_rows * ss + (y / 2) * ss,
+                             false, bgra, w, level);
+            }
+            if (bgra != d) {
+              shuffle_row(bgra, d, w, shuffle, level);
+            }
+            break;
+          }
+          }
+        }
+      }
+    };
+
+  }
+
+  /** Options of pixel format conversions. */
+  struct convert_options {
+    /** Number of threads, zero to decide by image size. Default is zero. */
+    int num_threads;
+    /** Depth value mapped to the brightest gray level when converting
+      * image::FORMAT_DEPTH_16, in [256, 65535]. Larger depths saturate. Default is 65535. */
+    int depth_max;
+
+    /** Construct default options. */
+    inline convert_options() : num_threads(0), depth_max(65535) {}
+  };
+
+  /** Test whether pixels of one format can be converted into another.
+    *
+    * Supported are conversions among image::FORMAT_RGB_888, image::FORMAT_BGR_888,
+    * image::FORMAT_RGBA_8888, image::FORMAT_BGRA_8888 and image::FORMAT_GRAY_8, from
+    * image::FORMAT_DEPTH_16 and the YUV formats to any of those, between image::FORMAT_YUYV
+    * and image::FORMAT_UYVY, and copies of identical formats. */
+  inline bool can_convert(image::eformat from, image::eformat to)
+  {
+    pixel::job j;
+    return j.plan(from, to);
+  }
+
+  /** Convert pixels from one format into another.
+    *
+    * Kernels for SSSE3 and AVX2 are selected at runtime, NEON is used when compiled for
+    * AArch64. Rows of large frames are converted in parallel.
+    *
+    * \param [in] src first byte of the source image.
+    * \param [in] src_step bytes per row of the source, or its luma plane for planar formats.
+    * \param [in] from source format.
+    * \param [out] dst first byte of the destination image.
+    * \param [in] dst_step bytes per row of the destination, or its luma plane for planar formats.
+    * \param [in] to destination format.
+    * \param [in] w number of pixels in width, even for YUV formats.
+    * \param [in] h number of pixels in height.
+    * \param [in] o conversion options.
+    * \throws ib_error if the conversion is not supported or parameters are out of range.
+    */
+  inline void convert_pixels(const void *src, size_t src_step, image::eformat from,
+                             void *dst, size_t dst_step, image::eformat to,
+                             int w, int h, const convert_options &o = convert_options())
+  {
+    pixel::job j;
+    IB_ASSERT(j.plan(from, to), ib_error::ECONVERSION);
+    IB_ASSERT(w >= 0 && h >= 0, ib_error::EPARAMRANGE);
+    IB_ASSERT(o.depth_max >= 256 && o.depth_max <= 65535, ib_error::EPARAMRANGE);
+    IB_ASSERT(w % 2 == 0 || !(pixel::is_packed_yuv(from) || pixel::is_planar_yuv(from)), ib_error::EPARAMRANGE);
+
+    j.src = static_cast<const uint8_t*>(src);
+    j.src_step = src_step;
+    j.dst = static_cast<uint8_t*>(dst);
+    j.dst_step = dst_step;
+    j.w = w;
+    j.h = h;
+    j.depth_scale = ((255u << 16) + o.depth_max - 1) / o.depth_max;
+    j.level = get_simd_level();
+
+    parallel_rows(w, h, o.num_threads, j);
+  }
+
+  /** Convert an image into a newly allocated image of another format. Flags, sequence
+    * number and timestamp are kept. \see convert_pixels */
+  inline void convert_image(const image &src, image &dst, image::eformat to,
+                            const convert_options &o = convert_options())
+  {
+    const int w = src.get_width(), h = src.get_height();
+    IB_ASSERT(src.size() >= image::get_buffer_size(src.get_format(), h, src.get_step()) &&
+              src.get_step() >= w * get_bytes_per_pixel(src.get_format()), ib_error::ECONVERSION);
+
+    image out(w, h, w * get_bytes_per_pixel(to), to);
+    out.set_flags(src.get_flags());
+    out.set_sequence(src.get_sequence());
+    out.set_timestamp(src.get_timestamp());
+
+    convert_pixels(src.ptr<void>(), src.get_step(), src.get_format(),
+                   out.ptr<void>(), out.get_step(), to, w, h, o);
+    dst = out;
+  }
+
+}
+
+#endif
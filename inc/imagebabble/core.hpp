@@ -37,14 +37,39 @@
 #include <string>
 #include <limits>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <chrono>
+#include <typeinfo>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
 
 /** Whether the compiler supports move constructors and assignment operators. */
 #define IB_HAS_RVALUE_REFS ZMQ_HAS_RVALUE_REFS
 
+#ifdef IB_LEGACY_TEXT_ENCODING
 /** The version identification for fast protocol.  */
 #define IB_EXCHANGE_PROTO_FAST_VERSION "f001"    
 /** The version identification for reliable protocol.  */
 #define IB_EXCHANGE_PROTO_RELIABLE_VERSION "r002"
+#else
+/** The version identification for fast protocol.  */
+#define IB_EXCHANGE_PROTO_FAST_VERSION "f003"    
+/** The version identification for reliable protocol.  */
+#define IB_EXCHANGE_PROTO_RELIABLE_VERSION "r004"
+#endif
+
+/** The version identification for fast protocol passing pointers in-process. */
+#define IB_EXCHANGE_PROTO_POINTER_VERSION "p001"
+
+/** The version identification for fast protocol over shared memory. */
+#define IB_EXCHANGE_PROTO_SHM_VERSION "s001"
+
+/** Marker in front of the version of a fast protocol message replayed from a last value cache. */
+#define IB_EXCHANGE_PROTO_FAST_CACHED "c001"
 
 /** Assert expression or throw imagebabble::ib_error */
 #define IB_ASSERT(expr, reason)               \
@@ -152,7 +177,9 @@ namespace imagebabble {
       /** Parameter out of range */
       EPARAMRANGE,
       /** Incompatible talk versions */
-      EWRONGPROTO
+      EWRONGPROTO,
+      /** Shared memory segment could not be created or mapped. */
+      ESHMERROR
     };
 
     /** Construct using unkown error. */
@@ -203,6 +230,8 @@ namespace imagebabble {
         return "Wrong protocol version or type.";
       case EPARAMRANGE:
         return "Parameter is out of range.";
+      case ESHMERROR:
+        return "Shared memory segment unavailable.";
       default:
         return "Unknown error";
       }
@@ -213,6 +242,264 @@ namespace imagebabble {
     ereason _e;
   };
 
+  /** Creates ZMQ contexts. ZMQ performs network I/O for all sockets of a context on 
+    * background I/O threads. Entities constructed without a context create one using
+    * the process wide factory returned by context_factory::instance. Configure it 
+    * before constructing entities. */
+  class context_factory {
+  public:
+
+    /** Construct factory creating contexts with a single I/O thread. */
+    context_factory()
+      : _io_threads(1)
+    {}
+
+    /** Set the number of I/O threads of created contexts. */
+    void set_io_threads(int n)
+    {
+      IB_ASSERT(n >= 0, ib_error::EPARAMRANGE);
+      _io_threads = n;
+    }
+
+    /** Get the number of I/O threads of created contexts. */
+    int get_io_threads() const
+    {
+      return _io_threads;
+    }
+
+    /** Restrict the I/O threads of created contexts to the given CPUs, e.g. those of the 
+      * NUMA node owning the network interface. An empty list removes the restriction. 
+      *
+      * \note ZMQ_THREAD_AFFINITY_CPU_ADD is a draft option of ZMQ 4.2 and later. When ZMQ
+      * is built without draft options, the restriction is silently not applied and I/O 
+      * threads run on any CPU. */
+    void set_cpu_affinity(const std::vector<int> &cpus)
+    {
+      _cpus = cpus;
+    }
+
+    /** Get the CPUs I/O threads of created contexts are restricted to. */
+    const std::vector<int> &get_cpu_affinity() const
+    {
+      return _cpus;
+    }
+
+    /** Create a new context. */
+    context_ptr create() const
+    {
+      context_ptr ctx(new zmq::context_t(_io_threads));
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+      // Applies to I/O threads started with the first socket. Libraries built without
+      // draft options reject the option, the affinity is skipped then.
+      for (size_t i = 0; i < _cpus.size(); ++i) {
+        if (zmq_ctx_set(*ctx, ZMQ_THREAD_AFFINITY_CPU_ADD, _cpus[i]) != 0) {
+          break;
+        }
+      }
+#endif
+      return ctx;
+    }
+
+    /** Get a context shared by all callers. The context is created on first use and 
+      * released when no longer referenced. Entities need to share a context in order 
+      * to communicate on in-process endpoints. */
+    context_ptr get_shared()
+    {
+      std::lock_guard<std::mutex> lock(_shared_mutex);
+
+      context_ptr ctx = _shared.lock();
+      if (!ctx) {
+        ctx = create();
+        _shared = ctx;
+      }
+      return ctx;
+    }
+
+    /** Get the process wide factory. */
+    static context_factory &instance()
+    {
+      static context_factory f;
+      return f;
+    }
+
+  private:
+    int _io_threads;
+    std::vector<int> _cpus;
+    std::weak_ptr<zmq::context_t> _shared;
+    std::mutex _shared_mutex;
+  };
+
+  /** Create a context using the process wide context_factory. */
+  inline context_ptr make_context()
+  {
+    return context_factory::instance().create();
+  }
+
+  /** Create a context with the given number of I/O threads using the settings of the
+    * process wide context_factory otherwise. */
+  inline context_ptr make_context(int io_threads)
+  {
+    context_factory f;
+    f.set_io_threads(io_threads);
+    f.set_cpu_affinity(context_factory::instance().get_cpu_affinity());
+    return f.create();
+  }
+
+  /** Limits the number of bytes held by message parts. Parts are accounted from 
+    * byte_budget::admit until the last reference to their data is released, which is 
+    * detected through the free callback of the message. Unlike high water marks 
+    * counting messages, a budget bounds memory regardless of the size of messages. */
+  class byte_budget {
+  public:
+
+    /** Policies applied when a message does not fit into the budget. */
+    enum epolicy {
+      POLICY_DROP, ///< Drop the message.
+      POLICY_BLOCK ///< Wait for bytes to be released, drop the message on timeout.
+    };
+
+    /** Construct budget of the given number of bytes. A negative timeout waits
+      * indefinitely when blocking. */
+    explicit byte_budget(size_t nbytes, epolicy policy = POLICY_DROP, int timeout_ms = -1)
+      : _state(std::make_shared<state>(nbytes)), _policy(policy), _timeout_ms(timeout_ms), _dropped(0)
+    {}
+
+    /** Get the number of bytes available in total. */
+    size_t get_limit() const
+    {
+      return _state->limit;
+    }
+
+    /** Get the number of bytes currently accounted. */
+    size_t get_used() const
+    {
+      std::lock_guard<std::mutex> lock(_state->mutex);
+      return _state->used;
+    }
+
+    /** Get the policy applied when a message does not fit. */
+    epolicy get_policy() const
+    {
+      return _policy;
+    }
+
+    /** Get the number of messages dropped. */
+    size_t get_num_dropped() const
+    {
+      return _dropped;
+    }
+
+    /** Account all parts of a message. Each part is replaced by a part referencing
+      * the same data, whose release returns the bytes to the budget. Messages larger
+      * than the budget are always dropped.
+      * \returns false if the message was dropped. */
+    bool admit(std::vector<zmq::message_t> &parts)
+    {
+      size_t nbytes = 0;
+      for (size_t i = 0; i < parts.size(); ++i) {
+        nbytes += parts[i].size();
+      }
+
+      if (!_state->reserve(nbytes, (_policy == POLICY_BLOCK) ? _timeout_ms : 0)) {
+        ++_dropped;
+        return false;
+      }
+
+      for (size_t i = 0; i < parts.size(); ++i) {
+        if (parts[i].size() == 0) {
+          continue;
+        }
+
+        tracked_part *p = new tracked_part(_state);
+        p->msg.move(&parts[i]);
+
+        zmq::message_t m(p->msg.data(), p->msg.size(), &byte_budget::release, p);
+        parts[i].move(&m);
+      }
+
+      return true;
+    }
+
+  private:
+
+    /** Accounting shared with parts in flight, which may outlive the budget. */
+    struct state {
+      explicit state(size_t nbytes)
+        : limit(nbytes), used(0)
+      {}
+
+      bool reserve(size_t nbytes, int timeout_ms)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (nbytes > limit) {
+          return false;
+        }
+
+        if (used + nbytes > limit) {
+          if (timeout_ms == 0) {
+            return false;
+          }
+
+          const size_t n = nbytes;
+          auto fits = [this, n]() { return used + n <= limit; };
+          if (timeout_ms < 0) {
+            released.wait(lock, fits);
+          } else if (!released.wait_for(lock, std::chrono::milliseconds(timeout_ms), fits)) {
+            return false;
+          }
+        }
+
+        used += nbytes;
+        return true;
+      }
+
+      void release(size_t nbytes)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          used -= nbytes;
+        }
+        released.notify_all();
+      }
+
+      const size_t limit;
+      size_t used;
+      std::mutex mutex;
+      std::condition_variable released;
+    };
+
+    /** Original part kept alive until the part replacing it is released. */
+    struct tracked_part {
+      explicit tracked_part(const std::shared_ptr<state> &s)
+        : budget(s)
+      {}
+
+      std::shared_ptr<state> budget;
+      zmq::message_t msg;
+    };
+
+    /** Return bytes of a part. Signature matches zmq::free_fn. */
+    static void release(void *, void *hint)
+    {
+      tracked_part *p = static_cast<tracked_part*>(hint);
+      p->budget->release(p->msg.size());
+      delete p;
+    }
+
+    std::shared_ptr<state> _state;
+    epolicy _policy;
+    int _timeout_ms;
+    size_t _dropped;
+
+    /** Disabled copy constructor */
+    byte_budget (const byte_budget &);
+    /** Disabled assignment operator */
+    byte_budget &operator = (const byte_budget &);
+  };
+
+  /** Reference counted pointer to a byte budget. */
+  typedef std::shared_ptr<byte_budget> byte_budget_ptr;
+
   /** Base class for objects communicating via networks. 
     * Servers and clients shall derive from this base. */
   class network_entity {
@@ -220,7 +507,7 @@ namespace imagebabble {
 
     /** Construct from context. */
     network_entity(const context_ptr &c)
-      :_ctx(c), _hwm_snd(-1), _hwm_recv(-1), _no_linger(true)
+      :_ctx(c), _hwm_snd(-1), _hwm_recv(-1), _no_linger(true), _affinity(0)
     {}
 
     /** Destructor. */
@@ -263,6 +550,21 @@ namespace imagebabble {
     void set_max_pending_inbound(int nmessages) {
       _hwm_recv = nmessages;
     }
+
+    /** Select the I/O threads of the context handling connections of this entity. Bit
+      * N of the mask selects thread N, zero selects all threads. Applies to services
+      * and connections started afterwards. */
+    void set_io_affinity(uint64_t mask) {
+      _affinity = mask;
+      if (_s) {
+        IB_CATCH_ZMQ_RETHROW(_s->setsockopt(ZMQ_AFFINITY, &_affinity, sizeof(uint64_t)));
+      }
+    }
+
+    /** Get the I/O thread mask, see network_entity::set_io_affinity. */
+    uint64_t get_io_affinity() const {
+      return _affinity;
+    }
    
   protected:    
 
@@ -283,6 +585,10 @@ namespace imagebabble {
         if (_hwm_recv >= 0) {
           IB_CATCH_ZMQ_RETHROW(_s->setsockopt(ZMQ_RCVHWM, &_hwm_recv, sizeof(int)));
         }
+
+        if (_affinity != 0) {
+          IB_CATCH_ZMQ_RETHROW(_s->setsockopt(ZMQ_AFFINITY, &_affinity, sizeof(uint64_t)));
+        }
       }
     }
       
@@ -294,12 +600,21 @@ namespace imagebabble {
         throw ib_error(ib_error::EWRONGPROTO);
     }
 
+    /** Validate talk-version received as raw message. */
+    void validate_version(const char *build_version, const zmq::message_t &recv_version) 
+    {
+      const size_t n = strlen(build_version);
+      if (recv_version.size() != n || memcmp(recv_version.data(), build_version, n) != 0)
+        throw ib_error(ib_error::EWRONGPROTO);
+    }
+
 
     context_ptr _ctx; ///< ZMQ context
     socket_ptr _s;    ///< ZMQ socket
     int _hwm_snd;     ///< High water mark for outbound messages
     int _hwm_recv;    ///< High water mark for inbound messages
     bool _no_linger;  ///< Discard all messages on shutdown
+    uint64_t _affinity; ///< I/O threads handling connections
 
   private:
     /** Disabled copy constructor */
@@ -314,25 +629,17 @@ namespace imagebabble {
 
     /** Start stopwatch */
     inline stopwatch()
-      : _handle(zmq_stopwatch_start()), _elapsed(0)
+      : _start(std::chrono::steady_clock::now())
     {}
 
-    /** Destroy stopwatch */
-    inline ~stopwatch()
-    {
-      zmq_stopwatch_stop(_handle);
-    }
-
     /** Get elapsed time since construction in milli-seconds */
     inline unsigned long elapsed_msecs() {
-      _elapsed += zmq_stopwatch_stop(_handle);      
-      _handle = zmq_stopwatch_start();      
-      return _elapsed / 1000;
+      return static_cast<unsigned long>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start).count());
     }
 
   private:
-    void *_handle;    
-    unsigned long _elapsed;
+    std::chrono::steady_clock::time_point _start;
   };
 
   /** Helper class to calculate elapsed times and timeouts */
@@ -480,12 +787,16 @@ namespace imagebabble {
     *
     * \tparam T Datatype to publish. Data to be published must either have
     *         a specific send method overload in the imagebabble::io namespace,
-    *         or primitive output stream insertion (operator<<) semantics.
+    *         be trivially copyable or have primitive output stream insertion 
+    *         (operator<<) semantics.
     */
   template<typename T>
   class basic_server : public network_entity {
   public:
     
+    /** Type of data published. */
+    typedef T value_type;
+
     /** Construct from context */
     basic_server(const context_ptr &c)
       : network_entity(c)
@@ -508,13 +819,16 @@ namespace imagebabble {
   /** Base class for clients. 
     *
     * \tparam Data type to receive. Data to be received must either have a specific
-    * imagebabble::io::recv method overload, or primitive output stream
-    * extraction (operator>>) semantics. 
+    * imagebabble::io::recv method overload, be trivially copyable or have primitive 
+    * output stream extraction (operator>>) semantics. 
     */
   template<typename T>
   class basic_client : public network_entity {
   public:
     
+    /** Type of data received. */
+    typedef T value_type;
+
     /** Construct from context */
     basic_client(const context_ptr &c)
       : network_entity(c)
@@ -540,6 +854,43 @@ namespace imagebabble {
     /** Indicator to discard next message part to be received. */
     typedef empty drop;
 
+    /** Test if message content equals the given zero-terminated string. */
+    inline bool is_equal(const zmq::message_t &msg, const char *str)
+    {
+      const size_t n = strlen(str);
+      return msg.size() == n && memcmp(msg.data(), str, n) == 0;
+    }
+
+    /** Test if message content equals the given string. */
+    inline bool is_equal(const zmq::message_t &msg, const std::string &str)
+    {
+      return msg.size() == str.size() && memcmp(msg.data(), str.data(), str.size()) == 0;
+    }
+
+    /** Test if address refers to an in-process endpoint. */
+    inline bool is_inproc_address(const std::string &addr)
+    {
+      return addr.compare(0, 9, "inproc://") == 0;
+    }
+
+    /** Get the subscription filter selecting a single topic. Topics are sent 
+      * followed by a zero byte, which prevents a topic from matching all topics it 
+      * is a prefix of. */
+    inline std::string topic_filter(const std::string &topic)
+    {
+      return std::string(topic).append(1, '\0');
+    }
+
+    /** Test if a subscription filter receives the given topic. */
+    inline bool is_topic_match(const std::string &filter, const std::string &topic)
+    {
+      const size_t n = filter.size();
+      if (n <= topic.size()) {
+        return topic.compare(0, n, filter) == 0;
+      }
+      return n == topic.size() + 1 && filter[n - 1] == '\0' && filter.compare(0, topic.size(), topic) == 0;
+    }
+
     /** Simple in-memory stream buffer. Allows to adapt an istream on an existing buffer. 
       * This avoids costly copy operations of std::ostringstream and std::istringstream.*/      
     class in_memory_buffer : public std::basic_streambuf<char>
@@ -554,8 +905,107 @@ namespace imagebabble {
       }
     };
 
+    /** Store an unsigned integral value in little-endian byte order. The byte-wise
+      * formulation is independent of host endianness and compiles to a plain
+      * store on little-endian machines. */
+    template<class U>
+    inline void store_le(void *dst, U v)
+    {
+      unsigned char *p = static_cast<unsigned char*>(dst);
+      for (size_t i = 0; i < sizeof(U); ++i) {
+        p[i] = static_cast<unsigned char>(v >> (8 * i));
+      }
+    }
+
+    /** Load an unsigned integral value stored in little-endian byte order. */
+    template<class U>
+    inline U load_le(const void *src)
+    {
+      const unsigned char *p = static_cast<const unsigned char*>(src);
+      U v = 0;
+      for (size_t i = 0; i < sizeof(U); ++i) {
+        v |= static_cast<U>(static_cast<U>(p[i]) << (8 * i));
+      }
+      return v;
+    }
+
+    /** Test whether the host stores multi-byte values in little-endian byte order. */
+    inline bool is_host_little_endian()
+    {
+      const uint16_t probe = 1;
+      return *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    }
+
+    /** Selects the wire encoding of a type used by the generic io::send and io::recv 
+      * methods. Types for which this trait is true are sent as a single binary block of 
+      * sizeof(T) bytes. Arithmetic values are stored in little-endian byte order, other 
+      * trivially copyable types are sent as-is. All other types are converted to text 
+      * using stream insertion and extraction operators.
+      *
+      * By default all trivially copyable types except pointers and arrays are encoded
+      * in binary. Specialize this trait to opt out for specific types. Defining
+      * IB_LEGACY_TEXT_ENCODING before including ImageBabble encodes all types as text, 
+      * as done by ImageBabble 0.1.x, which allows talking to peers of that version.
+      */
+    template<class T>
+    struct is_binary_encoded 
+#ifdef IB_LEGACY_TEXT_ENCODING
+      : std::false_type
+#else
+      : std::integral_constant<bool, 
+          std::is_trivially_copyable<T>::value && 
+          !std::is_pointer<T>::value && 
+          !std::is_array<T>::value>
+#endif
+    {};
+
+    /** Selects the encoding of std::vector<T>. When true, the vector is sent as a 
+      * single message part consisting of a 16 byte header followed by the elements
+      * in contiguous memory. Otherwise the vector is sent as a multi-part message with 
+      * one part per element. Defaults to io::is_binary_encoded, except for the 
+      * bit-packed std::vector<bool>. */
+    template<class T>
+    struct is_block_encoded 
+      : std::integral_constant<bool, 
+          is_binary_encoded<T>::value && 
+          !std::is_same<T, bool>::value>
+    {};
+
+    /** Copy a value of n bytes. Arithmetic values are converted to/from little-endian 
+      * byte order on big-endian hosts. */
+    inline void copy_value_bytes(void *dst, const void *src, size_t n, bool arithmetic)
+    {
+      if (!arithmetic || is_host_little_endian()) {
+        memcpy(dst, src, n);
+      } else {
+        const unsigned char *s = static_cast<const unsigned char*>(src);
+        unsigned char *d = static_cast<unsigned char*>(dst);
+        for (size_t i = 0; i < n; ++i) {
+          d[i] = s[n - i - 1];
+        }
+      }
+    }
+
+    /** Copy count values of n bytes each. See io::copy_value_bytes. */
+    inline void copy_array_bytes(void *dst, const void *src, size_t count, size_t n, bool arithmetic)
+    {
+      if (count == 0) {
+        return;
+      } else if (!arithmetic || is_host_little_endian()) {
+        memcpy(dst, src, count * n);
+      } else {
+        for (size_t i = 0; i < count; ++i) {
+          copy_value_bytes(
+            static_cast<char*>(dst) + i * n, 
+            static_cast<const char*>(src) + i * n, 
+            n, arithmetic);
+        }
+      }
+    }
+
     /** Discards the remainder of a multi-part message */
-    inline void discard_remainder(zmq::socket_t &s) {
+    template<class S>
+    inline void discard_remainder(S &s) {
       int more;
       size_t more_size = sizeof(more);
       
@@ -563,9 +1013,10 @@ namespace imagebabble {
       // this method is most often used inside error handling
       // code parts.
       try {        
+        zmq::message_t m;
         s.getsockopt(ZMQ_RCVMORE, &more, &more_size);
         while (more > 0) {
-          s.recv(0, 0);
+          s.recv(&m, 0);
           s.getsockopt(ZMQ_RCVMORE, &more, &more_size);
         }
       } catch (const zmq::error_t &) {}
@@ -592,17 +1043,11 @@ namespace imagebabble {
       socket_ptr _s;      
     };
 
-    /** Generic receive method. Tries to receive a value of T from the given socket.
-      * T must have locatable extraction semantics. This method will block until
-      * at least one byte is readable from the socket or an error occurs. 
-      * 
-      * \param[in] s socket to receive from
-      * \param[in,out] v value to receive
-      * \param[in] flags ZMQ flags
-      * \throws ib_error on error.
-      */
-    template<class T>
-    inline bool recv(zmq::socket_t &s, T &v, int flags) 
+    template<class T> struct serializer;
+
+    /** Receive a value sent as text. T must have locatable extraction semantics. */
+    template<class T, class S>
+    inline bool recv_text(S &s, T &v, int flags) 
     {
       zmq::message_t msg;
       IB_FIRST_PART(s.recv(&msg, flags));
@@ -616,8 +1061,51 @@ namespace imagebabble {
       return true;
     }
 
+    /** Receive a value sent as binary block. T must be trivially copyable. */
+    template<class T, class S>
+    inline bool recv_binary(S &s, T &v, int flags) 
+    {
+      zmq::message_t msg;
+      IB_FIRST_PART(s.recv(&msg, flags));
+
+      IB_ASSERT(msg.size() == sizeof(T), ib_error::ECONVERSION);
+      copy_value_bytes(&v, msg.data(), sizeof(T), std::is_arithmetic<T>::value);
+
+      return true;
+    }
+
+    /** Dispatch receiving to binary encoding. */
+    template<class T, class S>
+    inline bool recv_encoded(S &s, T &v, int flags, std::true_type) 
+    {
+      return recv_binary(s, v, flags);
+    }
+
+    /** Dispatch receiving to text encoding. */
+    template<class T, class S>
+    inline bool recv_encoded(S &s, T &v, int flags, std::false_type) 
+    {
+      return recv_text(s, v, flags);
+    }
+
+    /** Generic receive method. Tries to receive a value of T from the given socket
+      * or io::part_source. T is decoded by io::serializer. This method will block until
+      * at least one byte is readable from the socket or an error occurs. 
+      * 
+      * \param[in] s socket to receive from
+      * \param[in,out] v value to receive
+      * \param[in] flags ZMQ flags
+      * \throws ib_error on error.
+      */
+    template<class T, class S>
+    inline bool recv(S &s, T &v, int flags) 
+    {
+      return serializer<T>::recv(s, v, flags);
+    }
+
     /** Read a message(part) from the socket and discard. */
-    inline bool recv(zmq::socket_t &s, drop &v, int flags) 
+    template<class S>
+    inline bool recv(S &s, drop &v, int flags) 
     {
       zmq::message_t msg;
       IB_FIRST_PART(s.recv(&msg, flags));
@@ -625,7 +1113,8 @@ namespace imagebabble {
     }
 
     /** Receive a string. */
-    inline bool recv(zmq::socket_t &s, std::string &v, int flags) 
+    template<class S>
+    inline bool recv(S &s, std::string &v, int flags) 
     {
       zmq::message_t msg;
       
@@ -638,15 +1127,38 @@ namespace imagebabble {
       return true;
     }
 
-    /** Receive a vector of elements. */
-    template<class T>
-    inline bool recv(zmq::socket_t &s, std::vector<T> &c, int flags)
+    /** Receive a vector sent as a single block. */
+    template<class T, class S>
+    inline bool recv_vector_encoded(S &s, std::vector<T> &c, int flags, std::true_type)
     {
-      size_t count;
+      zmq::message_t msg;
+      IB_FIRST_PART(s.recv(&msg, flags));
+
+      IB_ASSERT(msg.size() >= 16, ib_error::ECONVERSION);
+      const char *p = static_cast<const char*>(msg.data());
+      const uint64_t count = io::load_le<uint64_t>(p);
+      const uint32_t elem_size = io::load_le<uint32_t>(p + 8);
+      IB_ASSERT(elem_size == sizeof(T), ib_error::ECONVERSION);
+      IB_ASSERT(count == (msg.size() - 16) / sizeof(T), ib_error::ECONVERSION);
+      IB_ASSERT((msg.size() - 16) % sizeof(T) == 0, ib_error::ECONVERSION);
+
+      c.resize(static_cast<size_t>(count));
+      if (count > 0) {
+        copy_array_bytes(&c[0], p + 16, c.size(), sizeof(T), std::is_arithmetic<T>::value);
+      }
+
+      return true;
+    }
+
+    /** Receive a vector sent as a multi-part message. */
+    template<class T, class S>
+    inline bool recv_vector_encoded(S &s, std::vector<T> &c, int flags, std::false_type)
+    {
+      uint64_t count;
 
       IB_FIRST_PART(io::recv(s, count, flags));
       // Note, use resize to allow existing elements to be reused.
-      c.resize(count);
+      c.resize(static_cast<size_t>(count));
 
       // Receive elements
       for (size_t i = 0; i < count; ++i) { 
@@ -660,6 +1172,13 @@ namespace imagebabble {
       return true;
     }
 
+    /** Receive a vector of elements. The encoding is selected by io::is_block_encoded. */
+    template<class T, class S>
+    inline bool recv(S &s, std::vector<T> &c, int flags)
+    {
+      return recv_vector_encoded(s, c, flags, typename is_block_encoded<T>::type());
+    }
+
     /** Test if data to be read is pending on the socket. Returns true
       * when at least one byte readable within the given timeout in milli
       * seconds. */
@@ -670,15 +1189,9 @@ namespace imagebabble {
       return (items[0].revents & ZMQ_POLLIN);      
     }
 
-    /** Generic send method. T must have insertion operator semantics. 
-      *
-      * \param[in] s socket to send data to
-      * \param[in] v data to send
-      * \param[in] flags ZMQ send flags.
-      * \throws ib_error on error.
-      */
-    template<class T>
-    inline bool send(zmq::socket_t &s, const T &v, int flags) 
+    /** Send a value as text. T must have insertion operator semantics. */
+    template<class T, class S>
+    inline bool send_text(S &s, const T &v, int flags) 
     {
       std::ostringstream ostr;
       ostr << v;
@@ -695,8 +1208,89 @@ namespace imagebabble {
       return true;
     }
 
+    /** Send a value as binary block. T must be trivially copyable. */
+    template<class T, class S>
+    inline bool send_binary(S &s, const T &v, int flags) 
+    {
+      zmq::message_t msg(sizeof(T));
+      copy_value_bytes(msg.data(), &v, sizeof(T), std::is_arithmetic<T>::value);
+
+      IB_FIRST_PART(s.send(msg, flags));
+      return true;
+    }
+
+    /** Dispatch sending to binary encoding. */
+    template<class T, class S>
+    inline bool send_encoded(S &s, const T &v, int flags, std::true_type) 
+    {
+      return send_binary(s, v, flags);
+    }
+
+    /** Dispatch sending to text encoding. */
+    template<class T, class S>
+    inline bool send_encoded(S &s, const T &v, int flags, std::false_type) 
+    {
+      return send_text(s, v, flags);
+    }
+
+    /** Serializes values of type T to message parts and back. By default T is encoded
+      * as selected by io::is_binary_encoded. Text encoded types must have insertion and
+      * locatable extraction operator semantics. 
+      *
+      * Specialize this class to transmit custom data types. Both methods take the 
+      * stream S as a template parameter: a zmq::socket_t when talking to a peer, an 
+      * io::part_sink or io::part_source when data is serialized ahead of sending or 
+      * decoded after receiving, see io::serialized_message. 
+      */
+    template<class T>
+    struct serializer {
+
+      /** Send value. */
+      template<class S>
+      static inline bool send(S &s, const T &v, int flags)
+      {
+        return send_encoded(s, v, flags, typename is_binary_encoded<T>::type());
+      }
+
+      /** Receive value. */
+      template<class S>
+      static inline bool recv(S &s, T &v, int flags)
+      {
+        return recv_encoded(s, v, flags, typename is_binary_encoded<T>::type());
+      }
+    };
+
+    /** Generic send method. Sends a value of T to the given socket or io::part_sink.
+      * T is encoded by io::serializer. 
+      *
+      * \param[in] s socket to send data to
+      * \param[in] v data to send
+      * \param[in] flags ZMQ send flags.
+      * \throws ib_error on error.
+      */
+    template<class T, class S>
+    inline bool send(S &s, const T &v, int flags) 
+    {
+      return serializer<T>::send(s, v, flags);
+    }
+
+    /** Send zero-terminated string. The terminator is not sent. */
+    template<class S>
+    inline bool send(S &s, const char *v, int flags) 
+    {
+      const size_t len = strlen(v);
+      zmq::message_t msg(len);
+      if (len > 0) {
+        memcpy(msg.data(), v, len);
+      }
+      
+      IB_FIRST_PART(s.send(msg, flags));
+      return true;
+    }
+
     /** Send string. */
-    inline bool send(zmq::socket_t &s, const std::string &v, int flags) 
+    template<class S>
+    inline bool send(S &s, const std::string &v, int flags) 
     {
       zmq::message_t msg(v.size());
       if (!v.empty()) {
@@ -708,7 +1302,8 @@ namespace imagebabble {
     }
 
     /** Send empty message. */
-    inline bool send(zmq::socket_t &s, const empty &v, int flags) 
+    template<class S>
+    inline bool send(S &s, const empty &v, int flags) 
     {
       zmq::message_t msg(0);
       
@@ -716,15 +1311,34 @@ namespace imagebabble {
       return true;    
     }
 
-    /** Send vector of elements. A vector is serialized into a multi-part message.
-      * First the number of elements is sent, then each element is sent in turn.
-      * Finally an empty message marks the end of vector. */
-    template<class T>
-    inline bool send(zmq::socket_t &s, const std::vector<T> &c, int flags)
+    /** Send vector of elements as a single block. The block starts with a 16 byte 
+      * header holding the number of elements (8 bytes) and the element size (4 bytes), 
+      * followed by the elements in contiguous memory. */
+    template<class T, class S>
+    inline bool send_vector_encoded(S &s, const std::vector<T> &c, int flags, std::true_type)
+    {
+      zmq::message_t msg(16 + c.size() * sizeof(T));
+      char *p = static_cast<char*>(msg.data());
+      io::store_le<uint64_t>(p, c.size());
+      io::store_le<uint32_t>(p + 8, sizeof(T));
+      io::store_le<uint32_t>(p + 12, 0);
+      if (!c.empty()) {
+        copy_array_bytes(p + 16, &c[0], c.size(), sizeof(T), std::is_arithmetic<T>::value);
+      }
+
+      IB_FIRST_PART(s.send(msg, flags));
+      return true;
+    }
+
+    /** Send vector of elements as a multi-part message. First the number of 
+      * elements is sent, then each element is sent in turn. Finally an empty 
+      * message marks the end of vector. */
+    template<class T, class S>
+    inline bool send_vector_encoded(S &s, const std::vector<T> &c, int flags, std::false_type)
     {
       const size_t nelems = c.size();
 
-      IB_FIRST_PART(io::send(s, nelems, flags | ZMQ_SNDMORE));
+      IB_FIRST_PART(io::send(s, static_cast<uint64_t>(nelems), flags | ZMQ_SNDMORE));
 
       for (size_t i = 0; i < nelems; ++i) {
         IB_NEXT_PART(io::send(s, c[i], flags | ZMQ_SNDMORE));        
@@ -734,6 +1348,353 @@ namespace imagebabble {
       
       return true;
     }
+
+    /** Send vector of elements. The encoding is selected by io::is_block_encoded.
+      * Vectors of trivially copyable elements are sent as a single message part,
+      * all other vectors are serialized into a multi-part message. */
+    template<class T, class S>
+    inline bool send(S &s, const std::vector<T> &c, int flags)
+    {
+      return send_vector_encoded(s, c, flags, typename is_block_encoded<T>::type());
+    }
+
+    /** Stream collecting message parts instead of sending them. Supports the part
+      * of the zmq::socket_t interface used by io::send, so that values are serialized
+      * into a list of message parts without passing through ZMQ. */
+    class part_sink {
+    public:
+
+      /** Construct sink appending to the given parts. */
+      inline explicit part_sink(std::vector<zmq::message_t> &parts)
+        : _parts(parts)
+      {}
+
+      /** Append a part. The content is moved, leaving msg empty as if it was sent. */
+      inline bool send(zmq::message_t &msg, int flags = 0)
+      {
+        _parts.push_back(zmq::message_t());
+        _parts.back().move(&msg);
+        return true;
+      }
+
+    private:
+      std::vector<zmq::message_t> &_parts;
+    };
+
+    /** Stream reading message parts received before. Supports the part of the 
+      * zmq::socket_t interface used by io::recv, so that values are decoded from 
+      * a list of message parts. Parts are moved out of the list while reading. */
+    class part_source {
+    public:
+
+      /** Construct source reading the given parts from the first one on. */
+      inline explicit part_source(std::vector<zmq::message_t> &parts)
+        : _parts(&parts), _next(0)
+      {}
+
+      /** Move the next part into msg. Returns false if all parts were read. */
+      inline bool recv(zmq::message_t *msg, int flags = 0)
+      {
+        if (_next >= _parts->size()) {
+          return false;
+        }
+        msg->move(&(*_parts)[_next++]);
+        return true;
+      }
+
+      /** Copy the next part into the given buffer. Returns the size of the part, 
+        * which is larger than len if the part was truncated. 
+        * \throws ib_error if all parts were read. */
+      inline size_t recv(void *buf, size_t len, int flags = 0)
+      {
+        IB_ASSERT(_next < _parts->size(), ib_error::EINCOMPLETE);
+        const zmq::message_t &m = (*_parts)[_next++];
+        if (m.size() > 0) {
+          memcpy(buf, m.data(), std::min(len, m.size()));
+        }
+        return m.size();
+      }
+
+      /** Get an option. Only ZMQ_RCVMORE is supported, which tells whether more parts 
+        * follow the part read last. */
+      inline void getsockopt(int option, void *optval, size_t *optvallen)
+      {
+        IB_ASSERT(option == ZMQ_RCVMORE, ib_error::EPARAMRANGE);
+        const bool more = _next > 0 && _next < _parts->size();
+        if (*optvallen == sizeof(int64_t)) {
+          *static_cast<int64_t*>(optval) = more ? 1 : 0;
+        } else {
+          IB_ASSERT(*optvallen == sizeof(int), ib_error::EPARAMRANGE);
+          *static_cast<int*>(optval) = more ? 1 : 0;
+        }
+      }
+
+    private:
+      std::vector<zmq::message_t> *_parts;
+      size_t _next;
+    };
+
+    /** Multi-part message holding the serialized representation of a value. 
+      *
+      * A value is serialized once using io::send and the resulting message parts
+      * are kept. The parts can then be sent any number of times, possibly to 
+      * different peers, without repeating serialization. Sending increments the 
+      * reference count of each part instead of copying its content.
+      *
+      * Conversely, a raw multi-part message can be received from a socket without 
+      * interpreting its content and decoded later on by reading from the source 
+      * returned by serialized_message::replay.
+      *
+      * Values are serialized into an io::part_sink and decoded from an io::part_source,
+      * so any type supported by io::serializer is supported.
+      */
+    class serialized_message {
+    public:
+
+      /** Construct empty message. */
+      inline serialized_message()
+      {}
+
+      /** Serialize value. Previously stored parts are released. */
+      template<class T>
+      inline void assign(const T &v)
+      {
+        _parts.clear();
+
+        part_sink sink(_parts);
+        IB_ASSERT(io::send(sink, v, 0), ib_error::EINCOMPLETE);
+      }
+
+      /** Get the number of message parts. */
+      inline size_t size() const
+      {
+        return _parts.size();
+      }
+
+      /** Send all parts on given socket. ZMQ_SNDMORE in flags is applied to the last part. */
+      inline bool send(zmq::socket_t &s, int flags)
+      {
+        const size_t n = _parts.size();
+        for (size_t i = 0; i < n; ++i) {
+          zmq::message_t m;
+          m.copy(&_parts[i]);
+          const int f = (i + 1 < n) ? (flags | ZMQ_SNDMORE) : flags;
+          if (i == 0) {
+            IB_FIRST_PART(s.send(m, f));
+          } else {
+            IB_NEXT_PART(s.send(m, f));
+          }
+        }
+        return true;
+      }
+
+      /** Receive a complete multi-part message from given socket without interpreting it.
+        * Previously stored parts are only replaced when a message was received. 
+        *
+        * \returns false if no message was available and ZMQ_DONTWAIT was specified.
+        */
+      inline bool recv(zmq::socket_t &s, int flags)
+      {
+        _scratch.clear();
+        _scratch.push_back(zmq::message_t());
+        IB_FIRST_PART(s.recv(&_scratch.back(), flags));
+
+        int64_t more = 0;
+        size_t more_size = sizeof(more);
+        IB_CATCH_ZMQ_RETHROW(s.getsockopt(ZMQ_RCVMORE, &more, &more_size));
+        while (more) {
+          _scratch.push_back(zmq::message_t());
+          IB_NEXT_PART(s.recv(&_scratch.back(), flags));
+          IB_CATCH_ZMQ_RETHROW(s.getsockopt(ZMQ_RCVMORE, &more, &more_size));
+        }
+
+        _parts.swap(_scratch);
+        return true;
+      }
+
+      /** Exchange stored parts with the given parts. */
+      inline void swap_parts(std::vector<zmq::message_t> &parts)
+      {
+        _parts.swap(parts);
+      }
+
+      /** Hand stored parts over to a source from which they can be decoded using io::recv. 
+        * The parts are moved, leaving this message empty. The source remains valid until
+        * the next call to replay. */
+      inline part_source replay()
+      {
+        _replayed.clear();
+        _replayed.swap(_parts);
+        return part_source(_replayed);
+      }
+
+    private:
+      std::vector<zmq::message_t> _parts;
+      std::vector<zmq::message_t> _replayed;
+      std::vector<zmq::message_t> _scratch;
+
+      /** Disabled copy constructor */
+      serialized_message (const serialized_message &);
+      /** Disabled assignment operator */
+      serialized_message &operator = (const serialized_message &);
+    };
+
+    /** Send topic followed by a zero byte as a single message part. */
+    template<class S>
+    inline bool send_topic(S &s, const std::string &topic, int flags)
+    {
+      zmq::message_t m(topic.size() + 1);
+      char *d = static_cast<char*>(m.data());
+      memcpy(d, topic.data(), topic.size());
+      d[topic.size()] = 0;
+
+      IB_FIRST_PART(s.send(m, flags));
+      return true;
+    }
+
+    /** Receive topic sent by io::send_topic. 
+      * \throws ib_error if the message part is not a topic. */
+    template<class S>
+    inline bool recv_topic(S &s, zmq::message_t &topic, int flags)
+    {
+      IB_FIRST_PART(s.recv(&topic, flags));
+
+      const char *d = static_cast<const char*>(topic.data());
+      IB_ASSERT(topic.size() > 0 && d[topic.size() - 1] == 0, ib_error::EWRONGPROTO);
+      return true;
+    }
+
+    /** Subscriptions reported by an XPUB socket. */
+    class subscription_set {
+    public:
+
+      /** Ask an XPUB socket to report each subscription and unsubscription instead of the 
+        * first and last per filter only. Older ZMQ versions don't support this, subscriber 
+        * counts are limited to one per filter then. */
+      static inline void enable_verbose(zmq::socket_t &s)
+      {
+        // ZMQ_XPUB_VERBOSER is not declared by all ZMQ versions supporting it.
+        const int verboser_option = 78, verboser = 1;
+        zmq_setsockopt(s, verboser_option, &verboser, sizeof(int));
+      }
+
+      /** Process pending subscription messages. Each message consists of a single byte,
+        * one for subscribing and zero for unsubscribing, followed by the filter. Filters 
+        * of new subscriptions are appended to subscribed if given. */
+      inline void update(zmq::socket_t &s, std::vector<std::string> *subscribed = 0)
+      {
+        zmq::message_t m;
+        while (s.recv(&m, ZMQ_DONTWAIT)) {
+          const char *d = static_cast<const char*>(m.data());
+          if (m.size() == 0) {
+            continue;
+          }
+
+          const std::string filter(d + 1, m.size() - 1);
+          if (d[0] == 1) {
+            ++_filters[filter];
+            if (subscribed) {
+              subscribed->push_back(filter);
+            }
+          } else if (d[0] == 0) {
+            filter_map::iterator i = _filters.find(filter);
+            if (i != _filters.end() && --i->second == 0) {
+              _filters.erase(i);
+            }
+          }
+        }
+      }
+
+      /** Test if there are no subscriptions. */
+      inline bool empty() const
+      {
+        return _filters.empty();
+      }
+
+      /** Get the number of subscriptions receiving the given topic. */
+      inline size_t count(const std::string &topic) const
+      {
+        size_t n = 0;
+        for (filter_map::const_iterator i = _filters.begin(); i != _filters.end(); ++i) {
+          if (is_topic_match(i->first, topic)) {
+            n += i->second;
+          }
+        }
+        return n;
+      }
+
+      /** Remove all subscriptions. */
+      inline void clear()
+      {
+        _filters.clear();
+      }
+
+    private:
+      typedef std::map<std::string, size_t> filter_map;
+      filter_map _filters;
+    };
+
+    /** Type information in front of a shared pointer passed by io::send_pointer. */
+    struct pointer_holder_base {
+      const std::type_info *type;
+    };
+
+    /** Shared pointer passed by io::send_pointer. */
+    template<class T>
+    struct pointer_holder : pointer_holder_base {
+      std::shared_ptr<const T> ptr;
+
+      /** Free function deleting the holder once ZMQ released the message. */
+      static inline void destroy(void *data, void * /*hint*/)
+      {
+        delete static_cast<pointer_holder*>(static_cast<pointer_holder_base*>(data));
+      }
+    };
+
+    /** Send a shared pointer as a single message part. The message refers to a heap 
+      * allocated copy of the pointer, which is released when ZMQ drops the last copy
+      * of the message, including messages discarded at the high water mark. Fanning
+      * out to multiple subscribers thus shares one pointer copy. 
+      *
+      * \warning Only valid for sockets connected to in-process endpoints.
+      */
+    template<class T, class S>
+    inline bool send_pointer(S &s, const std::shared_ptr<const T> &p, int flags)
+    {
+      pointer_holder<T> *h = new pointer_holder<T>();
+      h->type = &typeid(T);
+      h->ptr = p;
+
+      pointer_holder_base *b = h;
+      zmq::message_t m;
+      try {
+        m.rebuild(b, sizeof(pointer_holder<T>), &pointer_holder<T>::destroy, 0);
+      } catch (const zmq::error_t &e) {
+        delete h;
+        throw ib_error(ib_error::EZMQERROR, e);
+      }
+
+      IB_FIRST_PART(s.send(m, flags));
+      return true;
+    }
+
+    /** Receive a shared pointer sent by io::send_pointer. 
+      *
+      * \throws ib_error if the pointer refers to a different type.
+      */
+    template<class T, class S>
+    inline bool recv_pointer(S &s, std::shared_ptr<const T> &p, int flags)
+    {
+      zmq::message_t m;
+      IB_FIRST_PART(s.recv(&m, flags));
+
+      IB_ASSERT(m.size() == sizeof(pointer_holder<T>), ib_error::ECONVERSION);
+      const pointer_holder_base *b = static_cast<const pointer_holder_base*>(m.data());
+      IB_ASSERT(*b->type == typeid(T), ib_error::ECONVERSION);
+
+      p = static_cast<const pointer_holder<T>*>(b)->ptr;
+      return true;
+    }
   }
 }
 
@@ -30,6 +30,9 @@
 #define __IMAGE_BABBLE_FAST_HPP_INCLUDED__
 
 #include "core.hpp"
+#include "shm.hpp"
+#include <set>
+#include <algorithm>
 
 namespace imagebabble {
 
@@ -40,14 +43,37 @@ namespace imagebabble {
     *
     * The server will drop messages when no clients are connected. Messages for clients
     * in exceptional states are dropped as well. Expect to lose data when using the 
-    * fast server.*/
+    * fast server.
+    *
+    * The server tracks subscriptions of clients. When nobody is subscribed, publishing
+    * returns before data is serialized.
+    *
+    * Images can be published to clients on the same host through shared memory by
+    * starting the server on a <code>shm://name</code> address, see shm_ring.
+    *
+    * When all endpoints are in-process, data is not serialized. Instead a shared 
+    * pointer to constant data is passed to clients, which requires server and clients
+    * to share a context. Publishing a std::shared_ptr or moving data into publish avoids
+    * copying the data as well.
+    *
+    * Optionally the server keeps the last data published per topic and sends it to
+    * clients as soon as they subscribe, see fast_server::set_enable_last_value_cache.*/
   template<typename T>
   class fast_server : public basic_server<T> {
   public:
 
     /** Default constructor. */
     fast_server()
-      : basic_server<T>(context_ptr(new zmq::context_t(1)))
+      : basic_server<T>(make_context())
+      , _shm_slots(shm_ring::default_slots), _shm_capacity(shm_ring::default_capacity), _remote(false)
+      , _enable_cache(false)
+    {}
+
+    /** Construct from existing context. Required to reach clients on in-process endpoints. */
+    explicit fast_server(const context_ptr &ctx)
+      : basic_server<T>(ctx)
+      , _shm_slots(shm_ring::default_slots), _shm_capacity(shm_ring::default_capacity), _remote(false)
+      , _enable_cache(false)
     {}
 
     /** Destructor. */
@@ -55,19 +81,151 @@ namespace imagebabble {
     {}
 
     /** Start a new connection on the given endpoint. This method can be called
-      * multiple times to publish the same data on multiple endpoints.
+      * multiple times to publish the same data on multiple endpoints. A 
+      * <code>shm://name</code> address creates a shared memory ring and cannot be
+      * combined with other endpoints.
       *
       * \param[in] addr address to bind server to.
       * \throws ib_error on error.
       */
     virtual void startup(const std::string &addr = "tcp://127.0.0.1:6000")
     { 
+      std::string name;
+      const bool use_shm = shm_ring::parse_address(addr, name);
+      IB_ASSERT(!_shm && !(use_shm && network_entity::_s), ib_error::EPARAMRANGE);
+
       if (!network_entity::_s) {
-        network_entity::_s = socket_ptr(new zmq::socket_t(*network_entity::_ctx, ZMQ_PUB));
+        network_entity::_s = socket_ptr(new zmq::socket_t(*network_entity::_ctx, ZMQ_XPUB));
         network_entity::apply_socket_options();
+        io::subscription_set::enable_verbose(*network_entity::_s);
       }
 
-      IB_CATCH_ZMQ_RETHROW(network_entity::_s->bind(addr.c_str()));
+      if (use_shm) {
+        _shm = shm_ring::create(name, _shm_slots, _shm_capacity);
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->bind(shm_ring::endpoint(name).c_str()));
+      } else {
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->bind(addr.c_str()));
+      }
+
+      _remote = _remote || !io::is_inproc_address(addr);
+      if (_remote) {
+        // Pointers cannot be replayed to remote clients.
+        clear_cached_pointers();
+      }
+    }
+
+    /** Shutdown all services and release the shared memory ring and cached data. */
+    virtual void shutdown()
+    {
+      _shm.reset();
+      _remote = false;
+      _subscriptions.clear();
+      _cache.clear();
+      basic_server<T>::shutdown();
+    }
+
+    /** Test if any client is subscribed. */
+    bool has_subscribers()
+    {
+      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+      update_subscriptions();
+      return !_subscriptions.empty();
+    }
+
+    /** Get the number of subscriptions receiving the given topic. Clients that did not
+      * subscribe to specific topics receive all topics. */
+    size_t get_num_subscribers(const std::string &topic = std::string())
+    {
+      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+      update_subscriptions();
+      return _subscriptions.count(topic);
+    }
+
+    /** Keep the last data published per topic and send it to clients when they subscribe,
+      * so that clients don't have to wait for the next publish. Data is cached even when
+      * nobody is subscribed. Clients having received data on a topic already ignore 
+      * cached data replayed for others, without giving up waiting or skipping to the
+      * most recent data. Data published through shared memory is not cached, since 
+      * its slots are recycled.
+      *
+      * Images encoded by a codec keeping state between frames, such as tile_delta_codec,
+      * are cached at keyframes only, since delta frames do not decode without the frames
+      * before. When a client subscribes, the codec is asked for a keyframe, so that the
+      * frames following the cached one decode as well.
+      *
+      * Subscriptions are processed whenever the server publishes or is asked for 
+      * subscribers. Servers publishing at low rates should wait in 
+      * fast_server::serve_subscriptions instead of sleeping between frames.
+      */
+    void set_enable_last_value_cache(bool enable)
+    {
+#ifdef IB_LEGACY_TEXT_ENCODING
+      IB_ASSERT(!enable, ib_error::EPARAMRANGE);
+#endif
+      _enable_cache = enable;
+      if (enable) {
+        ensure_payload();
+      } else {
+        _cache.clear();
+      }
+    }
+
+    /** Wait up to the given time for subscription changes and send cached data to new
+      * subscribers. 
+      * \returns true if subscriptions changed. */
+    bool serve_subscriptions(int timeout_ms)
+    {
+      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+
+      if (!io::is_data_pending(*network_entity::_s, timeout_ms)) {
+        return false;
+      }
+      update_subscriptions();
+      return true;
+    }
+
+    /** Test if data is passed by pointer, which is the case when all endpoints are in-process. */
+    bool is_passing_pointers() const
+    {
+      return network_entity::_s && !_remote;
+    }
+
+    /** Set the number of slots and the maximum image size in bytes of the shared memory 
+      * ring. Takes effect on the next startup on a shm address. */
+    void set_shm_options(size_t nslots, size_t capacity)
+    {
+      _shm_slots = nslots;
+      _shm_capacity = capacity;
+    }
+
+    /** Get the shared memory ring. Empty unless started on a shm address. Use 
+      * shm_ring::allocate_image to fill images in place and avoid copying them when
+      * published. */
+    shm_ring_ptr get_shm_ring() const
+    {
+      return _shm;
+    }
+
+    /** Limit the number of bytes of published data waiting in socket queues. Data that 
+      * does not fit is dropped or, depending on the policy, publish waits for queued data
+      * to be sent. Zero removes the limit. Data passed by pointer or through shared 
+      * memory is not accounted, its memory is bounded otherwise.
+      * \see byte_budget */
+    void set_max_outbound_bytes(size_t nbytes, byte_budget::epolicy policy = byte_budget::POLICY_DROP, int timeout_ms = -1)
+    {
+      if (nbytes == 0) {
+        _outbound.reset();
+        return;
+      }
+
+      _outbound = byte_budget_ptr(new byte_budget(nbytes, policy, timeout_ms));
+      ensure_payload();
+    }
+
+    /** Get the outbound byte budget. Empty unless limited by set_max_outbound_bytes. */
+    byte_budget_ptr get_outbound_budget() const
+    {
+      return _outbound;
     }
 
     /** Publish data to clients.
@@ -76,15 +234,285 @@ namespace imagebabble {
       * \param[in] timeout_ms unused. Method returns always immediately.
       * \param[in] min_serve unused.
       * \returns true if data was published successfully.
-      * \returns false never.
+      * \returns false if no client is subscribed.
+      * \returns false if publishing through shared memory and all slots are referenced.
+      * \returns false if data exceeds the outbound byte budget.
       **/
     virtual bool publish(const T &t, int timeout_ms = 0, size_t min_serve = 0)
+    {
+      return publish(std::string(), t);
+    }
+
+    /** Publish data on the given topic. Only clients subscribed to the topic receive the data.
+      * \see fast_server::publish */
+    bool publish(const std::string &topic, const T &t)
     {
       IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+
+      // Processes pending subscriptions before the cache is updated, so that new
+      // subscribers receive either cached data or this data but not both.
+      const bool subscribed = get_num_subscribers(topic) > 0;
+      if (!subscribed && !_enable_cache) {
+        return false;
+      }
+
+      if (is_passing_pointers()) {
+        // Types that cannot be copied are serialized instead.
+        std::shared_ptr<const T> p = copy_shared(t, std::is_copy_constructible<T>());
+        if (p) {
+          return publish(topic, p);
+        }
+      }
+
+      if (_shm) {
+        if (!subscribed) {
+          return false;
+        }
+
+        // Place data first, so that nothing is sent when no slot is available.
+        io::shm_message m(*_shm);
+        if (!m.assign(t)) {
+          return false;
+        }
+        send_topic(topic);
+        io::send(*network_entity::_s, IB_EXCHANGE_PROTO_SHM_VERSION, ZMQ_SNDMORE);
+        m.send(*network_entity::_s, 0);
+        return true;
+      }
+
+      if (_outbound || _enable_cache) {
+        return publish_serialized(topic, t, subscribed);
+      }
+
+      send_topic(topic);
       io::send(*network_entity::_s, IB_EXCHANGE_PROTO_FAST_VERSION, ZMQ_SNDMORE);
       io::send(*network_entity::_s, t, 0);
       return true;
     }
+
+#ifdef IB_HAS_RVALUE_REFS
+    /** Publish data to clients. Data is moved instead of copied when passing pointers. 
+      * \see fast_server::publish */
+    bool publish(T &&t, int /*timeout_ms*/ = 0, size_t /*min_serve*/ = 0)
+    {
+      return publish(std::string(), std::move(t));
+    }
+
+    /** Publish data on the given topic. Data is moved instead of copied when passing pointers. 
+      * \see fast_server::publish */
+    bool publish(const std::string &topic, T &&t)
+    {
+      if (is_passing_pointers() && (_enable_cache || get_num_subscribers(topic) > 0)) {
+        return publish(topic, std::shared_ptr<const T>(std::make_shared<T>(std::move(t))));
+      }
+      return publish(topic, static_cast<const T&>(t));
+    }
+#endif
+
+    /** Publish shared data to clients. When passing pointers, clients receive the 
+      * pointer itself and the data must not be modified afterwards. Otherwise data
+      * is serialized.
+      *
+      * \param[in] p data to be published.
+      * \returns true if data was published successfully.
+      **/
+    bool publish(const std::shared_ptr<const T> &p)
+    {
+      return publish(std::string(), p);
+    }
+
+    /** Publish shared data on the given topic.
+      * \see fast_server::publish */
+    bool publish(const std::string &topic, const std::shared_ptr<const T> &p)
+    {
+      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+      IB_ASSERT(p, ib_error::EPARAMRANGE);
+
+      if (!is_passing_pointers()) {
+        return publish(topic, *p);
+      }
+
+      const bool subscribed = get_num_subscribers(topic) > 0;
+      if (_enable_cache) {
+        cached_message &c = _cache[topic];
+        c.parts.clear();
+        c.pointer = p;
+        c.codec.reset();
+      }
+
+      if (!subscribed) {
+        return false;
+      }
+
+      send_topic(topic);
+      io::send(*network_entity::_s, IB_EXCHANGE_PROTO_POINTER_VERSION, ZMQ_SNDMORE);
+      io::send_pointer(*network_entity::_s, p, 0);
+      return true;
+    }
+
+  private:
+
+    /** Send topic as first message part. */
+    void send_topic(const std::string &topic)
+    {
+#ifdef IB_LEGACY_TEXT_ENCODING
+      IB_ASSERT(topic.empty(), ib_error::EPARAMRANGE);
+#else
+      io::send_topic(*network_entity::_s, topic, ZMQ_SNDMORE);
+#endif
+    }
+
+    /** Last data published on a topic. */
+    struct cached_message {
+      std::vector<zmq::message_t> parts;
+      std::shared_ptr<const T> pointer;
+      codec_ptr codec;
+    };
+
+    typedef std::map<std::string, cached_message> cache_map;
+
+    /** Create message used to serialize data ahead of sending it. */
+    void ensure_payload()
+    {
+      if (!_payload) {
+        _payload = std::shared_ptr<io::serialized_message>(new io::serialized_message());
+      }
+    }
+
+    /** Process pending subscriptions and send cached data to new subscribers. */
+    void update_subscriptions()
+    {
+      if (!_enable_cache) {
+        _subscriptions.update(*network_entity::_s);
+        return;
+      }
+
+      _joined.clear();
+      _subscriptions.update(*network_entity::_s, &_joined);
+      for (size_t i = 0; i < _joined.size(); ++i) {
+        for (typename cache_map::iterator c = _cache.begin(); c != _cache.end(); ++c) {
+          if (io::is_topic_match(_joined[i], c->first)) {
+            if (c->second.codec) {
+              c->second.codec->request_keyframe();
+            }
+            if (c->second.pointer || !c->second.parts.empty()) {
+              send_cached(c->first, c->second);
+            }
+          }
+        }
+      }
+    }
+
+    /** Replay cached data. The marker lets clients ignore data they have seen. */
+    void send_cached(const std::string &topic, const cached_message &c)
+    {
+      send_topic(topic);
+      io::send(*network_entity::_s, IB_EXCHANGE_PROTO_FAST_CACHED, ZMQ_SNDMORE);
+
+      if (c.pointer) {
+        io::send(*network_entity::_s, IB_EXCHANGE_PROTO_POINTER_VERSION, ZMQ_SNDMORE);
+        io::send_pointer(*network_entity::_s, c.pointer, 0);
+        return;
+      }
+
+      io::send(*network_entity::_s, IB_EXCHANGE_PROTO_FAST_VERSION, ZMQ_SNDMORE);
+      const size_t n = c.parts.size();
+      for (size_t i = 0; i < n; ++i) {
+        zmq::message_t m;
+        m.copy(const_cast<zmq::message_t*>(&c.parts[i]));
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->send(m, (i + 1 < n) ? ZMQ_SNDMORE : 0));
+      }
+    }
+
+    /** Drop cached pointers. */
+    void clear_cached_pointers()
+    {
+      typename cache_map::iterator c = _cache.begin();
+      while (c != _cache.end()) {
+        if (c->second.pointer) {
+          _cache.erase(c++);
+        } else {
+          ++c;
+        }
+      }
+    }
+
+    /** Serialize data, cache it if enabled and send it if it fits into the outbound budget. */
+    bool publish_serialized(const std::string &topic, const T &t, bool subscribed)
+    {
+      _payload->assign(t);
+      _payload->swap_parts(_parts);
+
+      codec_ptr codec;
+      bool cache = false;
+      if (_enable_cache) {
+        // Copies share data with the parts sent. They are taken before the parts are
+        // tracked by the outbound budget, so that cached data is not charged to it.
+        // Delta frames are not cached, since new subscribers cannot decode them.
+        codec = io::get_stream_codec(t);
+        cache = io::is_keyframe(codec, _parts);
+        if (cache) {
+          _cached_parts.resize(_parts.size());
+          for (size_t i = 0; i < _parts.size(); ++i) {
+            _cached_parts[i].copy(&_parts[i]);
+          }
+        }
+      }
+
+      if (_outbound && !_outbound->admit(_parts)) {
+        _parts.clear();
+        _cached_parts.clear();
+        return false;
+      }
+
+      if (_enable_cache) {
+        cached_message &c = _cache[topic];
+        c.codec = codec;
+        if (cache) {
+          c.pointer.reset();
+          c.parts.swap(_cached_parts);
+          _cached_parts.clear();
+        }
+      }
+
+      if (!subscribed) {
+        _parts.clear();
+        return false;
+      }
+
+      send_topic(topic);
+      io::send(*network_entity::_s, IB_EXCHANGE_PROTO_FAST_VERSION, ZMQ_SNDMORE);
+      const size_t n = _parts.size();
+      for (size_t i = 0; i < n; ++i) {
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->send(_parts[i], (i + 1 < n) ? ZMQ_SNDMORE : 0));
+      }
+      _parts.clear();
+      return true;
+    }
+
+    /** Copy data into a new shared element. */
+    static std::shared_ptr<const T> copy_shared(const T &t, std::true_type)
+    {
+      return std::make_shared<T>(t);
+    }
+
+    /** Data cannot be copied. */
+    static std::shared_ptr<const T> copy_shared(const T &, std::false_type)
+    {
+      return std::shared_ptr<const T>();
+    }
+
+    size_t _shm_slots, _shm_capacity;
+    shm_ring_ptr _shm;
+    bool _remote;
+    io::subscription_set _subscriptions;
+    byte_budget_ptr _outbound;
+    std::shared_ptr<io::serialized_message> _payload;
+    std::vector<zmq::message_t> _parts;
+    std::vector<zmq::message_t> _cached_parts;
+    bool _enable_cache;
+    cache_map _cache;
+    std::vector<std::string> _joined;
   };
 
    /** Fast client implementation. */
@@ -94,33 +522,70 @@ namespace imagebabble {
 
     /** Default constructor */
     fast_client()
-      : basic_client<T>(context_ptr(new zmq::context_t(1)))
-      , _enable_skip(false), _recv_skip(0)
+      : basic_client<T>(make_context())
+      , _enable_skip(false), _recv_skip(0), _stale_replay(false)
+      , _remote(false), _all_topics(true), _current(0)
+    {}
+
+    /** Construct from existing context. Required to reach servers on in-process endpoints. */
+    explicit fast_client(const context_ptr &ctx)
+      : basic_client<T>(ctx)
+      , _enable_skip(false), _recv_skip(0), _stale_replay(false)
+      , _remote(false), _all_topics(true), _current(0)
     {}
 
     virtual ~fast_client()
     {}
 
     /** Start a new connection to the given endpoint. If called multiple times, the client
-      * will connect to more endpoints. 
+      * will connect to more endpoints. A <code>shm://name</code> address receives images
+      * through the shared memory ring of a server on the same host and cannot be combined
+      * with other endpoints. Received images then reference shared memory and must not
+      * be modified.
       *
       * \param [in] addr endpoint address to connect to
       * \throws ib_error on error
       */      
     virtual void startup(const std::string &addr = "tcp://127.0.0.1:6000")
     {
+      std::string name;
+      const bool use_shm = shm_ring::parse_address(addr, name);
+      IB_ASSERT(!_shm && !(use_shm && network_entity::_s), ib_error::EPARAMRANGE);
+
       if (!network_entity::_s) {
         network_entity::_s = socket_ptr(new zmq::socket_t(*network_entity::_ctx, ZMQ_SUB));
       
         network_entity::apply_socket_options();
-        IB_CATCH_ZMQ_RETHROW(network_entity::_s->setsockopt(ZMQ_SUBSCRIBE, 0, 0));
+        if (_all_topics) {
+          IB_CATCH_ZMQ_RETHROW(network_entity::_s->setsockopt(ZMQ_SUBSCRIBE, 0, 0));
+        }
+        for (std::set<std::string>::const_iterator i = _topics.begin(); i != _topics.end(); ++i) {
+          const std::string f = io::topic_filter(*i);
+          IB_CATCH_ZMQ_RETHROW(network_entity::_s->setsockopt(ZMQ_SUBSCRIBE, f.data(), f.size()));
+        }
 
         size_t recvhwm_size = sizeof (_recv_skip);
         IB_CATCH_ZMQ_RETHROW(network_entity::_s->getsockopt(ZMQ_RCVHWM, &_recv_skip, &recvhwm_size));
 
       }
 
-      IB_CATCH_ZMQ_RETHROW(network_entity::_s->connect(addr.c_str()));
+      if (use_shm) {
+        _shm = shm_view_ptr(new shm_view(name));
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->connect(shm_ring::endpoint(name).c_str()));
+      } else {
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->connect(addr.c_str()));
+      }
+
+      _remote = _remote || !io::is_inproc_address(addr);
+    }
+
+    /** Shutdown all connections. */
+    virtual void shutdown()
+    {
+      _shm.reset();
+      _remote = false;
+      _streams.clear();
+      basic_client<T>::shutdown();
     }
 
     /** Receive data.
@@ -132,37 +597,75 @@ namespace imagebabble {
       * \param [in] timeout_ms Maximum wait time in milliseconds to receive data.
       *             Timeout is set to 1 second by default.
       * \returns true if data was received successfully.
-      * \returns false when receive timeout occurred.
+      * \returns false when receive timeout occurred, shared memory data was overwritten 
+      *          before it could be received or a compressed image could not be decoded
+      *          because its reference frame was missed.
       * \throws ib_error on error
       */
     virtual bool receive(T &t, int timeout_ms = 1000)
     {
-      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+      return receive_any(t, timeout_ms, 0);
+    }
 
-      io::ensure_cleanup_partial_messages ecpm(this->get_socket());
+    /** Receive data along with the topic it was published on.
+      * \see fast_client::receive */
+    bool receive(std::string &topic, T &t, int timeout_ms = 1000)
+    {
+      return receive_any(t, timeout_ms, &topic);
+    }
 
-      const bool has_wait = (timeout_ms != 0);
-      const int max_skip = _enable_skip ? _recv_skip : 0;
-      int k = max_skip;
-       
-      bool has_data = false;
-      while (k >= 0 && receive_message(t, ZMQ_DONTWAIT)) {
-        --k;
+    /** Receive shared data. Data passed by pointer from an in-process server is 
+      * received without copying it. Otherwise data is deserialized into a newly 
+      * allocated element. 
+      *
+      * \see fast_client::receive
+      */
+    bool receive(std::shared_ptr<const T> &p, int timeout_ms = 1000)
+    {
+      return receive_any(p, timeout_ms, 0);
+    }
+
+    /** Receive only data published on the given topic. The first subscription replaces
+      * the default of receiving all topics. Topics are matched as a whole, so that 
+      * subscribing to <code>cam1</code> does not receive <code>cam10</code>. Filtering
+      * happens at the server, unsubscribed topics are not transmitted.
+      *
+      * \throws ib_error on error.
+      */
+    void subscribe(const std::string &topic)
+    {
+#ifdef IB_LEGACY_TEXT_ENCODING
+      throw ib_error(ib_error::EPARAMRANGE);
+#else
+      if (_all_topics) {
+        _all_topics = false;
+        if (network_entity::_s) {
+          IB_CATCH_ZMQ_RETHROW(network_entity::_s->setsockopt(ZMQ_UNSUBSCRIBE, 0, 0));
+        }
       }
 
-      // Received at least one message from queue.
-      if (k != max_skip) {
-          return true;
+      if (_topics.insert(topic).second && network_entity::_s) {
+        const std::string f = io::topic_filter(topic);
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->setsockopt(ZMQ_SUBSCRIBE, f.data(), f.size()));
       }
+#endif
+    }
 
-      // We haven't received anything. See if waiting is ok.
-      if (has_wait && io::is_data_pending(*network_entity::_s, timeout_ms)) {
-        receive_message(t, 0);
-        return true;
-      } else {
-        return false;
+    /** Stop receiving data published on the given topic. */
+    void unsubscribe(const std::string &topic)
+    {
+      // Cached data is accepted again after subscribing anew.
+      for (size_t i = 0; i < _streams.size(); ++i) {
+        if (_streams[i].topic == topic) {
+          _streams.erase(_streams.begin() + i);
+          break;
+        }
       }
 
+      if (_topics.erase(topic) > 0 && network_entity::_s) {
+        const std::string f = io::topic_filter(topic);
+        IB_CATCH_ZMQ_RETHROW(network_entity::_s->setsockopt(ZMQ_UNSUBSCRIBE, f.data(), f.size()));
+      }
     }
 
     /** Enable skipping older elements in receive queue. Enabling
@@ -173,22 +676,306 @@ namespace imagebabble {
       _enable_skip = enable;
     }
 
+    /** Limit the number of bytes of received data held by the client and the application. 
+      * Data is accounted until its memory is released, e.g. when an image receiving
+      * it without copying is destroyed. Received data that does not fit is dropped or, 
+      * depending on the policy, receive waits for data to be released. Zero removes the
+      * limit. Messages queued by ZMQ before receiving are bounded by 
+      * set_max_pending_inbound only.
+      * \see byte_budget */
+    void set_max_inbound_bytes(size_t nbytes, byte_budget::epolicy policy = byte_budget::POLICY_DROP, int timeout_ms = -1)
+    {
+      _inbound.reset(nbytes > 0 ? new byte_budget(nbytes, policy, timeout_ms) : 0);
+    }
+
+    /** Get the inbound byte budget. Empty unless limited by set_max_inbound_bytes. */
+    byte_budget_ptr get_inbound_budget() const
+    {
+      return _inbound;
+    }
+
   private:
 
-    /** Receive complete message once */
-    bool receive_message(T &t, int flags)
+    /** Receive into element or shared pointer. */
+    template<class D>
+    bool receive_any(D &t, int timeout_ms, std::string *topic)
     {
-      std::string version;
+      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
 
-      IB_FIRST_PART(io::recv(*network_entity::_s, version, flags));
-      network_entity::validate_version(IB_EXCHANGE_PROTO_FAST_VERSION, version);
-      IB_NEXT_PART(io::recv(*network_entity::_s, t, flags));
+      io::ensure_cleanup_partial_messages ecpm(this->get_socket());
+
+      const bool has_wait = (timeout_ms != 0);
+
+      if (_inbound) {
+        return receive_budgeted(t, timeout_ms, topic);
+      }
+
+      if (_enable_skip) {
+        // Drain queued messages without decoding them and keep the last one only.
+        if (drain_latest(_recv_skip)) {
+          io::part_source src = _latest.replay();
+          return receive_message(src, t, 0, topic);
+        }
+      } else {
+        do {
+          if (receive_message(*network_entity::_s, t, ZMQ_DONTWAIT, topic)) {
+            return true;
+          }
+        } while (_stale_replay);
+      }
 
+      // We haven't received anything. See if waiting is ok. Stale replays do not 
+      // end the wait.
+      if (has_wait) {
+        timeout to(timeout_ms);
+        int left = timeout_ms;
+        while (timeout::is_timeleft(left) && io::is_data_pending(*network_entity::_s, left)) {
+          if (receive_message(*network_entity::_s, t, 0, topic)) {
+            return true;
+          } else if (!_stale_replay) {
+            return false;
+          }
+          left = to.timeleft();
+        }
+      }
+      return false;
+    }
+
+    /** Receive a message without decoding it, account it in the inbound budget and
+      * decode it afterwards. */
+    template<class D>
+    bool receive_budgeted(D &t, int timeout_ms, std::string *topic)
+    {
+      if (!drain_latest(_enable_skip ? _recv_skip : 0)) {
+        if (timeout_ms == 0) {
+          return false;
+        }
+
+        timeout to(timeout_ms);
+        int left = timeout_ms;
+        do {
+          if (!timeout::is_timeleft(left) || !io::is_data_pending(*network_entity::_s, left) || 
+              !_incoming.recv(*network_entity::_s, 0)) 
+          {
+            return false;
+          }
+          left = to.timeleft();
+        } while (!keep_incoming());
+      }
+
+      _latest.swap_parts(_parts);
+      if (!_inbound->admit(_parts)) {
+        _parts.clear();
+        return false;
+      }
+      _latest.swap_parts(_parts);
+
+      io::part_source src = _latest.replay();
+      return receive_message(src, t, 0, topic);
+    }
+
+    /** Receive queued messages without decoding them and keep the last one in _latest. 
+      * Stale replays of cached data are dropped without replacing a message kept before.
+      * At most skip + 1 other messages are received. Returns true if a message was kept. */
+    bool drain_latest(int skip)
+    {
+      bool kept = false;
+      int k = skip;
+      while (k >= 0 && _incoming.recv(*network_entity::_s, ZMQ_DONTWAIT)) {
+        if (keep_incoming()) {
+          kept = true;
+          --k;
+        }
+      }
+      return kept;
+    }
+
+    /** Move the message received into _incoming to _latest unless it is a stale replay
+      * of cached data. Returns true if the message was kept. */
+    bool keep_incoming()
+    {
+      _incoming.swap_parts(_parts);
+      const bool keep = !is_stale_replay(_parts);
+      if (keep) {
+        _latest.swap_parts(_parts);
+      }
+      _parts.clear();
+      return keep;
+    }
+
+    /** Test if undecoded message parts replay cached data on a topic data was received
+      * on before. */
+    bool is_stale_replay(const std::vector<zmq::message_t> &parts) const
+    {
+#ifdef IB_LEGACY_TEXT_ENCODING
+      return false;
+#else
+      return parts.size() > 1 && 
+        io::is_equal(parts[1], IB_EXCHANGE_PROTO_FAST_CACHED) && 
+        parts[0].size() > 0 &&
+        find_stream(parts[0]) < _streams.size();
+#endif
+    }
+
+    /** Receive complete message once. Returns false if no message is available, if
+      * the message was a stale replay of cached data or, when receiving through shared 
+      * memory, if the data was already overwritten. */
+    template<class S>
+    bool receive_message(S &s, T &t, int flags, std::string *topic)
+    {
+      zmq::message_t version;
+      IB_FIRST_PART(receive_header(s, version, flags, topic));
+
+      if (is_pointer_version(version)) {
+        std::shared_ptr<const T> p;
+        IB_NEXT_PART(io::recv_pointer(s, p, flags));
+        assign_copy(t, *p, std::is_copy_assignable<T>());
+        return true;
+      }
+
+      return receive_payload(s, version, t, flags);
+    }
+
+    /** Receive complete message once into shared pointer. */
+    template<class S>
+    bool receive_message(S &s, std::shared_ptr<const T> &p, int flags, std::string *topic)
+    {
+      zmq::message_t version;
+      IB_FIRST_PART(receive_header(s, version, flags, topic));
+
+      if (is_pointer_version(version)) {
+        IB_NEXT_PART(io::recv_pointer(s, p, flags));
+        return true;
+      }
+
+      std::shared_ptr<T> q = std::make_shared<T>();
+      if (!receive_payload(s, version, *q, flags)) {
+        return false;
+      }
+      p = q;
+      return true;
+    }
+
+    /** Receive topic and version parts. */
+    template<class S>
+    bool receive_header(S &s, zmq::message_t &version, int flags, std::string *topic)
+    {
+      _stale_replay = false;
+#ifdef IB_LEGACY_TEXT_ENCODING
+      IB_FIRST_PART(s.recv(&version, flags));
+      if (topic) {
+        topic->clear();
+      }
+#else
+      zmq::message_t t;
+      IB_FIRST_PART(io::recv_topic(s, t, flags));
+      IB_NEXT_PART(s.recv(&version, flags));
+
+      const bool first = mark_received(t);
+      if (io::is_equal(version, IB_EXCHANGE_PROTO_FAST_CACHED)) {
+        // Cached data is replayed to all subscribers when one joins. 
+        if (!first) {
+          io::discard_remainder(s);
+          _stale_replay = true;
+          return false;
+        }
+        IB_NEXT_PART(s.recv(&version, flags));
+      }
+
+      if (topic) {
+        topic->assign(static_cast<const char*>(t.data()), t.size() - 1);
+      }
+#endif
+      return true;
+    }
+
+    /** Remember that data was received on a topic and make its stream the current 
+      * one. Returns true for the first data. */
+    bool mark_received(const zmq::message_t &topic)
+    {
+      _current = find_stream(topic);
+      if (_current < _streams.size()) {
+        return false;
+      }
+      _streams.push_back(stream());
+      _streams.back().topic.assign(static_cast<const char*>(topic.data()), topic.size() - 1);
       return true;
     }
 
+    /** Find the stream of a topic part. Returns the number of streams if not found. */
+    size_t find_stream(const zmq::message_t &topic) const
+    {
+      const char *d = static_cast<const char*>(topic.data());
+      const size_t n = topic.size() - 1;
+      for (size_t i = 0; i < _streams.size(); ++i) {
+        if (_streams[i].topic.size() == n && memcmp(_streams[i].topic.data(), d, n) == 0) {
+          return i;
+        }
+      }
+      return _streams.size();
+    }
+
+    /** Copy shared element. */
+    static void assign_copy(T &t, const T &v, std::true_type)
+    {
+      t = v;
+    }
+
+    /** Shared elements of types that cannot be copied are only received by pointer. */
+    static void assign_copy(T &, const T &, std::false_type)
+    {
+      throw ib_error(ib_error::ECONVERSION);
+    }
+
+    /** Test for a message passing a pointer. Pointers are accepted only if 
+      * all endpoints are in-process. */
+    bool is_pointer_version(const zmq::message_t &version) const
+    {
+      if (!io::is_equal(version, IB_EXCHANGE_PROTO_POINTER_VERSION)) {
+        return false;
+      }
+      IB_ASSERT(!_remote, ib_error::EWRONGPROTO);
+      return true;
+    }
+
+    /** Receive serialized or shared memory data following the version part. */
+    template<class S>
+    bool receive_payload(S &s, const zmq::message_t &version, T &t, int flags)
+    {
+      if (_shm) {
+        network_entity::validate_version(IB_EXCHANGE_PROTO_SHM_VERSION, version);
+        return io::recv_shm(s, *_shm, t, flags);
+      }
+
+      network_entity::validate_version(IB_EXCHANGE_PROTO_FAST_VERSION, version);
+#ifdef IB_LEGACY_TEXT_ENCODING
+      IB_NEXT_PART(io::recv(s, t, flags));
+      return true;
+#else
+      // Decoders of compressed images are kept per topic.
+      return io::recv_decoded(s, _streams[_current].codecs, t, flags);
+#endif
+    }
+
+    /** Data received on a single topic. */
+    struct stream {
+      std::string topic;
+      codec_cache codecs;
+    };
+
     bool _enable_skip;
     int _recv_skip;
+    io::serialized_message _latest;
+    io::serialized_message _incoming;
+    bool _stale_replay;
+    shm_view_ptr _shm;
+    bool _remote;
+    bool _all_topics;
+    std::set<std::string> _topics;
+    std::vector<stream> _streams;
+    size_t _current;
+    byte_budget_ptr _inbound;
+    std::vector<zmq::message_t> _parts;
   };
 }
 
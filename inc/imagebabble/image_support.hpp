@@ -30,7 +30,10 @@
 #define __IMAGE_BABBLE_IMAGE_SUPPORT_HPP_INCLUDED__
 
 #include "core.hpp"
+#include "buffer_pool.hpp"
+#include "codec.hpp"
 #include <string>
+#include <climits>
 #include <vector>
 #include <exception>
 
@@ -38,12 +41,19 @@ namespace imagebabble {
 
   class image;
   class image_group;
+  class shm_view;
 
   namespace io {
-    template<> bool send<image>(zmq::socket_t &, const image &, int);
-    template<> bool recv<image>(zmq::socket_t &, image &, int);
-    template<> bool send<image_group>(zmq::socket_t &, const image_group &, int);
-    template<> bool recv<image_group>(zmq::socket_t &, image_group &, int);
+    struct image_header;
+    class group_directory;
+    template<> struct serializer<image>;
+    template<> struct serializer<image_group>;
+    template<class S> bool send_image_payload(S &, const image &, int);
+    template<class S> bool recv_image_payload(S &, image &, int, size_t *nbytes = 0);
+    bool encode_image_payload(const image &, image_header &, zmq::message_t &);
+    template<class S> bool recv_coded_payload(S &, image &, const image_header &, codec_cache *, int);
+    template<class S> bool recv_image(S &, image &, codec_cache *, int);
+    template<class S> bool recv_shm(S &, shm_view &, image &, int);
   };
   
   /** Represents a generic image. An image consists of basic header information
@@ -53,6 +63,9 @@ namespace imagebabble {
     *  - \a height number of rows in image
     *  - \a step the number of bytes between two subsequent rows.
     *  - \a type opaque type information. 
+    *  - \a flags application defined flags.
+    *  - \a sequence a frame counter maintained by the application.
+    *  - \a timestamp an application defined point in time, e.g. the capture time.
     *
     * \note the \a type field is application dependent. If the sender uses a specific
     *       type value, the client should know its meaning and act accordingly. For example when 
@@ -93,7 +106,37 @@ namespace imagebabble {
       /** Grayscale image using 8 bit channel. */
       FORMAT_GRAY_8,
       /** Depth image using 16 bit channel.    */
-      FORMAT_DEPTH_16
+      FORMAT_DEPTH_16,
+      /** Raw Bayer mosaic with 8 bit samples, first row red and green. */
+      FORMAT_BAYER_RGGB_8,
+      /** Raw Bayer mosaic with 8 bit samples, first row blue and green. */
+      FORMAT_BAYER_BGGR_8,
+      /** Raw Bayer mosaic with 8 bit samples, first row green and red. */
+      FORMAT_BAYER_GRBG_8,
+      /** Raw Bayer mosaic with 8 bit samples, first row green and blue. */
+      FORMAT_BAYER_GBRG_8,
+      /** Raw Bayer mosaic with 16 bit samples, first row red and green. */
+      FORMAT_BAYER_RGGB_16,
+      /** Raw Bayer mosaic with 16 bit samples, first row blue and green. */
+      FORMAT_BAYER_BGGR_16,
+      /** Raw Bayer mosaic with 16 bit samples, first row green and red. */
+      FORMAT_BAYER_GRBG_16,
+      /** Raw Bayer mosaic with 16 bit samples, first row green and blue. */
+      FORMAT_BAYER_GBRG_16,
+      /** RGBA format using 8 bits per channel. */
+      FORMAT_RGBA_8888,
+      /** BGRA format using 8 bits per channel. */
+      FORMAT_BGRA_8888,
+      /** Packed YUV 4:2:2, byte order Y0 U Y1 V. */
+      FORMAT_YUYV,
+      /** Packed YUV 4:2:2, byte order U Y0 V Y1. */
+      FORMAT_UYVY,
+      /** Planar YUV 4:2:0. The luma plane of step bytes per row is followed by 
+        * ceil(h/2) rows of interleaved U and V samples, also step bytes each. */
+      FORMAT_NV12,
+      /** Planar YUV 4:2:0. The luma plane of step bytes per row is followed by 
+        * the U plane and the V plane of ceil(h/2) rows of step/2 bytes each. */
+      FORMAT_I420
     };
 
     /** Free function prototype when sharing user memory */
@@ -101,7 +144,8 @@ namespace imagebabble {
 
     /** Construct a new image. */
     inline image()
-      : _w(0), _h(0), _step(0), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(false)
+      : _w(0), _h(0), _step(0), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(false),
+        _flags(0), _seq(0), _stamp(0)
     {}
 
     /** Construct a new image. The implementation will copy the header 
@@ -110,27 +154,46 @@ namespace imagebabble {
       : _w(other._w), _h(other._h), _step(other._step), 
       _external_type(other._external_type), 
       _format(other._format), 
-      _shared_mem(other._shared_mem)
+      _shared_mem(other._shared_mem),
+      _flags(other._flags), _seq(other._seq), _stamp(other._stamp),
+      _pool(other._pool), _codec(other._codec)
     {
       _msg.copy(const_cast<zmq::message_t*>(&other._msg));
     }
 
     /** Construct a new image. Allocates the necessary image data buffer size. */
     inline explicit image(int w, int h, int step) 
-      : _msg(h*step), _w(w), _h(h), _step(step), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(false)
+      : _msg(h*step), _w(w), _h(h), _step(step), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(false),
+        _flags(0), _seq(0), _stamp(0)
+    {}
+  
+    /** Construct a new image of the given format. Allocates the buffer size required 
+      * by the format, which exceeds h*step for planar formats. */
+    inline explicit image(int w, int h, int step, eformat f) 
+      : _msg(get_buffer_size(f, h, step)), _w(w), _h(h), _step(step), _external_type(-1), _format(f), _shared_mem(false),
+        _flags(0), _seq(0), _stamp(0)
     {}
   
     /** Construct a new image. The implementation does not take ownership of the passed 
       * bock. Freeing it is a responsibility of the caller. The implementation will ensure
       * that any custom free function of share_mem is being called. */
     inline explicit image(int w, int h, int step, void *data, const share_mem &s) 
-      : _msg(data, h*step, s.get_free_fn(), s.get_hint()), _w(w), _h(h), _step(step), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(true)
+      : _msg(data, h*step, s.get_free_fn(), s.get_hint()), _w(w), _h(h), _step(step), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(true),
+        _flags(0), _seq(0), _stamp(0)
+    {}
+
+    /** Construct a new image of the given format that shares user memory of the buffer 
+      * size required by the format. \see image(int, int, int, void*, const share_mem&) */
+    inline explicit image(int w, int h, int step, eformat f, void *data, const share_mem &s) 
+      : _msg(data, get_buffer_size(f, h, step), s.get_free_fn(), s.get_hint()), _w(w), _h(h), _step(step), _external_type(-1), _format(f), _shared_mem(true),
+        _flags(0), _seq(0), _stamp(0)
     {}
 
     /** Construct a new image. The implementation will copy the data given. The newly
       * allocated buffer will be released when its reference count hits zero. */
     inline explicit image(int w, int h, int step, void *data, const copy_mem &) 
-      : _msg(h*step), _w(w), _h(h), _step(step), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(false)
+      : _msg(h*step), _w(w), _h(h), _step(step), _external_type(-1), _format(FORMAT_UNKNOWN), _shared_mem(false),
+        _flags(0), _seq(0), _stamp(0)
     {
       memcpy(_msg.data(), data, _msg.size());      
     }
@@ -144,7 +207,9 @@ namespace imagebabble {
         _w(rhs._w), _h(rhs._h), 
         _external_type(rhs._external_type), 
         _format(rhs._format),
-        _step(rhs._step)
+        _step(rhs._step),
+        _flags(rhs._flags), _seq(rhs._seq), _stamp(rhs._stamp),
+        _pool(std::move(rhs._pool)), _codec(std::move(rhs._codec))
     {}
 
     /** Move assignment operator. Renders the source invalid. */
@@ -158,6 +223,11 @@ namespace imagebabble {
         _external_type = rhs._external_type;
         _format = rhs._format;
         _step = rhs._step;
+        _flags = rhs._flags;
+        _seq = rhs._seq;
+        _stamp = rhs._stamp;
+        _pool = rhs._pool;
+        _codec = rhs._codec;
       }
       return *this;
     }
@@ -175,6 +245,11 @@ namespace imagebabble {
         _step = rhs._step;
         _external_type = rhs._external_type;
         _format = rhs._format;
+        _flags = rhs._flags;
+        _seq = rhs._seq;
+        _stamp = rhs._stamp;
+        _pool = rhs._pool;
+        _codec = rhs._codec;
       }
       return *this;
     }
@@ -247,6 +322,114 @@ namespace imagebabble {
       _format = f; 
     }
 
+    /** Get the number of bytes needed to store an image of the given format, height 
+      * and row step. */
+    static inline size_t get_buffer_size(eformat f, int h, int step)
+    {
+      const size_t luma = static_cast<size_t>(h) * step;
+      const size_t chroma_rows = static_cast<size_t>(h + 1) / 2;
+      switch (f) {
+      case FORMAT_NV12:
+        return luma + chroma_rows * step;
+      case FORMAT_I420:
+        return luma + 2 * chroma_rows * (step / 2);
+      default:
+        return luma;
+      }
+    }
+
+    /** Get application defined flags. */
+    inline uint16_t get_flags() const
+    {
+      return _flags;
+    }
+
+    /** Set application defined flags. Flags are transmitted along with
+      * the image header but are otherwise not interpreted. */
+    inline void set_flags(uint16_t flags)
+    {
+      _flags = flags;
+    }
+
+    /** Get the frame sequence number. */
+    inline uint32_t get_sequence() const
+    {
+      return _seq;
+    }
+
+    /** Set the frame sequence number. The sequence number is transmitted 
+      * along with the image header and allows clients to detect lost frames. */
+    inline void set_sequence(uint32_t seq)
+    {
+      _seq = seq;
+    }
+
+    /** Get the timestamp. */
+    inline uint64_t get_timestamp() const
+    {
+      return _stamp;
+    }
+
+    /** Set the timestamp. The unit is application defined, e.g. 
+      * microseconds since epoch at the time of capture. */
+    inline void set_timestamp(uint64_t stamp)
+    {
+      _stamp = stamp;
+    }
+
+    /** Get the buffer pool used when receiving. */
+    inline const buffer_pool_ptr &get_buffer_pool() const
+    {
+      return _pool;
+    }
+
+    /** Set a buffer pool to receive image data into. When set, received image data is 
+      * stored in buffers drawn from the pool and returned to the pool once no image
+      * references them anymore. This avoids allocating a new buffer per frame when
+      * receiving streams. Pass an empty pointer to disable pooling. Has no effect on
+      * images referencing pre-allocated user memory. */
+    inline void set_buffer_pool(const buffer_pool_ptr &pool)
+    {
+      _pool = pool;
+    }
+
+    /** Get the codec used for the image data. */
+    inline const codec_ptr &get_codec() const
+    {
+      return _codec;
+    }
+
+    /** Set a codec to compress image data when sending. The codec identifier is sent
+      * in the image header and receivers decode transparently, into a buffer drawn
+      * from the buffer pool if one is set. The codec may decide to send payloads
+      * uncompressed, e.g. when they do not shrink. Pass an empty pointer to use the
+      * default codec of the image format, see image::set_default_codec.
+      *
+      * When receiving, the image keeps the codec used for decoding, so stateful codecs
+      * continue across frames received into the same image. Packed image groups 
+      * always send uncompressed payloads. */
+    inline void set_codec(const codec_ptr &c)
+    {
+      _codec = c;
+    }
+
+    /** Get the codec used for images of the given format that have no codec of their own. */
+    static inline codec_ptr get_default_codec(eformat f)
+    {
+      std::lock_guard<std::mutex> lock(get_default_codec_mutex());
+      return get_default_codecs()[f & 0xff];
+    }
+
+    /** Set the codec used for images of the given format that have no codec of their own.
+      * The codec is shared by all images and threads and must therefore keep no state.
+      * Depth images use rvl_codec by default. Pass an empty pointer to send images of 
+      * the format uncompressed. */
+    static inline void set_default_codec(eformat f, const codec_ptr &c)
+    {
+      std::lock_guard<std::mutex> lock(get_default_codec_mutex());
+      get_default_codecs()[f & 0xff] = c;
+    }
+
     /** Copy image data buffer to given destination. */
     inline void copy_to(void *dst) const 
     {
@@ -255,33 +438,100 @@ namespace imagebabble {
 
   private:
 
-    friend bool io::send<image>(zmq::socket_t &, const image &, int);
-    friend bool io::recv<image>(zmq::socket_t &, image &, int);
+    /** Get default codecs by format. */
+    static inline std::vector<codec_ptr> &get_default_codecs()
+    {
+      static std::vector<codec_ptr> codecs = make_default_codecs();
+      return codecs;
+    }
+
+    /** Build the initial default codecs. */
+    static inline std::vector<codec_ptr> make_default_codecs()
+    {
+      std::vector<codec_ptr> c(256);
+      c[FORMAT_DEPTH_16] = codec_ptr(new rvl_codec());
+      return c;
+    }
+
+    /** Get the mutex guarding default codecs. */
+    static inline std::mutex &get_default_codec_mutex()
+    {
+      static std::mutex m;
+      return m;
+    }
+
+    friend struct io::image_header;
+    friend struct io::serializer<image>;
+    template<class S> friend bool io::send_image_payload(S &, const image &, int);
+    template<class S> friend bool io::recv_image_payload(S &, image &, int, size_t *);
+    friend bool io::encode_image_payload(const image &, io::image_header &, zmq::message_t &);
+    template<class S> friend bool io::recv_coded_payload(S &, image &, const io::image_header &, codec_cache *, int);
+    template<class S> friend bool io::recv_image(S &, image &, codec_cache *, int);
+    template<class S> friend bool io::recv_shm(S &, shm_view &, image &, int);
 
     zmq::message_t _msg;
     int _w, _h, _step, _external_type;
     eformat _format;
     bool _shared_mem;
+    uint16_t _flags;
+    uint32_t _seq;
+    uint64_t _stamp;
+    buffer_pool_ptr _pool;
+    codec_ptr _codec;
   };
   
-  /** A collection of images to be sent/received at once. */
+  /** Get the number of bytes per pixel of a packed format, or of the luma plane of a planar
+    * format. Returns zero for image::FORMAT_UNKNOWN. */
+  inline int get_bytes_per_pixel(image::eformat f)
+  {
+    switch (f) {
+    case image::FORMAT_RGB_888:
+    case image::FORMAT_BGR_888:
+      return 3;
+    case image::FORMAT_RGBA_8888:
+    case image::FORMAT_BGRA_8888:
+      return 4;
+    case image::FORMAT_DEPTH_16:
+    case image::FORMAT_YUYV:
+    case image::FORMAT_UYVY:
+    case image::FORMAT_BAYER_RGGB_16:
+    case image::FORMAT_BAYER_BGGR_16:
+    case image::FORMAT_BAYER_GRBG_16:
+    case image::FORMAT_BAYER_GBRG_16:
+      return 2;
+    case image::FORMAT_UNKNOWN:
+      return 0;
+    default:
+      return 1;
+    }
+  }
+
+  /** A collection of images to be sent/received at once. 
+    *
+    * By default an image group is sent as a sequence of message parts: the identifier,
+    * the names vector and the images vector, which amounts to 2N+5 parts for N images.
+    * Enabling the packed format via image_group::set_packed sends a single binary 
+    * directory part (see io::group_directory) followed by one zero-copy part per image 
+    * payload instead. Receivers detect the format automatically.
+    */
   class image_group {
   public:
 
     /** Construct a new image group. */
     inline image_group() 
+      : _packed(false)
     {}
 
     /** Construct a new image group. */
     inline image_group( const std::string &id) 
-      : _id(id)
+      : _id(id), _packed(false)
     {}
 
 #ifdef IB_HAS_RVALUE_REFS
 
     /** Construct a new image group. */
     inline image_group(image_group &&rhs)
-      : _images(std::move(rhs._images)), _names(rhs._names), _id(rhs._id)
+      : _images(std::move(rhs._images)), _names(std::move(rhs._names)), _id(std::move(rhs._id)), _packed(rhs._packed)
     {}
 
     /** Move assignment operator.  */
@@ -291,6 +541,7 @@ namespace imagebabble {
         _images = std::move(rhs._images);
         _names = std::move(rhs._names);
         _id = std::move(rhs._id);        
+        _packed = rhs._packed;
       }
       return *this;
     }
@@ -298,8 +549,8 @@ namespace imagebabble {
     /** Move append named image. */
     inline void add_image(image &&i, std::string &&name = std::string())
     {
-      _images.push_back(i);
-      _names.push_back(name);
+      _images.push_back(std::move(i));
+      _names.push_back(std::move(name));
     }
 
 #endif
@@ -366,6 +617,21 @@ namespace imagebabble {
       _id = id;
     }
 
+    /** Test if the group is sent in packed format. For received groups
+      * this reflects the format used by the sender. */
+    inline bool is_packed() const
+    {
+      return _packed;
+    }
+
+    /** Enable the packed wire format. The packed format sends N+1 message 
+      * parts for N images instead of 2N+5. Peers running earlier releases
+      * do not understand the packed format. */
+    inline void set_packed(bool enable)
+    {
+      _packed = enable;
+    }
+
     /** Finds index of image corresponding to given name. Search is case-sensitive.
       *
       * \param[in] name name of image
@@ -384,97 +650,675 @@ namespace imagebabble {
 
   private:
     
-    friend bool io::send<image_group>(zmq::socket_t &, const image_group &, int);
-    friend bool io::recv<image_group>(zmq::socket_t &, image_group &, int);
+    friend class io::group_directory;
+    friend struct io::serializer<image_group>;
 
     std::vector<image> _images;
     std::vector<std::string> _names;
     std::string _id;
+    bool _packed;
   };
 
 
   namespace io {
-    
-    /** Send image. */
-    template<>
-    inline bool send(zmq::socket_t &s, const image &v, int flags) 
-    { 
-      std::ostringstream ostr;
-      ostr << v.get_width() << " "
-           << v.get_height() << " "
-           << v.get_step() << " "
-           << v.get_external_type() << " "
-           << v.get_format();
 
-      IB_ASSERT(ostr.good(), ib_error::ECONVERSION);
+    /** Binary image header. The header is sent as the first part of an image
+      * message and has a fixed size, little-endian layout
+      *  - byte  0 header version with the high bit set
+      *  - byte  1 image format
+      *  - bytes 2-3 flags
+      *  - bytes 4-7 width
+      *  - bytes 8-11 height
+      *  - bytes 12-15 step
+      *  - bytes 16-19 external type
+      *  - bytes 20-23 sequence number
+      *  - bytes 24-31 timestamp
+      *
+      * At 32 bytes the header fits into a ZMQ very small message, so it
+      * is sent without touching the heap. The high bit of the first byte 
+      * tells it apart from the textual header of earlier releases, which
+      * is still accepted when receiving. The textual header is sent when 
+      * IB_LEGACY_TEXT_ENCODING is defined.
+      *
+      * Headers of compressed payloads carry version 0x82 and four more bytes
+      *  - byte  32 codec identifier, see ecodec
+      *  - bytes 33-35 reserved, zero
+      *
+      * The payload then holds the codec output, which decodes to height 
+      * times step bytes.
+      */
+    struct image_header {
+
+      enum { 
+        /** Current header version as sent in the first byte. */
+        wire_version = 0x81, 
+        /** Number of bytes occupied on the wire. */
+        wire_size = 32,
+        /** Header version of compressed payloads. */
+        wire_version_coded = 0x82,
+        /** Number of bytes occupied on the wire by headers of compressed payloads. */
+        wire_size_coded = 36
+      };
+
+      uint8_t format;
+      uint16_t flags;
+      int32_t width, height, step, external_type;
+      uint32_t sequence;
+      uint64_t timestamp;
+      uint8_t codec;
+
+      /** Construct empty header. */
+      inline image_header()
+        : format(0), flags(0), width(0), height(0), step(0), external_type(0), 
+          sequence(0), timestamp(0), codec(CODEC_NONE)
+      {}
+
+      /** Get the number of bytes occupied on the wire. */
+      inline size_t get_wire_size() const
+      {
+        return (codec == CODEC_NONE) ? wire_size : wire_size_coded;
+      }
 
-      IB_FIRST_PART(io::send(s, ostr.str(), flags | ZMQ_SNDMORE));
-      
+      /** Write header to given buffer of at least get_wire_size bytes. */
+      inline void store(void *dst) const
+      {
+        char *p = static_cast<char*>(dst);
+        io::store_le<uint8_t>(p + 0, (codec == CODEC_NONE) ? wire_version : wire_version_coded);
+        io::store_le<uint8_t>(p + 1, format);
+        io::store_le<uint16_t>(p + 2, flags);
+        io::store_le<uint32_t>(p + 4, width);
+        io::store_le<uint32_t>(p + 8, height);
+        io::store_le<uint32_t>(p + 12, step);
+        io::store_le<uint32_t>(p + 16, external_type);
+        io::store_le<uint32_t>(p + 20, sequence);
+        io::store_le<uint64_t>(p + 24, timestamp);
+        if (codec != CODEC_NONE) {
+          io::store_le<uint32_t>(p + 32, codec);
+        }
+      }
+
+      /** Fill header fields from image. */
+      inline void assign_from(const image &v)
+      {
+        format = static_cast<uint8_t>(v._format);
+        flags = v._flags;
+        width = v._w;
+        height = v._h;
+        step = v._step;
+        external_type = v._external_type;
+        sequence = v._seq;
+        timestamp = v._stamp;
+        codec = CODEC_NONE;
+      }
+
+      /** Test that dimensions are non-negative, rows hold the pixels of the format and 
+        * the image fits into a single message. */
+      static inline bool is_valid_layout(int format, int w, int h, int step)
+      {
+        if (format < image::FORMAT_UNKNOWN || format > image::FORMAT_I420 || w < 0 || h < 0 || step < 0) {
+          return false;
+        }
+        const image::eformat f = static_cast<image::eformat>(format);
+        return static_cast<int64_t>(step) >= static_cast<int64_t>(w) * get_bytes_per_pixel(f) &&
+               static_cast<uint64_t>(image::get_buffer_size(f, h, step)) <= static_cast<uint64_t>(INT_MAX);
+      }
+
+      /** Test that the header describes a valid image layout. */
+      inline bool is_valid() const
+      {
+        return is_valid_layout(format, width, height, step);
+      }
+
+      /** Apply header fields to image. The image data is not modified. */
+      inline void assign_to(image &v) const
+      {
+        v._format = static_cast<image::eformat>(format);
+        v._flags = flags;
+        v._w = width;
+        v._h = height;
+        v._step = step;
+        v._external_type = external_type;
+        v._seq = sequence;
+        v._stamp = timestamp;
+      }
+
+      /** Read header from given buffer. Returns false if the buffer does
+        * not contain a binary header of a known version. 
+        * \throws ib_error if the header describes an invalid layout. */
+      inline bool load(const void *src, size_t n)
+      {
+        const char *p = static_cast<const char*>(src);
+        if (n == wire_size && io::load_le<uint8_t>(p) == wire_version) {
+          codec = CODEC_NONE;
+        } else if (n == wire_size_coded && io::load_le<uint8_t>(p) == wire_version_coded) {
+          codec = io::load_le<uint8_t>(p + 32);
+        } else {
+          return false;
+        }
+
+        format = io::load_le<uint8_t>(p + 1);
+        flags = io::load_le<uint16_t>(p + 2);
+        width = static_cast<int32_t>(io::load_le<uint32_t>(p + 4));
+        height = static_cast<int32_t>(io::load_le<uint32_t>(p + 8));
+        step = static_cast<int32_t>(io::load_le<uint32_t>(p + 12));
+        external_type = static_cast<int32_t>(io::load_le<uint32_t>(p + 16));
+        sequence = io::load_le<uint32_t>(p + 20);
+        timestamp = io::load_le<uint64_t>(p + 24);
+        IB_ASSERT(is_valid(), ib_error::ECONVERSION);
+        return true;
+      }
+    };
+    
+    /** Send image data buffer as a single message part without copying. */
+    template<class S>
+    inline bool send_image_payload(S &s, const image &v, int flags)
+    {
       // Need to copy in order to increment reference count, otherwise the 
       // input buffer is nullified.
       
       zmq::message_t m;
       m.copy(const_cast<zmq::message_t*>(&v._msg));
 
-      IB_NEXT_PART(s.send(m, flags));
+      IB_FIRST_PART(s.send(m, flags));
+      return true;
+    }
 
+    /** Receive image data buffer from a single message part. If image data points 
+      * to pre-allocated user memory, the implementation attempts to receive data 
+      * directly into that buffer. If the image has a buffer pool, data is received
+      * into a pooled buffer sized according to the image header already received. 
+      * The number of bytes sent is stored to nbytes, if given. */
+    template<class S>
+    inline bool recv_image_payload(S &s, image &v, int flags, size_t *nbytes)
+    {
+      size_t bytes = 0;
+      if (v._pool && !v._shared_mem) {
+        const size_t maxbytes = image::get_buffer_size(v._format, v._h, v._step);
+        void *p = v._pool->allocate(maxbytes);
+        try {
+          IB_CATCH_ZMQ_RETHROW(bytes = s.recv(p, maxbytes, 0));
+        } catch (...) {
+          buffer_pool::release(p, 0);
+          throw;
+        }
+        if (bytes > maxbytes) {
+          buffer_pool::release(p, 0);
+          throw ib_error(ib_error::EBUFFERTOOSMALL);
+        }
+        zmq::message_t m(p, bytes, &buffer_pool::release, 0);
+        v._msg.move(&m);
+      } else if (v._shared_mem) {
+        IB_CATCH_ZMQ_RETHROW(bytes = s.recv(v._msg.data(), v._msg.size(), 0));
+        IB_ASSERT(bytes <= v._msg.size(), ib_error::EBUFFERTOOSMALL);
+      } else {
+        IB_FIRST_PART(s.recv(&v._msg, flags));        
+        bytes = v._msg.size();
+      }
+
+      if (nbytes) {
+        *nbytes = bytes;
+      }
       return true;
     }
 
-    /** Receive image data. If image data points to pre-allocated user memory,
-      * the implementation attempts to receive data directly into that buffer.
-      * If the buffer is too small to fit the content, the received bytes are
-      * truncated to fit and false is returned. */
-    template<>
-    inline bool recv(zmq::socket_t &s, image &v, int flags) 
+    /** Get the pool providing codec buffers for images without a buffer pool of their own. */
+    inline const buffer_pool_ptr &get_codec_pool()
     {
-      zmq::message_t msg;
+      static buffer_pool_ptr pool(new buffer_pool());
+      return pool;
+    }
 
-      IB_FIRST_PART(s.recv(&msg, flags));
-      
-      in_memory_buffer mb(static_cast<char*>(msg.data()), msg.size());
-      std::istream is(&mb);
+    /** Compress image data with the codec of the image, or the default codec of its
+      * format, into a pooled buffer. On success the codec identifier is stored in the 
+      * header. Returns false if there is no codec or the codec chose to send the data 
+      * uncompressed. */
+    inline bool encode_image_payload(const image &v, image_header &h, zmq::message_t &m)
+    {
+      if (v._msg.size() == 0) {
+        return false;
+      }
+
+      const codec_ptr c = v._codec ? v._codec : image::get_default_codec(v._format);
+      if (!c) {
+        return false;
+      }
+
+      const codec_layout l = {v._w, v._h, v._step, v._format};
+      const size_t raw = v._msg.size();
+      const size_t capacity = c->get_max_encoded_size(l, raw);
+
+      const buffer_pool_ptr &pool = v._pool ? v._pool : get_codec_pool();
+      void *p = pool->allocate(capacity);
+      const size_t bytes = c->encode(l, v._msg.data(), raw, p, capacity);
+      if (bytes == 0) {
+        buffer_pool::release(p, 0);
+        return false;
+      }
 
-      is  >> v._w 
-          >> v._h
-          >> v._step
-          >> v._external_type
-          >> reinterpret_cast<int&>(v._format);
+      zmq::message_t coded(p, bytes, &buffer_pool::release, 0);
+      m.move(&coded);
+      h.codec = c->get_id();
+      return true;
+    }
 
-      IB_ASSERT(!is.fail(), ib_error::ECONVERSION);
+    /** Get the codec keeping state between frames sent from the given data. Empty for
+      * data other than images. */
+    template<class T>
+    inline codec_ptr get_stream_codec(const T &)
+    {
+      return codec_ptr();
+    }
+
+    /** Get the codec attached to the image. Default codecs of image formats keep no state. */
+    inline codec_ptr get_stream_codec(const image &v)
+    {
+      return v.get_codec();
+    }
+
+    /** Test if an image serialized into the given parts decodes without frames sent before. 
+      * Only images encoded by the given stream codec may depend on earlier frames. */
+    inline bool is_keyframe(const codec_ptr &c, const std::vector<zmq::message_t> &parts)
+    {
+      image_header h;
+      if (!c || parts.size() != 2 || !h.load(parts[0].data(), parts[0].size()) || h.codec != c->get_id()) {
+        return true;
+      }
+      return c->is_keyframe(parts[1].data(), parts[1].size());
+    }
+
+    /** Receive compressed image data and decode it. The decoder is taken from the 
+      * given cache, if any. Otherwise the codec held by the image is used if it matches
+      * the identifier found in the header, or a new one is created through the 
+      * codec_registry. Data is decoded directly into pre-allocated user memory or 
+      * into a buffer drawn from the buffer pool of the image, if any, or a shared 
+      * codec pool otherwise. Header fields are applied to the image on success only.
+      *
+      * \returns false if the data cannot be decoded, e.g. a delta frame whose 
+      *          reference was not received. The message is consumed nevertheless. */
+    template<class S>
+    inline bool recv_coded_payload(S &s, image &v, const image_header &h, codec_cache *codecs, int flags)
+    {
+      zmq::message_t m;
+      IB_FIRST_PART(s.recv(&m, flags));
+
+      codec_ptr c;
+      if (codecs) {
+        c = codecs->get(h.codec);
+      } else if (v._codec && v._codec->get_id() == h.codec) {
+        c = v._codec;
+      } else {
+        c = codec_registry::create(h.codec);
+      }
+      IB_ASSERT(c, ib_error::ECONVERSION);
+
+      const codec_layout l = {h.width, h.height, h.step, h.format};
+      const size_t raw = image::get_buffer_size(static_cast<image::eformat>(h.format), h.height, h.step);
 
       if (v._shared_mem) {
-        int bytes = zmq_recv(s, v._msg.data(), v._msg.size(), 0);
-        int maxbytes = static_cast<int>(v._msg.size());
-        IB_ASSERT(bytes <= maxbytes, ib_error::EBUFFERTOOSMALL);
+        IB_ASSERT(raw <= v._msg.size(), ib_error::EBUFFERTOOSMALL);
+        if (!c->decode(l, m.data(), m.size(), v._msg.data(), raw)) {
+          return false;
+        }
       } else {
-        IB_NEXT_PART(s.recv(&v._msg, flags));        
+        const buffer_pool_ptr &pool = v._pool ? v._pool : get_codec_pool();
+        void *p = pool->allocate(raw);
+        if (!c->decode(l, m.data(), m.size(), p, raw)) {
+          buffer_pool::release(p, 0);
+          return false;
+        }
+        zmq::message_t decoded(p, raw, &buffer_pool::release, 0);
+        v._msg.move(&decoded);
       }
 
+      h.assign_to(v);
+      v._codec = c;
       return true;
     }
 
-    /** Send image group. */
+    /** Directory of an image group sent in packed format. The directory is the first
+      * message part of a packed image group and is followed by one part per image 
+      * payload. It has the following little-endian layout
+      *  - bytes 0-3 magic 0x89 'I' 'B' 'G'
+      *  - bytes 4-7 number of images n
+      *  - bytes 8-11 offset of the group identifier
+      *  - bytes 12-15 length of the group identifier
+      *  - n entries of 48 bytes each: name offset (4 bytes), name length (4 bytes),
+      *    payload size (8 bytes) and the io::image_header of the image (32 bytes)
+      *  - string pool holding identifier and names
+      *
+      * Offsets are relative to the start of the directory. Once validated by 
+      * group_directory::parse, all fields are accessed in place without allocating.
+      */
+    class group_directory {
+    public:
+
+      enum {
+        /** Magic number identifying a directory. */
+        magic = 0x47424989,
+        /** Size of fixed header in bytes. */
+        header_size = 16,
+        /** Size of a single entry in bytes. */
+        entry_size = 48
+      };
+
+      /** Construct empty directory. */
+      inline group_directory()
+        : _p(0), _n(0), _count(0)
+      {}
+
+      /** Attach to the given buffer and validate it. Returns false if 
+        * the buffer does not contain a valid directory. */
+      inline bool parse(const void *data, size_t n)
+      {
+        _p = static_cast<const char*>(data);
+        _n = n;
+        _count = 0;
+
+        if (n < header_size || io::load_le<uint32_t>(_p) != magic) {
+          return false;
+        }
+
+        const uint64_t count = io::load_le<uint32_t>(_p + 4);
+        if (header_size + count * entry_size > n) {
+          return false;
+        }
+
+        if (!in_bounds(io::load_le<uint32_t>(_p + 8), io::load_le<uint32_t>(_p + 12))) {
+          return false;
+        }
+
+        for (uint64_t i = 0; i < count; ++i) {
+          const char *e = entry(static_cast<size_t>(i));
+          if (!in_bounds(io::load_le<uint32_t>(e), io::load_le<uint32_t>(e + 4))) {
+            return false;
+          }
+        }
+
+        _count = static_cast<size_t>(count);
+        return true;
+      }
+
+      /** Get the number of images. */
+      inline size_t size() const
+      {
+        return _count;
+      }
+
+      /** Get a pointer to the group identifier. The identifier is not zero-terminated. */
+      inline const char *id_data() const
+      {
+        return _p + io::load_le<uint32_t>(_p + 8);
+      }
+
+      /** Get the length of the group identifier. */
+      inline size_t id_size() const
+      {
+        return io::load_le<uint32_t>(_p + 12);
+      }
+
+      /** Get a pointer to the i-th image name. The name is not zero-terminated. */
+      inline const char *name_data(size_t i) const
+      {
+        return _p + io::load_le<uint32_t>(entry(i));
+      }
+
+      /** Get the length of the i-th image name. */
+      inline size_t name_size(size_t i) const
+      {
+        return io::load_le<uint32_t>(entry(i) + 4);
+      }
+
+      /** Get the number of bytes of the i-th image payload. */
+      inline uint64_t payload_size(size_t i) const
+      {
+        return io::load_le<uint64_t>(entry(i) + 8);
+      }
+
+      /** Get the header of the i-th image. Returns false if the header is of unknown version. */
+      inline bool get_header(size_t i, image_header &h) const
+      {
+        return h.load(entry(i) + 16, image_header::wire_size);
+      }
+
+      /** Get the number of bytes required to store the directory of the given group. */
+      static inline size_t required_size(const image_group &g)
+      {
+        size_t bytes = header_size + g._names.size() * entry_size + g._id.size();
+        for (size_t i = 0; i < g._names.size(); ++i) {
+          bytes += g._names[i].size();
+        }
+        return bytes;
+      }
+
+      /** Store directory of the given group to a buffer of group_directory::required_size bytes. */
+      static inline void store(const image_group &g, void *dst)
+      {
+        char *p = static_cast<char*>(dst);
+        const size_t n = g._names.size();
+
+        size_t pool = header_size + n * entry_size;
+
+        io::store_le<uint32_t>(p, magic);
+        io::store_le<uint32_t>(p + 4, static_cast<uint32_t>(n));
+        io::store_le<uint32_t>(p + 8, static_cast<uint32_t>(pool));
+        io::store_le<uint32_t>(p + 12, static_cast<uint32_t>(g._id.size()));
+        memcpy(p + pool, g._id.data(), g._id.size());
+        pool += g._id.size();
+
+        for (size_t i = 0; i < n; ++i) {
+          char *e = p + header_size + i * entry_size;
+          const std::string &name = g._names[i];
+          image_header h;
+          h.assign_from(g._images[i]);
+
+          io::store_le<uint32_t>(e, static_cast<uint32_t>(pool));
+          io::store_le<uint32_t>(e + 4, static_cast<uint32_t>(name.size()));
+          io::store_le<uint64_t>(e + 8, g._images[i].size());
+          h.store(e + 16);
+          memcpy(p + pool, name.data(), name.size());
+          pool += name.size();
+        }
+      }
+
+    private:
+
+      /** Get pointer to the i-th entry. */
+      inline const char *entry(size_t i) const
+      {
+        return _p + header_size + i * entry_size;
+      }
+
+      /** Test if the given range lies inside the buffer. */
+      inline bool in_bounds(uint64_t offset, uint64_t length) const
+      {
+        return offset <= _n && length <= _n - offset;
+      }
+
+      const char *_p;
+      size_t _n;
+      size_t _count;
+    };
+
+    /** Serializes images. */
     template<>
-    inline bool send(zmq::socket_t &s, const image_group &v, int flags) 
+    struct serializer<image> {
+
+      /** Send image. */
+      template<class S>
+      static inline bool send(S &s, const image &v, int flags) 
+      { 
+#ifdef IB_LEGACY_TEXT_ENCODING
+        std::ostringstream ostr;
+        ostr << v.get_width() << " "
+             << v.get_height() << " "
+             << v.get_step() << " "
+             << v.get_external_type() << " "
+             << v.get_format();
+
+        IB_ASSERT(ostr.good(), ib_error::ECONVERSION);
+
+        IB_FIRST_PART(io::send(s, ostr.str(), flags | ZMQ_SNDMORE));
+        IB_NEXT_PART(send_image_payload(s, v, flags));
+#else
+        image_header h;
+        h.assign_from(v);
+
+        zmq::message_t coded;
+        const bool is_coded = encode_image_payload(v, h, coded);
+
+        zmq::message_t hdr(h.get_wire_size());
+        h.store(hdr.data());
+
+        IB_FIRST_PART(s.send(hdr, flags | ZMQ_SNDMORE));
+        if (is_coded) {
+          IB_NEXT_PART(s.send(coded, flags));
+        } else {
+          IB_NEXT_PART(send_image_payload(s, v, flags));
+        }
+#endif
+
+        return true;
+      }
+
+      /** Receive image. \see io::recv_image */
+      template<class S>
+      static inline bool recv(S &s, image &v, int flags) 
+      {
+        return recv_image(s, v, 0, flags);
+      }
+    };
+
+    /** Receive image decoding compressed data with decoders from the given cache, 
+      * if any. If image data points to pre-allocated user memory,
+      * the implementation attempts to receive data directly into that buffer.
+      * If the buffer is too small to fit the content, the received bytes are
+      * truncated to fit and false is returned. Compressed data is decoded
+      * transparently. Returns false if it cannot be decoded, e.g. a delta 
+      * frame whose reference frame was not received into this image. */
+    template<class S>
+    inline bool recv_image(S &s, image &v, codec_cache *codecs, int flags) 
     {
-      IB_FIRST_PART(io::send(s, v.get_id(), flags | ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(s, v.get_names(), flags | ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(s, v.get_images(), flags));
+      zmq::message_t msg;
+
+      IB_FIRST_PART(s.recv(&msg, flags));
+
+      image_header h;
+      if (h.load(msg.data(), msg.size())) {
+        if (h.codec != CODEC_NONE) {
+          return recv_coded_payload(s, v, h, codecs, flags);
+        }
+        h.assign_to(v);
+      } else {
+        // Textual header as sent by earlier releases.
+        in_memory_buffer mb(static_cast<char*>(msg.data()), msg.size());
+        std::istream is(&mb);
+
+        is  >> v._w 
+            >> v._h
+            >> v._step
+            >> v._external_type
+            >> reinterpret_cast<int&>(v._format);
+
+        IB_ASSERT(!is.fail(), ib_error::ECONVERSION);
+        IB_ASSERT(image_header::is_valid_layout(v._format, v._w, v._h, v._step), ib_error::ECONVERSION);
+
+        v._flags = 0;
+        v._seq = 0;
+        v._stamp = 0;
+      }
+
+      IB_NEXT_PART(recv_image_payload(s, v, flags));
 
       return true;
     }
 
-    /** Receive image group. */
-    template<>
-    inline bool recv(zmq::socket_t &s, image_group &v, int flags) 
+    /** Receive data decoding compressed images with decoders kept per stream.
+      * Data types other than images are received by io::recv. */
+    template<class S, class T>
+    inline bool recv_decoded(S &s, codec_cache &, T &v, int flags)
     {
-      IB_FIRST_PART(io::recv(s, v._id, flags));
-      IB_NEXT_PART(io::recv(s, v._names, flags));
-      IB_NEXT_PART(io::recv(s, v._images, flags));
+      return io::recv(s, v, flags);
+    }
 
-      return true;
+    /** Receive image decoding compressed data with decoders kept per stream. 
+      * \see io::recv_image */
+    template<class S>
+    inline bool recv_decoded(S &s, codec_cache &codecs, image &v, int flags)
+    {
+      return recv_image(s, v, &codecs, flags);
     }
+
+    /** Serializes image groups. */
+    template<>
+    struct serializer<image_group> {
+
+      /** Send image group. */
+      template<class S>
+      static inline bool send(S &s, const image_group &v, int flags) 
+      {
+        if (v.is_packed()) {
+          IB_ASSERT(v._images.size() == v._names.size(), ib_error::EPARAMRANGE);
+
+          zmq::message_t dir(group_directory::required_size(v));
+          group_directory::store(v, dir.data());
+
+          const size_t n = v._images.size();
+          IB_FIRST_PART(s.send(dir, (n > 0) ? (flags | ZMQ_SNDMORE) : flags));
+          for (size_t i = 0; i < n; ++i) {
+            IB_NEXT_PART(send_image_payload(s, v._images[i], (i + 1 < n) ? (flags | ZMQ_SNDMORE) : flags));
+          }
+        } else {
+          IB_FIRST_PART(io::send(s, v.get_id(), flags | ZMQ_SNDMORE));
+          IB_NEXT_PART(io::send(s, v.get_names(), flags | ZMQ_SNDMORE));
+          IB_NEXT_PART(io::send(s, v.get_images(), flags));
+        }
+
+        return true;
+      }
+
+      /** Receive image group. Both, the packed and the multi-part format are 
+        * accepted. Existing images are reused to receive into pre-allocated 
+        * user memory. 
+        * \throws ib_error with ib_error::ECONVERSION if a packed payload does not match
+        * the size recorded in the directory or is smaller than its header implies. */
+      template<class S>
+      static inline bool recv(S &s, image_group &v, int flags) 
+      {
+        zmq::message_t msg;
+        IB_FIRST_PART(s.recv(&msg, flags));
+
+        group_directory dir;
+        if (dir.parse(msg.data(), msg.size())) {
+          const size_t n = dir.size();
+          v._packed = true;
+          v._id.assign(dir.id_data(), dir.id_size());
+          v._names.resize(n);
+          v._images.resize(n);
+
+          for (size_t i = 0; i < n; ++i) {
+            image_header h;
+            IB_ASSERT(dir.get_header(i, h), ib_error::ECONVERSION);
+            const uint64_t expected = dir.payload_size(i);
+            IB_ASSERT(expected >= image::get_buffer_size(static_cast<image::eformat>(h.format), h.height, h.step), ib_error::ECONVERSION);
+            h.assign_to(v._images[i]);
+            v._names[i].assign(dir.name_data(i), dir.name_size(i));
+
+            size_t received = 0;
+            IB_NEXT_PART(recv_image_payload(s, v._images[i], flags, &received));
+            IB_ASSERT(received == expected, ib_error::ECONVERSION);
+          }
+        } else {
+          v._packed = false;
+          v._id.assign(
+            static_cast<char*>(msg.data()), 
+            static_cast<char*>(msg.data()) + msg.size()); 
+          IB_NEXT_PART(io::recv(s, v._names, flags));
+          IB_NEXT_PART(io::recv(s, v._images, flags));
+        }
+
+        return true;
+      }
+    };
   }
 
   /** Generic image conversion. Specializations of this method handle
@@ -33,5 +33,9 @@
 #include "fast.hpp"
 #include "reliable.hpp"
 #include "image_support.hpp"
+#include "convert.hpp"
+#include "shm.hpp"
+#include "async.hpp"
+#include "mux.hpp"
 
 #endif
\ No newline at end of file
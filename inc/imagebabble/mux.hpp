@@ -0,0 +1,494 @@
+/*! \file mux.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#ifndef __IMAGE_BABBLE_MUX_HPP_INCLUDED__
+#define __IMAGE_BABBLE_MUX_HPP_INCLUDED__
+
+#include "core.hpp"
+#include <deque>
+#include <functional>
+#include <limits>
+
+namespace imagebabble {
+
+  class mux_server;
+
+  /** Handle to a channel of a mux_server. The handle is valid as long as the
+    * server is alive. */
+  template<class T>
+  class mux_channel {
+  public:
+
+    /** Construct invalid handle. */
+    mux_channel()
+      : _mux(0), _index(0)
+    {}
+
+    /** Serialize data and queue it for sending on this channel. Queued messages 
+      * are sent right away as far as the socket and the scheduler allow. 
+      * \returns false if nobody is subscribed to the channel. */
+    bool publish(const T &t);
+
+    /** Get the channel name. */
+    const std::string &get_name() const;
+
+    /** Get the number of messages waiting to be sent. */
+    size_t get_num_pending() const;
+
+    /** Get the number of messages dropped because the channel queue was full. */
+    size_t get_num_dropped() const;
+
+  private:
+    friend class mux_server;
+
+    mux_channel(mux_server *mux, size_t index)
+      : _mux(mux), _index(index)
+    {}
+
+    mux_server *_mux;
+    size_t _index;
+  };
+
+  /** Server multiplexing multiple named channels of possibly different types over a 
+    * single socket. Each channel is published as a topic of the fast protocol, so 
+    * fast_client instances subscribed to a channel name receive its data as well.
+    *
+    * Messages are serialized on publish and queued per channel. Queues are drained 
+    * by deficit round robin: in each round a channel may send up to its weight times 
+    * the quantum in bytes. A channel publishing large frames therefore cannot starve 
+    * channels publishing small ones. When a channel queue is full, its oldest message 
+    * is dropped.
+    *
+    * Other than fast_server, the socket does not drop messages at the high water mark 
+    * but reports back-pressure to the scheduler. Messages left queued are sent by the
+    * next call to publish or flush. 
+    *
+    * \note All channels share one socket and the scheduler resumes at the channel that
+    * would block. A slow subscriber whose queue is full therefore stalls all channels, 
+    * including those it is not subscribed to, until it catches up (head-of-line 
+    * blocking). Meanwhile channel queues fill up and drop their oldest messages. */
+  class mux_server : public network_entity {
+  public:
+
+    /** Default number of bytes a channel of weight one may send per round. */
+    enum { default_quantum = 64 * 1024 };
+
+    /** Default constructor. */
+    mux_server()
+      : network_entity(make_context())
+      , _quantum(default_quantum), _current(0), _granted(false), _pending(0)
+    {}
+
+    /** Construct from existing context. */
+    explicit mux_server(const context_ptr &ctx)
+      : network_entity(ctx)
+      , _quantum(default_quantum), _current(0), _granted(false), _pending(0)
+    {}
+
+    /** Destructor. */
+    virtual ~mux_server()
+    {}
+
+    /** Start a new service on the given endpoint. This method can be called 
+      * multiple times to publish all channels on multiple endpoints. */
+    virtual void startup(const std::string &addr = "tcp://127.0.0.1:6000")
+    {
+      if (!_s) {
+        _s = socket_ptr(new zmq::socket_t(*_ctx, ZMQ_XPUB));
+        network_entity::apply_socket_options();
+        io::subscription_set::enable_verbose(*_s);
+
+#ifdef ZMQ_XPUB_NODROP
+        int nodrop = 1;
+        IB_CATCH_ZMQ_RETHROW(_s->setsockopt(ZMQ_XPUB_NODROP, &nodrop, sizeof(int)));
+#endif
+      }
+
+      IB_CATCH_ZMQ_RETHROW(_s->bind(addr.c_str()));
+    }
+
+    /** Shutdown all services. Queued messages are discarded. */
+    virtual void shutdown()
+    {
+      for (size_t i = 0; i < _channels.size(); ++i) {
+        _channels[i].queue.clear();
+        _channels[i].deficit = 0;
+      }
+      _pending = 0;
+      _current = 0;
+      _granted = false;
+      _subscriptions.clear();
+
+      network_entity::shutdown();
+    }
+
+    /** Add a channel carrying data of type T. A weight of two allows the channel to
+      * send twice as many bytes per round as a channel of weight one. At most 
+      * max_queued messages are queued for the channel.
+      * \throws ib_error if a channel with the same name exists. */
+    template<class T>
+    mux_channel<T> add_channel(const std::string &name, size_t weight = 1, size_t max_queued = 4)
+    {
+      IB_ASSERT(weight > 0 && max_queued > 0, ib_error::EPARAMRANGE);
+      for (size_t i = 0; i < _channels.size(); ++i) {
+        IB_ASSERT(_channels[i].name != name, ib_error::EPARAMRANGE);
+      }
+
+      _channels.push_back(channel());
+      channel &c = _channels.back();
+      c.name = name;
+      c.type = &typeid(T);
+      c.weight = weight;
+      c.max_queued = max_queued;
+      c.deficit = 0;
+      c.dropped = 0;
+
+      return mux_channel<T>(this, _channels.size() - 1);
+    }
+
+    /** Get the number of channels. */
+    size_t get_num_channels() const
+    {
+      return _channels.size();
+    }
+
+    /** Set the number of bytes a channel of weight one may send per round. Smaller 
+      * values interleave channels more finely. */
+    void set_quantum(size_t nbytes)
+    {
+      IB_ASSERT(nbytes > 0, ib_error::EPARAMRANGE);
+      _quantum = nbytes;
+    }
+
+    /** Get the number of bytes a channel of weight one may send per round. */
+    size_t get_quantum() const
+    {
+      return _quantum;
+    }
+
+    /** Get the number of messages waiting to be sent on all channels. */
+    size_t get_num_pending() const
+    {
+      return _pending;
+    }
+
+    /** Get the number of subscribers to the given channel. */
+    size_t get_num_subscribers(const std::string &name)
+    {
+      IB_ASSERT(_s, ib_error::EINVALIDSOCKET);
+
+      _subscriptions.update(*_s);
+      return _subscriptions.count(name);
+    }
+
+    /** Send queued messages until all queues are empty, the socket would block or 
+      * about max_bytes were sent. At least one message is sent unless the socket 
+      * would block. The scheduler resumes where it stopped on the next call.
+      * \returns true if all queues are empty. */
+    bool flush(size_t max_bytes = std::numeric_limits<size_t>::max())
+    {
+      IB_ASSERT(_s, ib_error::EINVALIDSOCKET);
+
+      size_t sent = 0;
+      while (_pending > 0) {
+        channel &c = _channels[_current];
+
+        if (c.queue.empty()) {
+          next_channel();
+          continue;
+        }
+
+        if (!_granted) {
+          c.deficit += _quantum * c.weight;
+          _granted = true;
+        }
+
+        while (!c.queue.empty() && c.queue.front().nbytes <= c.deficit) {
+          const size_t nbytes = c.queue.front().nbytes;
+          if (sent > 0 && sent + nbytes > max_bytes) {
+            return false;
+          }
+          if (!send_front(c)) {
+            return false;
+          }
+          c.deficit -= nbytes;
+          sent += nbytes;
+        }
+
+        next_channel();
+      }
+
+      return true;
+    }
+
+  private:
+    template<class T> friend class mux_channel;
+
+    /** A serialized message waiting to be sent. */
+    struct queued_message {
+      std::vector<zmq::message_t> parts;
+      size_t nbytes;
+
+      queued_message()
+        : nbytes(0)
+      {}
+
+#ifdef IB_HAS_RVALUE_REFS
+      queued_message(queued_message &&other)
+        : parts(std::move(other.parts)), nbytes(other.nbytes)
+      {}
+#endif
+    };
+
+    /** Channel state. */
+    struct channel {
+      std::string name;
+      const std::type_info *type;
+      size_t weight;
+      size_t max_queued;
+      size_t deficit;
+      size_t dropped;
+      std::deque<queued_message> queue;
+    };
+
+    /** Serialize data and append it to the queue of a channel. */
+    template<class T>
+    bool enqueue(size_t index, const T &t)
+    {
+      IB_ASSERT(index < _channels.size() && *_channels[index].type == typeid(T), ib_error::EPARAMRANGE);
+
+      channel &c = _channels[index];
+      if (get_num_subscribers(c.name) == 0) {
+        return false;
+      }
+
+      queued_message m;
+      _serializer.assign(t);
+      _serializer.swap_parts(m.parts);
+      for (size_t i = 0; i < m.parts.size(); ++i) {
+        m.nbytes += m.parts[i].size();
+      }
+
+      if (c.queue.size() >= c.max_queued) {
+        c.queue.pop_front();
+        ++c.dropped;
+        --_pending;
+      }
+      c.queue.push_back(std::move(m));
+      ++_pending;
+
+      flush();
+      return true;
+    }
+
+    /** Send the oldest message of a channel. Returns false if the socket would block. 
+      * Once the first part is accepted, ZMQ accepts the remaining parts as well, so they
+      * never block. Failing to send them throws. */
+    bool send_front(channel &c)
+    {
+      if (!io::send_topic(*_s, c.name, ZMQ_SNDMORE | ZMQ_DONTWAIT)) {
+        return false;
+      }
+
+      std::vector<zmq::message_t> &parts = c.queue.front().parts;
+      IB_NEXT_PART(io::send(*_s, IB_EXCHANGE_PROTO_FAST_VERSION, parts.empty() ? ZMQ_DONTWAIT : (ZMQ_SNDMORE | ZMQ_DONTWAIT)));
+      for (size_t i = 0; i < parts.size(); ++i) {
+        IB_NEXT_PART(_s->send(parts[i], (i + 1 < parts.size()) ? (ZMQ_SNDMORE | ZMQ_DONTWAIT) : ZMQ_DONTWAIT));
+      }
+
+      c.queue.pop_front();
+      --_pending;
+      return true;
+    }
+
+    /** Advance the scheduler. A channel without messages keeps no deficit. */
+    void next_channel()
+    {
+      if (_channels[_current].queue.empty()) {
+        _channels[_current].deficit = 0;
+      }
+      _current = (_current + 1) % _channels.size();
+      _granted = false;
+    }
+
+    io::serialized_message _serializer;
+    io::subscription_set _subscriptions;
+    std::deque<channel> _channels;
+    size_t _quantum;
+    size_t _current;
+    bool _granted;
+    size_t _pending;
+  };
+
+  template<class T>
+  inline bool mux_channel<T>::publish(const T &t)
+  {
+    IB_ASSERT(_mux, ib_error::EPARAMRANGE);
+    return _mux->enqueue(_index, t);
+  }
+
+  template<class T>
+  inline const std::string &mux_channel<T>::get_name() const
+  {
+    IB_ASSERT(_mux, ib_error::EPARAMRANGE);
+    return _mux->_channels[_index].name;
+  }
+
+  template<class T>
+  inline size_t mux_channel<T>::get_num_pending() const
+  {
+    IB_ASSERT(_mux, ib_error::EPARAMRANGE);
+    return _mux->_channels[_index].queue.size();
+  }
+
+  template<class T>
+  inline size_t mux_channel<T>::get_num_dropped() const
+  {
+    IB_ASSERT(_mux, ib_error::EPARAMRANGE);
+    return _mux->_channels[_index].dropped;
+  }
+
+  /** Client receiving multiple channels of a mux_server over a single socket. 
+    * Received data is passed to the handler registered for its channel. Channels 
+    * published by a fast_server on topics can be received as well. */
+  class mux_client : public network_entity {
+  public:
+
+    /** Default constructor. */
+    mux_client()
+      : network_entity(make_context())
+    {}
+
+    /** Construct from existing context. */
+    explicit mux_client(const context_ptr &ctx)
+      : network_entity(ctx)
+    {}
+
+    /** Destructor. */
+    virtual ~mux_client()
+    {}
+
+    /** Connect to the given server endpoint. This method can be called multiple 
+      * times to receive from multiple servers. */
+    virtual void startup(const std::string &addr = "tcp://127.0.0.1:6000")
+    {
+      if (!_s) {
+        _s = socket_ptr(new zmq::socket_t(*_ctx, ZMQ_SUB));
+        network_entity::apply_socket_options();
+
+        for (handler_map::const_iterator i = _handlers.begin(); i != _handlers.end(); ++i) {
+          subscribe(i->first);
+        }
+      }
+
+      IB_CATCH_ZMQ_RETHROW(_s->connect(addr.c_str()));
+    }
+
+    /** Add a channel. Data received on the channel is decoded as type T and passed 
+      * to the handler. The decoded object is reused between calls.
+      * \throws ib_error if a channel with the same name exists. */
+    template<class T>
+    void add_channel(const std::string &name, const std::function<void(const T&)> &handler)
+    {
+      IB_ASSERT(_handlers.find(name) == _handlers.end(), ib_error::EPARAMRANGE);
+
+      _handlers[name] = std::shared_ptr<handler_base>(new typed_handler<T>(handler));
+      if (_s) {
+        subscribe(name);
+      }
+    }
+
+    /** Receive a single message and pass it to the handler of its channel. 
+      * \returns true if a message was received within the timeout. */
+    bool dispatch(int timeout_ms = 1000)
+    {
+      IB_ASSERT(_s, ib_error::EINVALIDSOCKET);
+
+      io::ensure_cleanup_partial_messages ecpm(_s);
+
+      if (!io::is_data_pending(*_s, timeout_ms)) {
+        return false;
+      }
+
+      zmq::message_t topic, version;
+      IB_FIRST_PART(io::recv_topic(*_s, topic, 0));
+      IB_NEXT_PART(_s->recv(&version, 0));
+      network_entity::validate_version(IB_EXCHANGE_PROTO_FAST_VERSION, version);
+
+      const std::string name(static_cast<const char*>(topic.data()), topic.size() - 1);
+      handler_map::iterator i = _handlers.find(name);
+      if (i == _handlers.end()) {
+        // Channel without handler.
+        io::discard_remainder(*_s);
+        return false;
+      }
+
+      IB_NEXT_PART(i->second->dispatch(*_s));
+      return true;
+    }
+
+  private:
+
+    /** Decodes and handles data of a channel. */
+    struct handler_base {
+      virtual ~handler_base() {}
+      virtual bool dispatch(zmq::socket_t &s) = 0;
+    };
+
+    template<class T>
+    struct typed_handler : handler_base {
+      typed_handler(const std::function<void(const T&)> &h)
+        : handler(h)
+      {}
+
+      virtual bool dispatch(zmq::socket_t &s)
+      {
+        if (!io::recv(s, value, 0)) {
+          return false;
+        }
+        handler(value);
+        return true;
+      }
+
+      std::function<void(const T&)> handler;
+      T value;
+    };
+
+    void subscribe(const std::string &name)
+    {
+      const std::string filter = io::topic_filter(name);
+      IB_CATCH_ZMQ_RETHROW(_s->setsockopt(ZMQ_SUBSCRIBE, filter.data(), filter.size()));
+    }
+
+    typedef std::map< std::string, std::shared_ptr<handler_base> > handler_map;
+    handler_map _handlers;
+  };
+
+}
+
+#endif
@@ -31,6 +31,7 @@
 
 #include "core.hpp"
 #include <unordered_map>
+#include <algorithm>
 
 #define IB_EXCHANGE_PROTO_RELIABLE_REGISTER "client_register"
 #define IB_EXCHANGE_PROTO_RELIABLE_ACK "client_ack"
@@ -45,10 +46,18 @@ namespace imagebabble {
     * 
     * When new data is to be published, the server first waits for registration of
     * the necessary number of clients. It then sends the message to all registered
-    * clients and waits for ACKS. 
+    * clients and waits for ACKS. The data is serialized only once per publish 
+    * call, regardless of the number of clients.
     * 
     * A timeout may be passed to to the publish process in which case the server 
     * might end the publishing preliminarily.
+    *
+    * By default publishing is stop-and-wait: publish returns once all clients have
+    * acknowledged the data just sent. Setting a window size W > 1 allows up to W 
+    * frames to be in flight per client. ACKs are cumulative, an ACK for frame N 
+    * acknowledges all frames up to N. Call flush to wait for all pending ACKs. 
+    * Note that in-flight frames occupy the socket queues, so the outbound high 
+    * water mark needs to hold W frames in order to avoid loss.
     */
   template<typename T>
   class reliable_server : public basic_server<T> {
@@ -56,8 +65,20 @@ namespace imagebabble {
 
     /** Default constructor. */
     reliable_server()
-      : basic_server<T>(context_ptr(new zmq::context_t(1)))
+      : basic_server<T>(make_context())
       , _next_id(0)
+      , _nclients(0)
+      , _frames_begin(0)
+      , _window(1)
+    {}
+
+    /** Construct from existing context. */
+    explicit reliable_server(const context_ptr &ctx)
+      : basic_server<T>(ctx)
+      , _next_id(0)
+      , _nclients(0)
+      , _frames_begin(0)
+      , _window(1)
     {}
 
     /** Destructor. */
@@ -84,10 +105,32 @@ namespace imagebabble {
       IB_CATCH_ZMQ_RETHROW(network_entity::_s->bind(addr.c_str()));
     }
 
+    /** Set the maximum number of frames per client that are not yet acknowledged
+      * when publish returns. Defaults to one, which corresponds to stop-and-wait.
+      *
+      * \param [in] nframes window size, must be greater than zero.
+      * \throws ib_error on error.
+      */
+    void set_window_size(size_t nframes)
+    {
+      IB_ASSERT(nframes > 0, ib_error::EPARAMRANGE);
+      _window = nframes;
+    }
+
+    /** Get the window size. */
+    size_t get_window_size() const
+    {
+      return _window;
+    }
+
     /** Shutdown server */
     virtual void shutdown()
     {
-      _clients.clear();
+      _slots.clear();
+      _free_slots.clear();
+      _index.clear();
+      _outstanding.clear();
+      _nclients = 0;
       basic_server<T>::shutdown();
     }
 
@@ -96,7 +139,8 @@ namespace imagebabble {
       * \param [in] t data to be published.
       * \param [in] min_serve minimum number of clients to service.
       * \param [in] timeout_ms maximum wait time in milliseconds.
-      * \returns true when data was published successfully
+      * \returns true when data was published successfully and all clients acknowledged
+      *          all but the latest window size - 1 frames.
       * \returns false when a send timeout occurred.
       * \throws ib_error on error.
       **/
@@ -115,26 +159,116 @@ namespace imagebabble {
        
         // No more data, see if we should wait for more
         int timeleft = tout.timeleft();
-        if ((_clients.size() < min_serve) && timeout::is_timeleft(timeleft)) {          
+        if ((_nclients < min_serve) && timeout::is_timeleft(timeleft)) {          
           new_data = io::is_data_pending(*network_entity::_s, timeleft);          
         }
 
       } while (new_data);
 
       // Drop unresponsive clients
-      disconnect_unresponsive_clients(_next_id - 10);
+      disconnect_unresponsive_clients(_next_id - 10 - static_cast<long>(_window));
 
       // Test if there are enough clients
-      if (_clients.size() < min_serve) {
+      if (_nclients < min_serve) {
         return false;
       }
 
       // Send data
-      for (client_map::iterator i = _clients.begin(); i != _clients.end(); ++i) {
-        send_client_payload(i->first, _next_id, t);          
+      _payload.assign(t);
+      size_t nsent = 0;
+      for (size_t i = 0; i < _slots.size(); ++i) {
+        client_slot &c = _slots[i];
+        if (c.active && send_client_payload(c.address, i, _next_id)) {
+          if (c.first < 0) {
+            c.first = _next_id;
+          }
+          ++nsent;
+        }
+      }
+
+      if (_outstanding.empty()) {
+        _frames_begin = _next_id;
       }
+      _outstanding.push_back(nsent);
+      prune_frames();
 
-      // Wait for ACKs
+      // Wait for ACKs of frames leaving the window
+      const long id = _next_id++;
+      return wait_for_acks(id - static_cast<long>(_window) + 1, tout);
+    }
+
+    /** Wait until all clients acknowledged all published data.
+      * 
+      * \param [in] timeout_ms maximum wait time in milliseconds.
+      * \returns true when all data was acknowledged.
+      * \returns false when a timeout occurred.
+      * \throws ib_error on error.
+      **/
+    bool flush(int timeout_ms = -1)
+    {
+      IB_ASSERT(network_entity::_s, ib_error::EINVALIDSOCKET);
+
+      timeout tout(timeout_ms);
+      return wait_for_acks(_next_id - 1, tout);
+    }
+
+  private:
+
+    /** Registered client. Clients are identified by their index into the slot array. */
+    struct client_slot {
+      std::string address;  ///< ROUTER identity
+      long acked;           ///< Highest acknowledged frame
+      long first;           ///< First frame sent to client or -1
+      bool active;          ///< Whether slot is in use
+    };
+
+    typedef std::unordered_map<std::string, size_t> client_index;
+
+    /** Receive from a single client */
+    bool recv_from_client(int flags) {
+      zmq::message_t address, version, type;
+
+      IB_FIRST_PART(network_entity::_s->recv(&address, flags));
+      IB_NEXT_PART(network_entity::_s->recv(&version, flags));
+      network_entity::validate_version(IB_EXCHANGE_PROTO_RELIABLE_VERSION, version);
+      IB_NEXT_PART(network_entity::_s->recv(&type, flags));
+
+      if (io::is_equal(type, IB_EXCHANGE_PROTO_RELIABLE_ACK)) {
+        int64_t id;
+        IB_NEXT_PART(io::recv(*network_entity::_s, id, flags));
+#ifdef IB_LEGACY_TEXT_ENCODING
+        client_index::iterator iter = _index.find(to_string(address));
+        if (iter != _index.end()) {
+          acknowledge(iter->second, static_cast<long>(id));
+        }
+#else
+        // Clients echo their slot, which saves a lookup by address.
+        uint32_t slot;
+        IB_NEXT_PART(io::recv(*network_entity::_s, slot, flags));
+        if (slot < _slots.size() && _slots[slot].active && io::is_equal(address, _slots[slot].address)) {
+          acknowledge(slot, static_cast<long>(id));
+        }
+#endif
+      } else if (io::is_equal(type, IB_EXCHANGE_PROTO_RELIABLE_REGISTER)) {
+        register_client(to_string(address));
+      } else if (io::is_equal(type, IB_EXCHANGE_PROTO_RELIABLE_DISCONNECT)) {
+        client_index::iterator iter = _index.find(to_string(address));
+        if (iter != _index.end()) {
+          release_client(iter->second);
+        }
+      }
+
+      return true;
+    }
+
+    /** Convert message content to string */
+    static std::string to_string(const zmq::message_t &msg) {
+      return std::string(static_cast<const char*>(msg.data()), msg.size());
+    }
+
+    /** Wait until all clients acknowledged given id */
+    bool wait_for_acks(long id, const timeout &tout) {
+      bool new_data = false;
       do {
         do {
           new_data = recv_from_client(ZMQ_DONTWAIT);
@@ -142,78 +276,116 @@ namespace imagebabble {
        
         // No more data, see if we should wait for more
         int timeleft = tout.timeleft();
-        if ((count_acks(_next_id) < _clients.size()) && timeout::is_timeleft(timeleft)) {
+        if (!is_acked(id) && timeout::is_timeleft(timeleft)) {
           new_data = io::is_data_pending(*network_entity::_s, timeleft);          
         }
 
       } while (new_data);
 
-      return count_acks(_next_id++) == _clients.size();
+      return is_acked(id);
     }
 
-  private:
-    typedef std::unordered_map<std::string, long> client_map;    
-
-    /** Receive from a single client */
-    bool recv_from_client(int flags) {
-      std::string address, version, type;
-      long id;
+    /** Test if all clients the given frame was sent to acknowledged it. */
+    bool is_acked(long id) const {
+      if (id < _frames_begin || id - _frames_begin >= static_cast<long>(_outstanding.size())) {
+        return true;
+      }
+      return _outstanding[id - _frames_begin] == 0;
+    }
 
-      IB_FIRST_PART(io::recv(*network_entity::_s, address, flags));
-      IB_NEXT_PART(io::recv(*network_entity::_s, version, flags));
-      network_entity::validate_version(IB_EXCHANGE_PROTO_RELIABLE_VERSION, version);
-      IB_NEXT_PART(io::recv(*network_entity::_s, type, flags));
+    /** Register client. Re-registering clients start over. */
+    void register_client(const std::string &address) {
+      client_index::iterator iter = _index.find(address);
+      if (iter != _index.end()) {
+        release_client(iter->second);
+      }
 
-      if (type == IB_EXCHANGE_PROTO_RELIABLE_REGISTER) {
-        _clients[address] = -1;
-      } else if (type == IB_EXCHANGE_PROTO_RELIABLE_DISCONNECT) {
-        _clients.erase(address);
-      } else if (type == IB_EXCHANGE_PROTO_RELIABLE_ACK) {
-        IB_NEXT_PART(io::recv(*network_entity::_s, id, flags));
-        client_map::iterator iter = _clients.find(address);
-        if (iter != _clients.end() && iter->second < id) {
-          iter->second = id;
-        }
+      size_t slot;
+      if (!_free_slots.empty()) {
+        slot = _free_slots.back();
+        _free_slots.pop_back();
+      } else {
+        slot = _slots.size();
+        _slots.push_back(client_slot());
       }
 
-      return true;
+      client_slot &c = _slots[slot];
+      c.address = address;
+      c.acked = -1;
+      c.first = -1;
+      c.active = true;
+
+      _index[address] = slot;
+      ++_nclients;
+    }
+
+    /** Remove client and drop the ACKs it owes. */
+    void release_client(size_t slot) {
+      client_slot &c = _slots[slot];
+      settle(c, _next_id - 1);
+      c.active = false;
+      _index.erase(c.address);
+      _free_slots.push_back(slot);
+      --_nclients;
+      prune_frames();
+    }
+
+    /** Process cumulative ACK of client. */
+    void acknowledge(size_t slot, long id) {
+      client_slot &c = _slots[slot];
+      if (id > c.acked) {
+        settle(c, std::min(id, _next_id - 1));
+        c.acked = id;
+        prune_frames();
+      }
     }
 
-    /** Count ACKs for given id */
-    size_t count_acks(long id) const {
-      size_t count = 0;
-      client_map::const_iterator iter;
+    /** Decrement outstanding ACK counters of frames client owes up to and including given id. */
+    void settle(const client_slot &c, long id) {
+      if (c.first < 0) {
+        return;
+      }
 
-      for (iter = _clients.begin(); iter != _clients.end(); ++iter) {
-        if (iter->second == id)
-          ++count;
+      const long end = std::min(id + 1, _frames_begin + static_cast<long>(_outstanding.size()));
+      for (long f = std::max(std::max(c.acked + 1, c.first), _frames_begin); f < end; ++f) {
+        --_outstanding[f - _frames_begin];
       }
+    }
 
-      return count;
+    /** Forget about leading frames that are completely acknowledged. */
+    void prune_frames() {
+      size_t n = 0;
+      while (n < _outstanding.size() && _outstanding[n] == 0) {
+        ++n;
+      }
+      if (n > 0) {
+        _outstanding.erase(_outstanding.begin(), _outstanding.begin() + n);
+        _frames_begin += static_cast<long>(n);
+      }
     }
 
-    /** Disconnect clients that fail to ACK */
+    /** Disconnect clients that fail to ACK frames up to and including the given threshold */
     void disconnect_unresponsive_clients(long threshold) {
-      client_map::iterator iter;
-
-      for (iter = _clients.begin(); iter != _clients.end();) {
-        if (iter->second < threshold) {
-          send_client_disconnect(iter->first);
-          iter = _clients.erase(iter);
-        } else {
-          ++iter;
+      for (size_t i = 0; i < _slots.size(); ++i) {
+        const client_slot &c = _slots[i];
+        if (c.active && c.first >= 0 && std::max(c.acked + 1, c.first) <= threshold) {
+          send_client_disconnect(c.address);
+          release_client(i);
         }
       }
     }
 
-    /** Send payload to client */
-    bool send_client_payload(const std::string &addr, long id, const T &t)
+    /** Send serialized payload to client */
+    bool send_client_payload(const std::string &addr, size_t slot, long id)
     {
       IB_FIRST_PART(io::send(*network_entity::_s, addr, ZMQ_SNDMORE));
       IB_NEXT_PART(io::send(*network_entity::_s, IB_EXCHANGE_PROTO_RELIABLE_VERSION, ZMQ_SNDMORE));
       IB_NEXT_PART(io::send(*network_entity::_s, IB_EXCHANGE_PROTO_RELIABLE_PAYLOAD, ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(*network_entity::_s, id, ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(*network_entity::_s, t, 0));
+      IB_NEXT_PART(io::send(*network_entity::_s, static_cast<int64_t>(id), ZMQ_SNDMORE));
+#ifndef IB_LEGACY_TEXT_ENCODING
+      IB_NEXT_PART(io::send(*network_entity::_s, static_cast<uint32_t>(slot), ZMQ_SNDMORE));
+#endif
+      IB_NEXT_PART(_payload.send(*network_entity::_s, 0));
 
       return true;
     }
@@ -228,8 +400,15 @@ namespace imagebabble {
       return true;
     }
 
-    client_map _clients;
+    std::vector<client_slot> _slots;
+    std::vector<size_t> _free_slots;
+    client_index _index;
+    std::vector<size_t> _outstanding; ///< Number of missing ACKs per frame starting at _frames_begin
     long _next_id;
+    size_t _nclients;
+    long _frames_begin;
+    size_t _window;
+    io::serialized_message _payload;
   };
 
   /** Reliable client implementation. */
@@ -239,7 +418,12 @@ namespace imagebabble {
 
     /** Default constructor */
     reliable_client()
-      : basic_client<T>(context_ptr(new zmq::context_t(1)))
+      : basic_client<T>(make_context())
+    {}
+
+    /** Construct from existing context. */
+    explicit reliable_client(const context_ptr &ctx)
+      : basic_client<T>(ctx)
     {}
 
     virtual ~reliable_client()
@@ -289,25 +473,29 @@ namespace imagebabble {
       io::ensure_cleanup_partial_messages ecpm(this->get_socket());      
 
       // Try receiving data
-      std::string version, type;
+      zmq::message_t version, type;
 
-      if (!io::recv(*network_entity::_s, version, ZMQ_DONTWAIT)) {
+      if (!network_entity::_s->recv(&version, ZMQ_DONTWAIT)) {
         if (timeout_ms == 0 || !io::is_data_pending(*network_entity::_s, timeout_ms)) {
           return false;
         }
-        IB_FIRST_PART(io::recv(*network_entity::_s, version, ZMQ_DONTWAIT));
+        IB_FIRST_PART(network_entity::_s->recv(&version, ZMQ_DONTWAIT));
       } 
 
       network_entity::validate_version(IB_EXCHANGE_PROTO_RELIABLE_VERSION, version);
-      IB_NEXT_PART(io::recv(*network_entity::_s, type, ZMQ_DONTWAIT));
-
-      if (type == IB_EXCHANGE_PROTO_RELIABLE_PAYLOAD) {
-        std::string id;
-        IB_NEXT_PART(io::recv(*network_entity::_s, id, ZMQ_DONTWAIT));        
-        send_ack(id, 0);
+      IB_NEXT_PART(network_entity::_s->recv(&type, ZMQ_DONTWAIT));
+
+      if (io::is_equal(type, IB_EXCHANGE_PROTO_RELIABLE_PAYLOAD)) {
+        // Id and slot are echoed as received.
+        zmq::message_t id, slot;
+        IB_NEXT_PART(network_entity::_s->recv(&id, ZMQ_DONTWAIT));        
+#ifndef IB_LEGACY_TEXT_ENCODING
+        IB_NEXT_PART(network_entity::_s->recv(&slot, ZMQ_DONTWAIT));        
+#endif
+        send_ack(id, slot, 0);
         IB_NEXT_PART(io::recv(*network_entity::_s, t, ZMQ_DONTWAIT));        
         return true;
-      } else if (type == IB_EXCHANGE_PROTO_RELIABLE_DISCONNECT) {
+      } else if (io::is_equal(type, IB_EXCHANGE_PROTO_RELIABLE_DISCONNECT)) {
         startup(_addr);
         return false;
       } else {
@@ -333,10 +521,15 @@ namespace imagebabble {
     }
 
     // Send ACK to server
-    bool send_ack(const std::string &id, int flags) {
+    bool send_ack(zmq::message_t &id, zmq::message_t &slot, int flags) {
       IB_FIRST_PART(io::send(*network_entity::_s, IB_EXCHANGE_PROTO_RELIABLE_VERSION, ZMQ_SNDMORE));      
       IB_NEXT_PART(io::send(*network_entity::_s, IB_EXCHANGE_PROTO_RELIABLE_ACK, flags | ZMQ_SNDMORE));
-      IB_NEXT_PART(io::send(*network_entity::_s, id, flags));
+#ifdef IB_LEGACY_TEXT_ENCODING
+      IB_NEXT_PART(network_entity::_s->send(id, flags));
+#else
+      IB_NEXT_PART(network_entity::_s->send(id, flags | ZMQ_SNDMORE));
+      IB_NEXT_PART(network_entity::_s->send(slot, flags));
+#endif
       return true;
     }
 
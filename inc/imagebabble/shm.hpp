@@ -0,0 +1,618 @@
+/*! \file shm.hpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#ifndef __IMAGE_BABBLE_SHM_HPP_INCLUDED__
+#define __IMAGE_BABBLE_SHM_HPP_INCLUDED__
+
+#include "core.hpp"
+#include "image_support.hpp"
+#include <atomic>
+#include <vector>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+/** Whether the platform provides POSIX shared memory. */
+#define IB_HAS_SHM
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace imagebabble {
+
+  class shm_ring;
+
+  /** Shared pointer to shared memory ring. */
+  typedef std::shared_ptr<shm_ring> shm_ring_ptr;
+
+  /** Ring of image slots in a named shared memory segment. A fast server started on a 
+    * <code>shm://name</code> address creates a ring and places each published image into 
+    * a slot. Clients on the same host map the segment and receive images pointing directly 
+    * into the slot. Per frame only the image header and the slot location are sent through 
+    * ZMQ, using an ipc endpoint derived from the segment name.
+    *
+    * The segment starts with a header, followed by one control block per slot and the
+    * page aligned slot data. Each control block holds an atomic state word made of
+    *  - bits 32-63 generation, incremented whenever the server reuses the slot
+    *  - bit 31 published flag
+    *  - bits 0-30 number of images referencing the slot
+    *
+    * The server reuses only slots that are not referenced and cycles through the slots in
+    * order, so that a published slot remains readable as long as possible. A client references
+    * a slot only if it is still published with the generation announced, otherwise the frame 
+    * is considered lost. References are dropped by the free function of the image buffer. 
+    * Clients map slot data read-only.
+    *
+    * \note A client process terminating while holding images leaks the slot references.
+    *       These slots are not reused until the server is restarted.
+    */
+  class shm_ring {
+  public:
+
+    enum {
+      /** Magic number at the start of the segment. */
+      magic = 0x48534249,
+      /** Default number of slots. */
+      default_slots = 8,
+      /** Default capacity of a slot in bytes. */
+      default_capacity = 16 * 1024 * 1024
+    };
+
+    /** Create a new ring. An existing segment of the same name is replaced. 
+      * 
+      * \param[in] name segment name without scheme.
+      * \param[in] nslots number of slots.
+      * \param[in] capacity maximum image size in bytes.
+      * \throws ib_error on error.
+      */
+    static inline shm_ring_ptr create(const std::string &name, size_t nslots = default_slots, size_t capacity = default_capacity)
+    {
+      IB_ASSERT(nslots > 0 && capacity > 0, ib_error::EPARAMRANGE);
+      shm_ring_ptr r(new shm_ring(name), &shm_ring::unref);
+      r->create_segment(nslots, capacity);
+      return r;
+    }
+
+    /** Map an existing ring created by another entity. 
+      *
+      * \throws ib_error if the segment does not exist or is invalid.
+      */
+    static inline shm_ring_ptr open(const std::string &name)
+    {
+      shm_ring_ptr r(new shm_ring(name), &shm_ring::unref);
+      r->open_segment();
+      return r;
+    }
+
+    /** Extract segment name from an address of the form <code>shm://name</code>. 
+      * Returns false if the address does not use the shm scheme. */
+    static inline bool parse_address(const std::string &addr, std::string &name)
+    {
+      static const char scheme[] = "shm://";
+      const size_t n = sizeof(scheme) - 1;
+      if (addr.size() <= n || addr.compare(0, n, scheme) != 0) {
+        return false;
+      }
+      name = addr.substr(n);
+      return true;
+    }
+
+    /** Get the ZMQ endpoint descriptors of the named ring are published on. */
+    static inline std::string endpoint(const std::string &name)
+    {
+      return "ipc:///tmp/imagebabble-" + name + ".ipc";
+    }
+
+    /** Get number of slots. */
+    inline size_t get_num_slots() const
+    {
+      return _nslots;
+    }
+
+    /** Get capacity of a slot in bytes. */
+    inline size_t get_slot_capacity() const
+    {
+      return _capacity;
+    }
+
+    /** Get identifier of the segment instance. Changes when the server is restarted. */
+    inline uint64_t get_session() const
+    {
+      return _session;
+    }
+
+    /** Get data of slot. */
+    inline void *get_slot_data(size_t slot) const
+    {
+      return _data + slot * _capacity;
+    }
+
+    /** Get hint to pass to shm_ring::release for dropping a reference to the given slot. */
+    inline void *get_hint(size_t slot)
+    {
+      return &_hints[slot];
+    }
+
+    /** Claim an unreferenced slot for writing. The caller holds a reference to the 
+      * slot and a new generation is assigned. Returns false when all slots are referenced. */
+    inline bool claim(size_t &slot, uint32_t &generation)
+    {
+      IB_ASSERT(_owner, ib_error::EPARAMRANGE);
+
+      for (size_t i = 0; i < _nslots; ++i) {
+        const size_t k = (_next + i) % _nslots;
+        std::atomic<uint64_t> &state = _ctl[k].state;
+        uint64_t s = state.load(std::memory_order_acquire);
+        if ((s & count_mask) != 0) {
+          continue;
+        }
+
+        const uint32_t g = static_cast<uint32_t>(s >> 32) + 1;
+        if (state.compare_exchange_strong(s, (static_cast<uint64_t>(g) << 32) | 1, std::memory_order_acq_rel)) {
+          ++_refs;
+          _next = k + 1;
+          slot = k;
+          generation = g;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /** Make the current generation of a claimed slot available to clients. */
+    inline void publish(size_t slot)
+    {
+      _ctl[slot].state.fetch_or(published_bit, std::memory_order_release);
+    }
+
+    /** Find the slot starting at the given address. */
+    inline bool locate(const void *p, size_t &slot, uint32_t &generation) const
+    {
+      const char *c = static_cast<const char*>(p);
+      if (!_data || c < _data || c >= _data + _nslots * _capacity) {
+        return false;
+      }
+
+      const size_t k = static_cast<size_t>(c - _data) / _capacity;
+      if (c != get_slot_data(k)) {
+        return false;
+      }
+
+      slot = k;
+      generation = static_cast<uint32_t>(_ctl[k].state.load(std::memory_order_acquire) >> 32);
+      return true;
+    }
+
+    /** Reference a slot if it is published with the given generation. */
+    inline bool acquire(size_t slot, uint32_t generation)
+    {
+      std::atomic<uint64_t> &state = _ctl[slot].state;
+      uint64_t s = state.load(std::memory_order_acquire);
+      while (static_cast<uint32_t>(s >> 32) == generation && (s & published_bit)) {
+        if (state.compare_exchange_weak(s, s + 1, std::memory_order_acq_rel)) {
+          ++_refs;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /** Drop a slot reference. Signature matches zmq::free_fn, the hint is obtained 
+      * from shm_ring::get_hint. */
+    static inline void release(void * /*data*/, void *hint)
+    {
+      slot_hint *h = static_cast<slot_hint*>(hint);
+      h->ring->_ctl[h->slot].state.fetch_sub(1, std::memory_order_release);
+      unref(h->ring);
+    }
+
+    /** Allocate an image in a free slot. Writing image data directly into the slot avoids
+      * copying it when the image is published through this ring. The image must not be 
+      * modified once published. Returns false when all slots are referenced.
+      *
+      * \throws ib_error if the image exceeds the slot capacity.
+      */
+    inline bool allocate_image(int w, int h, int step, image &img)
+    {
+      return allocate_image(w, h, step, image::FORMAT_UNKNOWN, img);
+    }
+
+    /** Allocate an image of the given format in a free slot. Planar formats occupy more 
+      * than h*step bytes. \see allocate_image(int, int, int, image&) */
+    inline bool allocate_image(int w, int h, int step, image::eformat f, image &img)
+    {
+      IB_ASSERT(image::get_buffer_size(f, h, step) <= _capacity, ib_error::EBUFFERTOOSMALL);
+
+      size_t slot;
+      uint32_t generation;
+      if (!claim(slot, generation)) {
+        return false;
+      }
+
+      img = image(w, h, step, f, get_slot_data(slot), share_mem(&shm_ring::release, get_hint(slot)));
+      return true;
+    }
+
+  private:
+
+    static const uint64_t published_bit = 0x80000000ULL;
+    static const uint64_t count_mask = 0x7fffffffULL;
+
+    /** Segment header. */
+    struct segment_header {
+      uint32_t magic;
+      uint32_t nslots;
+      uint64_t capacity;
+      uint64_t data_offset;
+      uint64_t length;
+      uint64_t session;
+    };
+
+    /** Per slot control block occupying a cache line. */
+    struct slot_control {
+      std::atomic<uint64_t> state;
+      char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    /** Hint identifying a slot in release. */
+    struct slot_hint {
+      shm_ring *ring;
+      size_t slot;
+    };
+
+    /** Construct unmapped ring. */
+    inline explicit shm_ring(const std::string &name)
+      : _name(name), _nslots(0), _capacity(0), _length(0), _session(0),
+        _base(0), _data(0), _ctl(0), _owner(false), _next(0), _refs(1)
+    {}
+
+    /** Unmap segment and remove it if owned. */
+    inline ~shm_ring()
+    {
+#ifdef IB_HAS_SHM
+      if (_base) {
+        munmap(_base, _length);
+      }
+      if (_owner) {
+        shm_unlink(segment_name().c_str());
+      }
+#endif
+    }
+
+    /** Drop a reference to the ring. The ring is deleted once its owning pointer 
+      * and all images referencing slots are gone. */
+    static inline void unref(shm_ring *r)
+    {
+      if (--r->_refs == 0) {
+        delete r;
+      }
+    }
+
+    /** Name of the POSIX shared memory object. */
+    inline std::string segment_name() const
+    {
+      return "/imagebabble-" + _name;
+    }
+
+    /** Create and map a new segment. */
+    inline void create_segment(size_t nslots, size_t capacity)
+    {
+#ifdef IB_HAS_SHM
+      const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      const size_t data_offset = round_up(sizeof(segment_header) + nslots * sizeof(slot_control), page);
+      
+      _nslots = nslots;
+      _capacity = round_up(capacity, page);
+      _length = data_offset + _nslots * _capacity;
+
+      const std::string n = segment_name();
+      shm_unlink(n.c_str());
+      int fd = shm_open(n.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      IB_ASSERT(fd >= 0, ib_error::ESHMERROR);
+      _owner = true;
+
+      void *p = MAP_FAILED;
+      if (ftruncate(fd, static_cast<off_t>(_length)) == 0) {
+        p = mmap(0, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      close(fd);
+      IB_ASSERT(p != MAP_FAILED, ib_error::ESHMERROR);
+
+      _base = static_cast<char*>(p);
+      _data = _base + data_offset;
+      _ctl = reinterpret_cast<slot_control*>(_base + sizeof(segment_header));
+      for (size_t i = 0; i < _nslots; ++i) {
+        new (&_ctl[i].state) std::atomic<uint64_t>(0);
+      }
+      IB_ASSERT(_ctl[0].state.is_lock_free(), ib_error::ESHMERROR);
+      init_hints();
+
+      _session = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^ 
+                 (static_cast<uint64_t>(getpid()) << 40);
+
+      segment_header *h = reinterpret_cast<segment_header*>(_base);
+      h->nslots = static_cast<uint32_t>(_nslots);
+      h->capacity = _capacity;
+      h->data_offset = data_offset;
+      h->length = _length;
+      h->session = _session;
+      std::atomic_thread_fence(std::memory_order_release);
+      h->magic = magic;
+#else
+      throw ib_error(ib_error::ESHMERROR);
+#endif
+    }
+
+    /** Map an existing segment. */
+    inline void open_segment()
+    {
+#ifdef IB_HAS_SHM
+      int fd = shm_open(segment_name().c_str(), O_RDWR, 0);
+      IB_ASSERT(fd >= 0, ib_error::ESHMERROR);
+
+      struct stat st;
+      void *p = MAP_FAILED;
+      if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(segment_header)) {
+        _length = static_cast<size_t>(st.st_size);
+        p = mmap(0, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      close(fd);
+      IB_ASSERT(p != MAP_FAILED, ib_error::ESHMERROR);
+      _base = static_cast<char*>(p);
+
+      const segment_header *h = reinterpret_cast<const segment_header*>(_base);
+      IB_ASSERT(h->magic == magic && h->length == _length && 
+                h->data_offset + h->nslots * h->capacity == _length, 
+                ib_error::ESHMERROR);
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      _nslots = h->nslots;
+      _capacity = static_cast<size_t>(h->capacity);
+      _session = h->session;
+      _data = _base + h->data_offset;
+      _ctl = reinterpret_cast<slot_control*>(_base + sizeof(segment_header));
+      init_hints();
+
+      IB_ASSERT(mprotect(_data, _length - h->data_offset, PROT_READ) == 0, ib_error::ESHMERROR);
+#else
+      throw ib_error(ib_error::ESHMERROR);
+#endif
+    }
+
+    /** Prepare release hints for all slots. */
+    inline void init_hints()
+    {
+      _hints.resize(_nslots);
+      for (size_t i = 0; i < _nslots; ++i) {
+        _hints[i].ring = this;
+        _hints[i].slot = i;
+      }
+    }
+
+    /** Round up to multiple of given alignment. */
+    static inline size_t round_up(size_t n, size_t a)
+    {
+      return ((n + a - 1) / a) * a;
+    }
+
+    std::string _name;
+    size_t _nslots, _capacity, _length;
+    uint64_t _session;
+    char *_base, *_data;
+    slot_control *_ctl;
+    bool _owner;
+    size_t _next;
+    std::vector<slot_hint> _hints;
+    std::atomic<long> _refs;
+
+    /** Disabled copy constructor */
+    shm_ring (const shm_ring &);
+    /** Disabled assignment operator */
+    shm_ring &operator = (const shm_ring &);
+  };
+
+  /** Client side view of the ring of a server. The segment is mapped when the first 
+    * descriptor arrives and mapped again when the server was restarted. */
+  class shm_view {
+  public:
+
+    /** Construct view of named ring. */
+    inline explicit shm_view(const std::string &name)
+      : _name(name)
+    {}
+
+    /** Get ring of the given session. Returns null if no such ring is available. */
+    inline shm_ring *get(uint64_t session)
+    {
+      if (!_ring || _ring->get_session() != session) {
+        try {
+          _ring = shm_ring::open(_name);
+        } catch (const ib_error &) {
+          _ring.reset();
+        }
+      }
+      return (_ring && _ring->get_session() == session) ? _ring.get() : 0;
+    }
+
+  private:
+    std::string _name;
+    shm_ring_ptr _ring;
+  };
+
+  /** Shared pointer to shared memory view. */
+  typedef std::shared_ptr<shm_view> shm_view_ptr;
+
+  namespace io {
+
+    /** A message referencing data placed in a shared memory ring. Assigning an image claims 
+      * a slot and copies the image data unless the image was allocated from the ring by 
+      * shm_ring::allocate_image. Sending transmits the io::image_header followed by a locator 
+      * part. The locator has the following little-endian layout
+      *  - bytes 0-3 slot index
+      *  - bytes 4-7 slot generation
+      *  - bytes 8-15 payload size
+      *  - bytes 16-23 session of the ring
+      *
+      * Both parts fit into ZMQ very small messages, so the cost per message does not depend
+      * on the image size once the data is in the ring.
+      */
+    class shm_message {
+    public:
+
+      enum {
+        /** Size of locator part in bytes. */
+        locator_size = 24
+      };
+
+      /** Construct empty message for given ring. */
+      inline explicit shm_message(shm_ring &ring)
+        : _ring(ring), _slot(0), _generation(0), _size(0), _owned(false)
+      {}
+
+      /** Destructor. Drops the slot reference held for copied data. */
+      inline ~shm_message()
+      {
+        reset();
+      }
+
+      /** Only images can be placed in shared memory. 
+        * \throws ib_error always. */
+      template<class T>
+      inline bool assign(const T &)
+      {
+        throw ib_error(ib_error::EPARAMRANGE);
+      }
+
+      /** Place image in ring. Returns false when all slots are referenced. 
+        * \throws ib_error if the image exceeds the slot capacity. */
+      inline bool assign(const image &v)
+      {
+        reset();
+
+        const char *data = v.ptr<char>();
+        _size = v.size();
+        IB_ASSERT(_size <= _ring.get_slot_capacity(), ib_error::EBUFFERTOOSMALL);
+
+        if (!_ring.locate(data, _slot, _generation)) {
+          if (!_ring.claim(_slot, _generation)) {
+            return false;
+          }
+          _owned = true;
+          memcpy(_ring.get_slot_data(_slot), data, _size);
+        }
+
+        _ring.publish(_slot);
+        _header.assign_from(v);
+        return true;
+      }
+
+      /** Send header and locator. */
+      inline bool send(zmq::socket_t &s, int flags)
+      {
+        zmq::message_t header(image_header::wire_size), locator(locator_size);
+        _header.store(header.data());
+
+        char *p = static_cast<char*>(locator.data());
+        io::store_le<uint32_t>(p + 0, static_cast<uint32_t>(_slot));
+        io::store_le<uint32_t>(p + 4, _generation);
+        io::store_le<uint64_t>(p + 8, _size);
+        io::store_le<uint64_t>(p + 16, _ring.get_session());
+
+        IB_FIRST_PART(s.send(header, flags | ZMQ_SNDMORE));
+        IB_NEXT_PART(s.send(locator, flags));
+        return true;
+      }
+
+    private:
+
+      /** Drop slot reference held for copied data. */
+      inline void reset()
+      {
+        if (_owned) {
+          shm_ring::release(0, _ring.get_hint(_slot));
+          _owned = false;
+        }
+      }
+
+      shm_ring &_ring;
+      size_t _slot;
+      uint32_t _generation;
+      uint64_t _size;
+      bool _owned;
+      image_header _header;
+    };
+
+    /** Only images can be received through shared memory.
+      * \throws ib_error always. */
+    template<class S, class T>
+    inline bool recv_shm(S &, shm_view &, T &, int)
+    {
+      throw ib_error(ib_error::EPARAMRANGE);
+    }
+
+    /** Receive image sent as io::shm_message. The image references the slot in shared 
+      * memory. Returns false when the slot was reused by the server in the meantime 
+      * or the ring is not available. */
+    template<class S>
+    inline bool recv_shm(S &s, shm_view &view, image &v, int flags)
+    {
+      zmq::message_t header, locator;
+      IB_FIRST_PART(s.recv(&header, flags));
+      IB_NEXT_PART(s.recv(&locator, flags));
+
+      image_header h;
+      IB_ASSERT(h.load(header.data(), header.size()), ib_error::ECONVERSION);
+      IB_ASSERT(locator.size() == shm_message::locator_size, ib_error::ECONVERSION);
+
+      const char *p = static_cast<const char*>(locator.data());
+      const size_t slot = io::load_le<uint32_t>(p + 0);
+      const uint32_t generation = io::load_le<uint32_t>(p + 4);
+      const uint64_t size = io::load_le<uint64_t>(p + 8);
+      const uint64_t session = io::load_le<uint64_t>(p + 16);
+
+      shm_ring *ring = view.get(session);
+      if (!ring) {
+        return false;
+      }
+
+      IB_ASSERT(slot < ring->get_num_slots() && size <= ring->get_slot_capacity(), ib_error::ECONVERSION);
+      if (!ring->acquire(slot, generation)) {
+        return false;
+      }
+
+      zmq::message_t m(ring->get_slot_data(slot), static_cast<size_t>(size), &shm_ring::release, ring->get_hint(slot));
+      v._msg.move(&m);
+      v._shared_mem = false;
+      h.assign_to(v);
+      return true;
+    }
+  }
+}
+
+#endif
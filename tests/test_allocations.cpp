@@ -0,0 +1,291 @@
+/*! \file test_allocations.cpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#define BOOST_TEST_MODULE ImageBabbleAllocationTests
+#include <boost/test/unit_test.hpp>
+
+#include <imagebabble/imagebabble.hpp>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <atomic>
+
+/* This test module replaces global operator new and delete to count heap allocations
+   performed by ImageBabble while sending and receiving in steady state. Counting is
+   enabled per thread, so background threads of ZMQ do not interfere. 
+   
+   Allocations ZMQ makes with malloc are not counted. Among them are the buffers of 
+   received messages too large to be stored inline, so images are only received into 
+   buffer pools here. Receiving images without a pool allocates a buffer per frame. */
+
+namespace {
+  thread_local bool counting = false;
+  thread_local size_t allocations = 0;
+
+  inline void *counted_malloc(std::size_t n)
+  {
+    if (counting) {
+      ++allocations;
+    }
+    return std::malloc(n ? n : 1);
+  }
+}
+
+void *operator new(std::size_t n)
+{
+  void *p = counted_malloc(n);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](std::size_t n)
+{
+  return operator new(n);
+}
+
+void *operator new(std::size_t n, const std::nothrow_t &) throw()
+{
+  return counted_malloc(n);
+}
+
+void *operator new[](std::size_t n, const std::nothrow_t &) throw()
+{
+  return counted_malloc(n);
+}
+
+void operator delete(void *p) throw()
+{
+  std::free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+  std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) throw()
+{
+  std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) throw()
+{
+  std::free(p);
+}
+
+BOOST_AUTO_TEST_SUITE(test_allocations)
+
+namespace ib = imagebabble;
+
+/** Counts allocations of the calling thread during its lifetime. */
+class allocation_scope {
+public:
+  allocation_scope()
+  {
+    allocations = 0;
+    counting = true;
+  }
+
+  ~allocation_scope()
+  {
+    counting = false;
+  }
+
+  size_t count() const
+  {
+    return allocations;
+  }
+};
+
+const int warmup_frames = 20;
+const int counted_frames = 100;
+
+/** Publish and receive on the fast protocol in a single thread. Returns the number 
+  * of allocations after warm-up. */
+template<class T>
+size_t fast_allocations(const T &v, T &r, const std::string &addr)
+{
+  ib::fast_server<T> s;
+  s.startup(addr);
+  ib::fast_client<T> c;
+  c.startup(addr);
+
+  // Wait for subscription to be established.
+  while (!c.receive(r, 10)) {
+    s.publish(v);
+  }
+
+  for (int i = 0; i < warmup_frames; ++i) {
+    s.publish(v);
+    c.receive(r, 1000);
+  }
+
+  size_t n = 0;
+  bool ok = true;
+  {
+    allocation_scope scope;
+    for (int i = 0; i < counted_frames; ++i) {
+      s.publish(v);
+      ok = c.receive(r, 1000) && ok;
+    }
+    n = scope.count();
+  }
+
+  BOOST_REQUIRE(ok);
+  return n;
+}
+
+/** Receive a fixed number of frames on the reliable protocol into data created by make_r. */
+template<class T>
+void reliable_client_fnc(const std::string &addr, T (*make_r)(), int frames, size_t &n, const std::atomic<bool> &done)
+{
+  ib::reliable_client<T> c;
+  c.startup(addr);
+
+  T r = make_r();
+  for (int i = 0; i < warmup_frames; ++i) {
+    c.receive(r, 5000);
+  }
+
+  {
+    allocation_scope scope;
+    for (int i = warmup_frames; i < frames; ++i) {
+      c.receive(r, 5000);
+    }
+    n = scope.count();
+  }
+
+  // Disconnecting is not part of the steady state.
+  while (!done) {
+    std::this_thread::yield();
+  }
+  c.shutdown();
+}
+
+/** Publish on the reliable protocol. Clients receive into data created by make_r. 
+  * Returns the number of allocations after warm-up of server and client. */
+template<class T>
+size_t reliable_allocations(const T &v, T (*make_r)(), const std::string &addr)
+{
+  const int frames = warmup_frames + counted_frames;
+
+  ib::reliable_server<T> s;
+  s.startup(addr);
+
+  size_t nclient = 0;
+  std::atomic<bool> done(false);
+  std::thread t(reliable_client_fnc<T>, addr, make_r, frames, std::ref(nclient), std::cref(done));
+
+  for (int i = 0; i < warmup_frames; ++i) {
+    s.publish(v, 5000, 1);
+  }
+
+  size_t nserver = 0;
+  bool ok = true;
+  {
+    allocation_scope scope;
+    for (int i = warmup_frames; i < frames; ++i) {
+      ok = s.publish(v, 5000, 1) && ok;
+    }
+    nserver = scope.count();
+  }
+
+  done = true;
+  t.join();
+  s.shutdown();
+
+  BOOST_REQUIRE(ok);
+  return nserver + nclient;
+}
+
+int make_int()
+{
+  return 0;
+}
+
+ib::image make_image()
+{
+  ib::image img(640, 480, 640);
+  img.set_format(ib::image::FORMAT_GRAY_8);
+  return img;
+}
+
+ib::image_group make_group(bool packed)
+{
+  ib::image_group g("rig");
+  g.set_packed(packed);
+  g.add_image(make_image(), "left");
+  g.add_image(make_image(), "right");
+  return g;
+}
+
+/** Empty image receiving into a buffer pool. */
+ib::image make_pooled_image()
+{
+  ib::image img;
+  img.set_buffer_pool(ib::buffer_pool_ptr(new ib::buffer_pool()));
+  return img;
+}
+
+/** Group of empty images receiving into a buffer pool. */
+ib::image_group make_pooled_group()
+{
+  ib::image_group g;
+  g.add_image(make_pooled_image());
+  g.add_image(make_pooled_image());
+  return g;
+}
+
+BOOST_AUTO_TEST_CASE(fast_steady_state)
+{
+  int ri = 0;
+  BOOST_REQUIRE_EQUAL(0, fast_allocations(42, ri, "tcp://127.0.0.1:6400"));
+
+  double rd = 0;
+  BOOST_REQUIRE_EQUAL(0, fast_allocations(3.5, rd, "tcp://127.0.0.1:6401"));
+
+  ib::image pooled = make_pooled_image();
+  BOOST_REQUIRE_EQUAL(0, fast_allocations(make_image(), pooled, "tcp://127.0.0.1:6403"));
+
+  ib::image_group g = make_pooled_group();
+  BOOST_REQUIRE_EQUAL(0, fast_allocations(make_group(false), g, "tcp://127.0.0.1:6404"));
+
+  ib::image_group gp = make_pooled_group();
+  BOOST_REQUIRE_EQUAL(0, fast_allocations(make_group(true), gp, "tcp://127.0.0.1:6405"));
+}
+
+BOOST_AUTO_TEST_CASE(reliable_steady_state)
+{
+  BOOST_REQUIRE_EQUAL(0, reliable_allocations(42, make_int, "tcp://127.0.0.1:6410"));
+  BOOST_REQUIRE_EQUAL(0, reliable_allocations(make_image(), make_pooled_image, "tcp://127.0.0.1:6411"));
+  BOOST_REQUIRE_EQUAL(0, reliable_allocations(make_group(true), make_pooled_group, "tcp://127.0.0.1:6412"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,168 @@
+/*! \file test_async.cpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#include <boost/test/unit_test.hpp>
+
+#include <imagebabble/imagebabble.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_async)
+
+namespace ib = imagebabble;
+
+void client_fnc(int &count)
+{
+  ib::reliable_client<int> c;
+  c.startup();
+
+  int j = -1;
+
+  count = 0;
+  while (c.receive(j, 2000) && j >= 0) {
+    count += j;    
+  }
+
+  c.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(publish_async)
+{
+  int sum_received = 0;
+
+  boost::thread_group g;
+  g.create_thread(boost::bind(client_fnc, boost::ref(sum_received)));
+
+  ib::async_server< ib::reliable_server<int> > s(4, ib::async_server< ib::reliable_server<int> >::POLICY_BLOCK);
+  s.get_server().set_window_size(4);
+  s.startup();
+
+  std::vector< std::future<bool> > results;
+  for (int i = 0; i < 100; ++i) {
+    results.push_back(s.publish_async(1));
+  }
+  results.push_back(s.publish_async(-1, 1000));
+
+  int sum_sent = 0;
+  for (int i = 0; i < 100; ++i) {
+    if (results[i].get()) {
+      sum_sent += 1;
+    }
+  }
+  results.back().get();
+  
+  g.join_all();
+  s.shutdown();
+
+  BOOST_REQUIRE_EQUAL(100, sum_sent);
+  BOOST_REQUIRE_EQUAL(sum_sent, sum_received);
+}
+
+BOOST_AUTO_TEST_CASE(drop_policies)
+{
+  typedef ib::async_server< ib::reliable_server<int> > server_type;
+
+  // Without clients, each publish operation blocks the I/O thread until it times out.
+  server_type newest(1, server_type::POLICY_DROP_NEWEST);
+  newest.startup();
+  
+  std::future<bool> a = newest.publish_async(1, 500);
+  while (newest.get_pending() > 0) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  }
+  std::future<bool> b = newest.publish_async(2, 0);
+  std::future<bool> c = newest.publish_async(3, 0);
+
+  BOOST_REQUIRE(c.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+  BOOST_REQUIRE(!c.get());
+  BOOST_REQUIRE(!a.get());
+  BOOST_REQUIRE(!b.get());
+  newest.shutdown();
+
+  server_type oldest(1, server_type::POLICY_DROP_OLDEST);
+  oldest.startup("tcp://127.0.0.1:6001");
+  
+  a = oldest.publish_async(1, 500);
+  while (oldest.get_pending() > 0) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  }
+  b = oldest.publish_async(2, 0);
+  c = oldest.publish_async(3, 0);
+
+  BOOST_REQUIRE(b.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+  BOOST_REQUIRE(!b.get());
+  BOOST_REQUIRE_EQUAL(1, oldest.get_pending());
+
+  // Pending data completes with false on shutdown.
+  oldest.shutdown();
+  BOOST_REQUIRE(!c.get());
+
+  BOOST_REQUIRE_THROW(oldest.publish_async(4), ib::ib_error);
+}
+
+BOOST_AUTO_TEST_CASE(receive_newest)
+{
+  ib::fast_server<int> s;
+  s.startup();
+
+  ib::async_client< ib::fast_client<int> > c;
+  c.startup();
+
+  int j = -1;
+  BOOST_REQUIRE(!c.receive(j));
+
+  // Wait for subscription to be established.
+  while (!c.receive(j, 10)) {
+    s.publish(0);
+  }
+
+  for (int i = 1; i <= 1000; ++i) {
+    s.publish(i);
+  }
+
+  // Intermediate data may be skipped, but data never goes backwards.
+  int last = 0, retries = 0;
+  while (last < 1000 && retries < 100) {
+    if (c.receive(j, 20)) {
+      BOOST_REQUIRE(j > last);
+      last = j;
+    } else {
+      // Data may have been dropped by the server, resend final value.
+      s.publish(1000);
+      ++retries;
+    }
+  }
+  BOOST_REQUIRE_EQUAL(1000, last);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  c.receive(j);
+  BOOST_REQUIRE(!c.receive(j, 50));
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
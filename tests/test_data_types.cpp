@@ -31,6 +31,26 @@
 #include <imagebabble/imagebabble.hpp>
 #include <boost/thread.hpp>
 
+struct sample {
+  int id;
+  float x, y;
+
+  bool operator==(const sample &rhs) const {
+    return id == rhs.id && x == rhs.x && y == rhs.y;
+  }
+};
+
+struct celsius {
+  int degrees;
+};
+
+std::ostream &operator<<(std::ostream &os, const celsius &c) { return os << c.degrees; }
+std::istream &operator>>(std::istream &is, celsius &c) { return is >> c.degrees; }
+
+namespace imagebabble { namespace io {
+  template<> struct is_binary_encoded<celsius> : std::false_type {};
+}}
+
 BOOST_AUTO_TEST_SUITE(test_datatypes)
 
 namespace ib = imagebabble;
@@ -117,6 +137,153 @@ void client_incompatible_fnc()
 }
 
 
+BOOST_AUTO_TEST_CASE(binary_encoding)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://binary_encoding");
+  out.connect("inproc://binary_encoding");
+
+  zmq::message_t msg;
+
+  // Arithmetic types are sent in little-endian byte order.
+  ib::io::send(out, int32_t(0x01020304), 0);
+  in.recv(&msg);
+  BOOST_REQUIRE_EQUAL(4, msg.size());
+  BOOST_REQUIRE_EQUAL(0x04, static_cast<unsigned char*>(msg.data())[0]);
+  BOOST_REQUIRE_EQUAL(0x01, static_cast<unsigned char*>(msg.data())[3]);
+
+  ib::io::send(out, double(1.3), 0);
+  double d;
+  BOOST_REQUIRE(ib::io::recv(in, d, 0));
+  BOOST_REQUIRE_EQUAL(1.3, d);
+
+  sample a = {7, 1.5f, -2.25f}, b;
+  ib::io::send(out, a, 0);
+  BOOST_REQUIRE(ib::io::recv(in, b, 0));
+  BOOST_REQUIRE(a == b);
+
+  // Size mismatch is a conversion error.
+  ib::io::send(out, int16_t(1), 0);
+  int32_t i;
+  BOOST_REQUIRE_THROW(ib::io::recv(in, i, 0), ib::ib_error);
+
+  // String literals are sent without terminator.
+  ib::io::send(out, "abc", 0);
+  in.recv(&msg);
+  BOOST_REQUIRE_EQUAL(3, msg.size());
+
+  // Opted out types use text.
+  celsius c = {-5};
+  ib::io::send(out, c, 0);
+  in.recv(&msg);
+  BOOST_REQUIRE_EQUAL(std::string("-5"), std::string(static_cast<char*>(msg.data()), msg.size()));
+}
+
+BOOST_AUTO_TEST_CASE(vector_block_encoding)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://vector_block_encoding");
+  out.connect("inproc://vector_block_encoding");
+
+  int more;
+  size_t more_size = sizeof(more);
+
+  // Trivially copyable elements travel in a single part.
+  std::vector<float> a(10000), b;
+  for (size_t i = 0; i < a.size(); ++i) { a[i] = i * 0.5f; }
+
+  ib::io::send(out, a, 0);
+  BOOST_REQUIRE(ib::io::recv(in, b, 0));
+  in.getsockopt(ZMQ_RCVMORE, &more, &more_size);
+  BOOST_REQUIRE_EQUAL(0, more);
+  BOOST_REQUIRE(a == b);
+
+  std::vector<sample> sa(3), sb;
+  sa[1].id = 1; sa[1].x = 2.f; sa[1].y = 3.f;
+  ib::io::send(out, sa, 0);
+  BOOST_REQUIRE(ib::io::recv(in, sb, 0));
+  BOOST_REQUIRE_EQUAL(3, sb.size());
+  BOOST_REQUIRE(sa[1] == sb[1]);
+
+  std::vector<float> e;
+  ib::io::send(out, e, 0);
+  BOOST_REQUIRE(ib::io::recv(in, b, 0));
+  BOOST_REQUIRE(b.empty());
+
+  // Element size mismatch is a conversion error.
+  ib::io::send(out, a, 0);
+  std::vector<double> d;
+  BOOST_REQUIRE_THROW(ib::io::recv(in, d, 0), ib::ib_error);
+
+  // Other elements keep the multi-part encoding.
+  std::vector<std::string> sv(2, "x"), sr;
+  ib::io::send(out, sv, 0);
+  uint64_t count;
+  BOOST_REQUIRE(ib::io::recv(in, count, 0));
+  BOOST_REQUIRE_EQUAL(2u, count);
+  in.getsockopt(ZMQ_RCVMORE, &more, &more_size);
+  BOOST_REQUIRE_EQUAL(1, more);
+  ib::io::discard_remainder(in);
+}
+
+BOOST_AUTO_TEST_CASE(serialized_message)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://serialized_message");
+  out.connect("inproc://serialized_message");
+
+  ib::io::serialized_message m;
+
+  std::vector<std::string> sv(3, "abc"), sr;
+  m.assign(sv);
+  BOOST_REQUIRE_EQUAL(5, m.size());
+
+  // Parts remain valid after sending and can be sent again.
+  for (int i = 0; i < 3; ++i) {
+    BOOST_REQUIRE(m.send(out, 0));
+    BOOST_REQUIRE(ib::io::recv(in, sr, 0));
+    BOOST_REQUIRE(sv == sr);
+  }
+
+  std::vector<float> a(1000, 2.f), b;
+  m.assign(a);
+  BOOST_REQUIRE_EQUAL(1, m.size());
+  BOOST_REQUIRE(m.send(out, 0));
+  BOOST_REQUIRE(m.send(out, 0));
+  BOOST_REQUIRE(ib::io::recv(in, b, 0));
+  BOOST_REQUIRE(a == b);
+  b.clear();
+  BOOST_REQUIRE(ib::io::recv(in, b, 0));
+  BOOST_REQUIRE(a == b);
+
+  // Receive raw messages and decode the last one only.
+  ib::io::send(out, sv, 0);
+  ib::io::send(out, a, 0);
+  BOOST_REQUIRE(m.recv(in, 0));
+  BOOST_REQUIRE_EQUAL(5, m.size());
+  BOOST_REQUIRE(m.recv(in, 0));
+  BOOST_REQUIRE_EQUAL(1, m.size());
+  BOOST_REQUIRE(!m.recv(in, ZMQ_DONTWAIT));
+  BOOST_REQUIRE_EQUAL(1, m.size());
+
+  b.clear();
+  ib::io::part_source src = m.replay();
+  BOOST_REQUIRE(ib::io::recv(src, b, 0));
+  BOOST_REQUIRE(a == b);
+  BOOST_REQUIRE_EQUAL(0, m.size());
+  BOOST_REQUIRE(!ib::io::recv(src, b, ZMQ_DONTWAIT));
+
+  // Multi-part values are decoded from a source part by part.
+  m.assign(sv);
+  sr.clear();
+  src = m.replay();
+  BOOST_REQUIRE(ib::io::recv(src, sr, 0));
+  BOOST_REQUIRE(sv == sr);
+}
+
 BOOST_AUTO_TEST_CASE(builtin)
 {
   boost::thread_group g;
@@ -98,4 +98,491 @@ BOOST_AUTO_TEST_CASE(single_client)
   BOOST_REQUIRE_EQUAL(10, sum_received);  
 }
 
+BOOST_AUTO_TEST_CASE(most_recent)
+{
+  ib::fast_server<int> s;
+  s.startup("tcp://127.0.0.1:6002");
+
+  ib::fast_client<int> c;
+  c.startup("tcp://127.0.0.1:6002");
+
+  // Wait for subscription to be established.
+  int j = 0;
+  while (!c.receive(j, 10)) {
+    s.publish(-1);
+  }
+
+  c.set_enable_most_recent(true);
+  for (int i = 0; i < 100; ++i) {
+    s.publish(i);
+  }
+  boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+  BOOST_REQUIRE(c.receive(j, 0));
+  BOOST_REQUIRE_EQUAL(99, j);
+  BOOST_REQUIRE(!c.receive(j, 0));
+
+  s.publish(100);
+  BOOST_REQUIRE(c.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(100, j);
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(inproc_pointers)
+{
+  ib::context_ptr ctx(new zmq::context_t(1));
+
+  ib::fast_server< std::vector<int> > s(ctx);
+  s.startup("inproc://test-fast-pointers");
+  BOOST_REQUIRE(s.is_passing_pointers());
+
+  ib::fast_client< std::vector<int> > c(ctx);
+  c.startup("inproc://test-fast-pointers");
+
+  std::shared_ptr<const std::vector<int> > p = std::make_shared< std::vector<int> >(10, 3);
+
+  // Wait for subscription to be established.
+  std::shared_ptr<const std::vector<int> > q;
+  while (!c.receive(q, 10)) {
+    s.publish(p);
+  }
+  BOOST_REQUIRE_EQUAL(p.get(), q.get());
+
+  std::vector<int> v;
+  s.publish(p);
+  BOOST_REQUIRE(c.receive(v, 1000));
+  BOOST_REQUIRE(v == *p);
+
+  // Pointers of messages dropped at the high water mark are released.
+  q.reset();
+  for (int i = 0; i < 5000; ++i) {
+    s.publish(p);
+  }
+  BOOST_REQUIRE_LT(p.use_count(), 2500);
+  c.shutdown();
+
+  // Clients connected to remote endpoints refuse pointers.
+  ib::fast_client< std::vector<int> > r(ctx);
+  r.startup("inproc://test-fast-pointers");
+  r.startup("tcp://127.0.0.1:6004");
+  while (!ib::io::is_data_pending(*r.get_socket(), 10)) {
+    s.publish(p);
+  }
+  BOOST_REQUIRE_THROW(r.receive(v, 0), ib::ib_error);
+
+  r.shutdown();
+  s.shutdown();
+
+  // Pointers of queued messages are released once the sockets are closed.
+  for (int i = 0; i < 100 && p.use_count() > 1; ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE_EQUAL(1, p.use_count());
+}
+
+BOOST_AUTO_TEST_CASE(subscriptions)
+{
+  ib::fast_server<int> s;
+  s.startup("tcp://127.0.0.1:6005");
+  BOOST_REQUIRE(!s.has_subscribers());
+  BOOST_REQUIRE(!s.publish(1));
+
+  ib::fast_client<int> c1, c2;
+  c1.startup("tcp://127.0.0.1:6005");
+  c2.startup("tcp://127.0.0.1:6005");
+  for (int i = 0; i < 100 && s.get_num_subscribers() < 2; ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE(s.has_subscribers());
+  BOOST_REQUIRE_EQUAL(2, s.get_num_subscribers());
+  BOOST_REQUIRE_EQUAL(2, s.get_num_subscribers("any topic"));
+  BOOST_REQUIRE(s.publish(1));
+
+  c1.shutdown();
+  c2.shutdown();
+  for (int i = 0; i < 100 && s.has_subscribers(); ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE(!s.has_subscribers());
+  BOOST_REQUIRE(!s.publish(1));
+
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(topics)
+{
+  ib::fast_server<int> s;
+  s.startup("tcp://127.0.0.1:6006");
+
+  ib::fast_client<int> c;
+  c.subscribe("cam1");
+  c.startup("tcp://127.0.0.1:6006");
+  c.subscribe("cam2");
+
+  for (int i = 0; i < 100 && s.get_num_subscribers("cam2") == 0; ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE_EQUAL(1, s.get_num_subscribers("cam1"));
+  BOOST_REQUIRE_EQUAL(1, s.get_num_subscribers("cam2"));
+  BOOST_REQUIRE_EQUAL(0, s.get_num_subscribers("cam10"));
+  BOOST_REQUIRE_EQUAL(0, s.get_num_subscribers("cam"));
+  BOOST_REQUIRE_EQUAL(0, s.get_num_subscribers());
+
+  // Unsubscribed topics are not published at all.
+  BOOST_REQUIRE(!s.publish("cam10", 10));
+  BOOST_REQUIRE(!s.publish(0));
+  BOOST_REQUIRE(s.publish("cam1", 1));
+  BOOST_REQUIRE(s.publish("cam2", 2));
+
+  std::string topic;
+  int j = 0;
+  BOOST_REQUIRE(c.receive(topic, j, 1000));
+  BOOST_REQUIRE_EQUAL("cam1", topic);
+  BOOST_REQUIRE_EQUAL(1, j);
+  BOOST_REQUIRE(c.receive(topic, j, 1000));
+  BOOST_REQUIRE_EQUAL("cam2", topic);
+  BOOST_REQUIRE_EQUAL(2, j);
+
+  c.unsubscribe("cam1");
+  for (int i = 0; i < 100 && s.get_num_subscribers("cam1") > 0; ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE(!s.publish("cam1", 1));
+  BOOST_REQUIRE(s.publish("cam2", 3));
+  BOOST_REQUIRE(c.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(3, j);
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(outbound_budget)
+{
+  const size_t frame_bytes = 1024 * 1024;
+
+  ib::fast_server< std::vector<float> > s;
+  s.set_max_outbound_bytes(4 * frame_bytes);
+  s.startup("tcp://127.0.0.1:6007");
+
+  // Client not receiving, so that published data piles up in queues.
+  ib::fast_client< std::vector<float> > c;
+  c.set_max_pending_inbound(1);
+  c.startup("tcp://127.0.0.1:6007");
+  while (!s.has_subscribers()) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  ib::byte_budget_ptr b = s.get_outbound_budget();
+  const std::vector<float> frame(frame_bytes / sizeof(float), 1.f);
+  for (int i = 0; i < 100 && b->get_num_dropped() == 0; ++i) {
+    s.publish(frame);
+    BOOST_REQUIRE(b->get_used() <= b->get_limit());
+  }
+  BOOST_REQUIRE(b->get_num_dropped() > 0);
+  BOOST_REQUIRE(b->get_used() > 0);
+
+  // Bytes are returned once the client receives.
+  std::vector<float> v;
+  while (c.receive(v, 200)) {
+  }
+  BOOST_REQUIRE(s.publish(frame));
+  BOOST_REQUIRE(c.receive(v, 1000));
+  BOOST_REQUIRE(v == frame);
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(inbound_budget)
+{
+  ib::fast_server<ib::image> s;
+  s.startup("tcp://127.0.0.1:6008");
+
+  const size_t image_bytes = 640 * 480;
+  ib::fast_client<ib::image> c;
+  c.set_max_inbound_bytes(2 * image_bytes + 1024);
+  c.startup("tcp://127.0.0.1:6008");
+  while (!s.has_subscribers()) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  ib::image img(640, 480, 640);
+  ib::byte_budget_ptr b = c.get_inbound_budget();
+
+  // Received images keep their bytes accounted.
+  ib::image r0, r1, r2;
+  BOOST_REQUIRE(s.publish(img));
+  BOOST_REQUIRE(c.receive(r0, 1000));
+  BOOST_REQUIRE(s.publish(img));
+  BOOST_REQUIRE(c.receive(r1, 1000));
+  BOOST_REQUIRE_EQUAL(2 * image_bytes, b->get_used());
+
+  BOOST_REQUIRE(s.publish(img));
+  BOOST_REQUIRE(!c.receive(r2, 1000));
+  BOOST_REQUIRE_EQUAL(1, b->get_num_dropped());
+
+  // Releasing an image makes room for the next one.
+  r0 = ib::image();
+  BOOST_REQUIRE(s.publish(img));
+  BOOST_REQUIRE(c.receive(r2, 1000));
+  BOOST_REQUIRE_EQUAL(640, r2.get_width());
+
+  // Blocking waits for an image to be released.
+  c.set_max_inbound_bytes(2 * image_bytes + 1024, ib::byte_budget::POLICY_BLOCK, 2000);
+  b = c.get_inbound_budget();
+  BOOST_REQUIRE(c.receive(r0, 0) == false);
+  BOOST_REQUIRE(s.publish(img));
+  BOOST_REQUIRE(c.receive(r0, 1000));
+  BOOST_REQUIRE(s.publish(img));
+  BOOST_REQUIRE(c.receive(r1, 1000));
+  BOOST_REQUIRE(s.publish(img));
+  boost::thread t([&]() {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    r0 = ib::image();
+  });
+  BOOST_REQUIRE(c.receive(r2, 1000));
+  t.join();
+  BOOST_REQUIRE_EQUAL(0, b->get_num_dropped());
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(last_value_cache)
+{
+  ib::fast_server<int> s;
+  s.set_enable_last_value_cache(true);
+  s.startup("tcp://127.0.0.1:6009");
+
+  // Cached even though nobody receives it.
+  BOOST_REQUIRE(!s.publish("cam", 1));
+
+  ib::fast_client<int> c1;
+  c1.subscribe("cam");
+  c1.startup("tcp://127.0.0.1:6009");
+  while (!s.serve_subscriptions(10)) {
+  }
+
+  std::string topic;
+  int j = 0;
+  BOOST_REQUIRE(c1.receive(topic, j, 1000));
+  BOOST_REQUIRE_EQUAL("cam", topic);
+  BOOST_REQUIRE_EQUAL(1, j);
+
+  BOOST_REQUIRE(s.publish("cam", 2));
+  BOOST_REQUIRE(c1.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(2, j);
+
+  // A late joiner receives the last value, others ignore the replay.
+  ib::fast_client<int> c2;
+  c2.startup("tcp://127.0.0.1:6009");
+  while (!s.serve_subscriptions(10)) {
+  }
+  BOOST_REQUIRE(c2.receive(topic, j, 1000));
+  BOOST_REQUIRE_EQUAL("cam", topic);
+  BOOST_REQUIRE_EQUAL(2, j);
+  BOOST_REQUIRE(!c1.receive(j, 100));
+
+  BOOST_REQUIRE(s.publish("cam", 3));
+  BOOST_REQUIRE(c1.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(3, j);
+  BOOST_REQUIRE(c2.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(3, j);
+
+  c2.shutdown();
+  c1.shutdown();
+  s.shutdown();
+}
+
+
+BOOST_AUTO_TEST_CASE(last_value_cache_stale_replay)
+{
+  ib::fast_server<int> s;
+  s.set_enable_last_value_cache(true);
+  s.startup("tcp://127.0.0.1:6012");
+
+  ib::fast_client<int> c1;
+  c1.set_enable_most_recent(true);
+  c1.startup("tcp://127.0.0.1:6012");
+  while (!s.serve_subscriptions(10)) {
+  }
+
+  int j = 0;
+  BOOST_REQUIRE(s.publish(1));
+  BOOST_REQUIRE(c1.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(1, j);
+
+  // The replay for a late joiner is queued behind fresh data and must not hide it.
+  BOOST_REQUIRE(s.publish(2));
+  BOOST_REQUIRE(s.publish(3));
+  ib::fast_client<int> c2;
+  c2.startup("tcp://127.0.0.1:6012");
+  while (!s.serve_subscriptions(10)) {
+  }
+  BOOST_REQUIRE(c2.receive(j, 1000));
+  BOOST_REQUIRE_EQUAL(3, j);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  BOOST_REQUIRE(c1.receive(j, 0));
+  BOOST_REQUIRE_EQUAL(3, j);
+
+  // A replay arriving while waiting does not end the wait, with and without skipping.
+  ib::fast_client<int> c3, c4;
+  for (int k = 0; k < 2; ++k) {
+    ib::fast_client<int> &late = (k == 0) ? c3 : c4;
+    c1.set_enable_most_recent(k == 0);
+    boost::thread t([&]() {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+      late.startup("tcp://127.0.0.1:6012");
+      while (!s.serve_subscriptions(10)) {
+      }
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+      s.publish(4 + k);
+    });
+    BOOST_REQUIRE(c1.receive(j, 2000));
+    BOOST_REQUIRE_EQUAL(4 + k, j);
+    t.join();
+  }
+
+  c4.shutdown();
+  c3.shutdown();
+  c2.shutdown();
+  c1.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(last_value_cache_budget)
+{
+  ib::fast_server<ib::image> s;
+  s.set_enable_last_value_cache(true);
+  s.set_max_outbound_bytes(100 * 1024, ib::byte_budget::POLICY_BLOCK, 2000);
+  s.startup("tcp://127.0.0.1:6011");
+
+  ib::fast_client<ib::image> c;
+  c.startup("tcp://127.0.0.1:6011");
+  while (!s.serve_subscriptions(10)) {
+  }
+
+  // Cached frames are not charged to the budget, so every frame fits once received.
+  ib::byte_budget_ptr b = s.get_outbound_budget();
+  ib::image img(320, 240, 320);
+  ib::image r;
+  for (int i = 0; i < 20; ++i) {
+    img.set_sequence(i);
+    BOOST_REQUIRE(s.publish(img));
+    BOOST_REQUIRE(c.receive(r, 1000));
+    BOOST_REQUIRE_EQUAL(static_cast<uint32_t>(i), r.get_sequence());
+  }
+  r = ib::image();
+  for (int i = 0; i < 100 && b->get_used() > 0; ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE_EQUAL(0u, b->get_used());
+  BOOST_REQUIRE_EQUAL(0u, b->get_num_dropped());
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(last_value_cache_delta)
+{
+  ib::fast_server<ib::image> s;
+  s.set_enable_last_value_cache(true);
+  s.startup("tcp://127.0.0.1:6013");
+
+  ib::fast_client<ib::image> c;
+  c.startup("tcp://127.0.0.1:6013");
+  while (!s.serve_subscriptions(10)) {
+  }
+
+  ib::image a(64, 32, 64), r;
+  memset(a.ptr<char>(), 0, a.size());
+  a.set_codec(ib::codec_ptr(new ib::tile_delta_codec(30)));
+  for (int k = 0; k < 4; ++k) {
+    a.ptr<unsigned char>()[k] = static_cast<unsigned char>(k + 1);
+    BOOST_REQUIRE(s.publish(a));
+    BOOST_REQUIRE(c.receive(r, 1000));
+    BOOST_REQUIRE_EQUAL(0, memcmp(a.ptr<char>(), r.ptr<char>(), a.size()));
+  }
+
+  // A late joiner receives the cached keyframe rather than the last delta frame.
+  ib::fast_client<ib::image> late;
+  late.startup("tcp://127.0.0.1:6013");
+  while (!s.serve_subscriptions(10)) {
+  }
+  ib::image rl;
+  BOOST_REQUIRE(late.receive(rl, 1000));
+  BOOST_REQUIRE_EQUAL(1, rl.ptr<unsigned char>()[0]);
+  BOOST_REQUIRE_EQUAL(0, rl.ptr<unsigned char>()[1]);
+  BOOST_REQUIRE(!c.receive(r, 100));
+
+  // The next frame is a keyframe and decodes for everyone.
+  a.ptr<unsigned char>()[4] = 5;
+  BOOST_REQUIRE(s.publish(a));
+  BOOST_REQUIRE(late.receive(rl, 1000));
+  BOOST_REQUIRE(c.receive(r, 1000));
+  BOOST_REQUIRE_EQUAL(0, memcmp(a.ptr<char>(), rl.ptr<char>(), a.size()));
+  BOOST_REQUIRE_EQUAL(0, memcmp(a.ptr<char>(), r.ptr<char>(), a.size()));
+
+  late.shutdown();
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(tile_delta)
+{
+  ib::fast_server<ib::image> s;
+  s.startup("tcp://127.0.0.1:6010");
+
+  ib::fast_client<ib::image> c;
+  c.startup("tcp://127.0.0.1:6010");
+  while (!s.has_subscribers()) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  ib::image a(64, 32, 64), b(64, 32, 64);
+  memset(a.ptr<char>(), 1, a.size());
+  memset(b.ptr<char>(), 2, b.size());
+  a.set_codec(ib::codec_ptr(new ib::tile_delta_codec(5)));
+  b.set_codec(ib::codec_ptr(new ib::tile_delta_codec(5)));
+
+  // The client reconstructs each topic, independent of the images received into.
+  for (int k = 0; k < 8; ++k) {
+    a.ptr<unsigned char>()[k] = static_cast<unsigned char>(k);
+    b.ptr<unsigned char>()[64 * k] = static_cast<unsigned char>(k);
+    BOOST_REQUIRE(s.publish("a", a));
+    BOOST_REQUIRE(s.publish("b", b));
+
+    std::string ta, tb;
+    ib::image ra, rb;
+    BOOST_REQUIRE(c.receive(ta, ra, 1000));
+    BOOST_REQUIRE(c.receive(tb, rb, 1000));
+    BOOST_REQUIRE_EQUAL("a", ta);
+    BOOST_REQUIRE_EQUAL("b", tb);
+    BOOST_REQUIRE_EQUAL(0, memcmp(a.ptr<char>(), ra.ptr<char>(), a.size()));
+    BOOST_REQUIRE_EQUAL(0, memcmp(b.ptr<char>(), rb.ptr<char>(), b.size()));
+  }
+
+  // A late joiner resynchronizes at the next keyframe.
+  ib::fast_client<ib::image> late;
+  late.subscribe("a");
+  late.startup("tcp://127.0.0.1:6010");
+  boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+  ib::image r;
+  for (int k = 8; k < 10; ++k) {
+    BOOST_REQUIRE(s.publish("a", a));
+    BOOST_REQUIRE(!late.receive(r, 1000));
+  }
+  a.ptr<unsigned char>()[0] = 42;
+  BOOST_REQUIRE(s.publish("a", a));
+  BOOST_REQUIRE(late.receive(r, 1000));
+  BOOST_REQUIRE_EQUAL(42, r.ptr<unsigned char>()[0]);
+
+  late.shutdown();
+  c.shutdown();
+  s.shutdown();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
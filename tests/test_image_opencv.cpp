@@ -64,18 +64,26 @@ BOOST_AUTO_TEST_CASE(convert)
 
 BOOST_AUTO_TEST_CASE(convert_format)
 {
-  cv::Mat cv_img(cv::Size(640,480), CV_8UC3);
+  cv::Mat cv_img(cv::Size(640,480), CV_8UC3, cv::Scalar(1, 2, 3));
   ib::image ib_img = ib::cvt_image< ib::image >(cv_img, ib::share_mem());  
   ib_img.set_format(ib::image::FORMAT_RGB_888);
   ib_img.set_external_type(-1);
+  BOOST_REQUIRE_EQUAL(cv_img.data, ib_img.ptr<void>());
+
+  // RGB images are converted to BGR, even when sharing memory is requested.
   cv::Mat cv_img2 = ib::cvt_image< cv::Mat > (ib_img, ib::share_mem());
 
   BOOST_REQUIRE_EQUAL(cv_img.rows, cv_img2.rows);
   BOOST_REQUIRE_EQUAL(cv_img.cols, cv_img2.cols);
   BOOST_REQUIRE_EQUAL(cv_img.step, cv_img2.step);
   BOOST_REQUIRE_EQUAL(cv_img.type(), cv_img2.type());
-  BOOST_REQUIRE_EQUAL(cv_img.data, cv_img2.data);
-  BOOST_REQUIRE_EQUAL(cv_img.data, ib_img.ptr<void>());
+  BOOST_REQUIRE_NE(cv_img.data, cv_img2.data);
+  BOOST_REQUIRE_EQUAL(3, cv_img2.data[0]);
+  BOOST_REQUIRE_EQUAL(2, cv_img2.data[1]);
+  BOOST_REQUIRE_EQUAL(1, cv_img2.data[2]);
+
+  cv::Mat cv_img4 = ib::cvt_image< cv::Mat > (ib_img, ib::copy_mem());
+  BOOST_REQUIRE_EQUAL(0, memcmp(cv_img2.data, cv_img4.data, cv_img2.rows * cv_img2.step));
 
   ib::image ib_img2 = ib::cvt_image< ib::image >(cv_img, ib::copy_mem());
   cv::Mat cv_img3 = ib::cvt_image< cv::Mat > (ib_img2, ib::copy_mem());
@@ -29,6 +29,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include <imagebabble/imagebabble.hpp>
+#include <imagebabble/conversion/bayer.hpp>
 #include <boost/thread/thread.hpp>
 
 BOOST_AUTO_TEST_SUITE(test_image_support)
@@ -197,6 +198,9 @@ void server_image_fnc()
   ib::image img(1, 5, sizeof(int));
   img.set_external_type(any_type);
   img.set_format(ib::image::FORMAT_RGB_888);
+  img.set_flags(0x8001);
+  img.set_sequence(42);
+  img.set_timestamp(1234567890123ULL);
   for (int i = 0; i < img.get_height(); ++i) {
     img.ptr<int>()[i] = i;
   } 
@@ -218,6 +222,9 @@ void client_image_fnc()
   BOOST_REQUIRE_EQUAL(sizeof(int), img.get_step());
   BOOST_REQUIRE_EQUAL(any_type, img.get_external_type());
   BOOST_REQUIRE_EQUAL(ib::image::FORMAT_RGB_888, img.get_format());
+  BOOST_REQUIRE_EQUAL(0x8001, img.get_flags());
+  BOOST_REQUIRE_EQUAL(42u, img.get_sequence());
+  BOOST_REQUIRE_EQUAL(1234567890123ULL, img.get_timestamp());
   BOOST_REQUIRE_EQUAL(0, img.ptr<int>()[0]);
   BOOST_REQUIRE_EQUAL(1, img.ptr<int>()[1]);
   BOOST_REQUIRE_EQUAL(2, img.ptr<int>()[2]);
@@ -236,6 +243,87 @@ BOOST_AUTO_TEST_CASE(send_receive_image)
   g.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(image_header)
+{
+  ib::io::image_header h;
+  h.format = ib::image::FORMAT_DEPTH_16;
+  h.flags = 0x1234;
+  h.width = 640;
+  h.height = 480;
+  h.step = 1280;
+  h.external_type = -1;
+  h.sequence = 0xdeadbeef;
+  h.timestamp = 0x0102030405060708ULL;
+
+  unsigned char buf[ib::io::image_header::wire_size];
+  h.store(buf);
+
+  // Layout is little-endian independent of the host.
+  BOOST_REQUIRE_EQUAL(0x81, buf[0]);
+  BOOST_REQUIRE_EQUAL(0x80, buf[4]);
+  BOOST_REQUIRE_EQUAL(0x02, buf[5]);
+  BOOST_REQUIRE_EQUAL(0x08, buf[24]);
+  BOOST_REQUIRE_EQUAL(0x01, buf[31]);
+
+  ib::io::image_header r;
+  BOOST_REQUIRE(r.load(buf, sizeof(buf)));
+  BOOST_REQUIRE_EQUAL(h.format, r.format);
+  BOOST_REQUIRE_EQUAL(h.flags, r.flags);
+  BOOST_REQUIRE_EQUAL(h.width, r.width);
+  BOOST_REQUIRE_EQUAL(h.height, r.height);
+  BOOST_REQUIRE_EQUAL(h.step, r.step);
+  BOOST_REQUIRE_EQUAL(h.external_type, r.external_type);
+  BOOST_REQUIRE_EQUAL(h.sequence, r.sequence);
+  BOOST_REQUIRE_EQUAL(h.timestamp, r.timestamp);
+
+  BOOST_REQUIRE(!r.load(buf, sizeof(buf) - 1));
+  buf[0] = '6';
+  BOOST_REQUIRE(!r.load(buf, sizeof(buf)));
+
+  // Malformed layouts are rejected before buffers are sized from them.
+  ib::io::image_header bad = h;
+  bad.height = -1;
+  bad.store(buf);
+  BOOST_REQUIRE_THROW(r.load(buf, sizeof(buf)), ib::ib_error);
+
+  bad = h;
+  bad.step = 640;
+  bad.store(buf);
+  BOOST_REQUIRE_THROW(r.load(buf, sizeof(buf)), ib::ib_error);
+
+  bad = h;
+  bad.format = 200;
+  bad.store(buf);
+  BOOST_REQUIRE_THROW(r.load(buf, sizeof(buf)), ib::ib_error);
+
+  bad = h;
+  bad.height = 0x10000000;
+  bad.store(buf);
+  BOOST_REQUIRE_THROW(r.load(buf, sizeof(buf)), ib::ib_error);
+}
+
+BOOST_AUTO_TEST_CASE(receive_legacy_image_header)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://legacy_header");
+  out.connect("inproc://legacy_header");
+
+  int data[2] = {7, 8};
+  ib::io::send(out, std::string("1 2 4 0 3"), ZMQ_SNDMORE);
+  out.send(data, sizeof(data));
+
+  ib::image img;
+  BOOST_REQUIRE(ib::io::recv(in, img, 0));
+  BOOST_REQUIRE_EQUAL(1, img.get_width());
+  BOOST_REQUIRE_EQUAL(2, img.get_height());
+  BOOST_REQUIRE_EQUAL(4, img.get_step());
+  BOOST_REQUIRE_EQUAL(0, img.get_external_type());
+  BOOST_REQUIRE_EQUAL(ib::image::FORMAT_GRAY_8, img.get_format());
+  BOOST_REQUIRE_EQUAL(7, img.ptr<int>()[0]);
+  BOOST_REQUIRE_EQUAL(8, img.ptr<int>()[1]);
+}
+
 void server_image_group_fnc() 
 {
   ib::reliable_server< ib::image_group > s;
@@ -394,4 +482,564 @@ BOOST_AUTO_TEST_CASE(receive_into_existing_memory)
   g.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(send_receive_packed_image_group)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://packed_group");
+  out.connect("inproc://packed_group");
+
+  ib::image_group g("packed");
+  g.set_packed(true);
+  g.add_image(ib::image(1, 5, sizeof(int)), "image one");
+  g.add_image(ib::image(2, 3, 2 * sizeof(int)), "image two");
+  g.get_images()[1].set_sequence(17);
+  for (int i = 0; i < 5; ++i) { g.get_images()[0].ptr<int>()[i] = i; }
+  for (int i = 0; i < 6; ++i) { g.get_images()[1].ptr<int>()[i] = 10 + i; }
+
+  // Directory followed by one part per image
+  BOOST_REQUIRE(ib::io::send(out, g, 0));
+
+  int parts = 0;
+  int64_t more = 1;
+  size_t more_size = sizeof(more);
+  zmq::message_t dir;
+  do {
+    zmq::message_t msg;
+    in.recv(&msg);
+    if (parts == 0) {
+      dir.copy(&msg);
+    }
+    ++parts;
+    in.getsockopt(ZMQ_RCVMORE, &more, &more_size);
+  } while (more);
+  BOOST_REQUIRE_EQUAL(3, parts);
+
+  ib::io::group_directory d;
+  BOOST_REQUIRE(d.parse(dir.data(), dir.size()));
+  BOOST_REQUIRE_EQUAL(2, d.size());
+  BOOST_REQUIRE_EQUAL(std::string("packed"), std::string(d.id_data(), d.id_size()));
+  BOOST_REQUIRE_EQUAL(std::string("image two"), std::string(d.name_data(1), d.name_size(1)));
+  BOOST_REQUIRE_EQUAL(6 * sizeof(int), d.payload_size(1));
+  BOOST_REQUIRE(!d.parse(dir.data(), dir.size() - 1));
+
+  // Receive into pre-allocated memory
+  int arr[5];
+  ib::image_group r;
+  r.add_image(ib::image(1, 5, sizeof(int), arr, ib::share_mem()));
+
+  BOOST_REQUIRE(ib::io::send(out, g, 0));
+  BOOST_REQUIRE(ib::io::recv(in, r, 0));
+  BOOST_REQUIRE(r.is_packed());
+  BOOST_REQUIRE_EQUAL(std::string("packed"), r.get_id());
+  BOOST_REQUIRE_EQUAL(2, r.size());
+  BOOST_REQUIRE_EQUAL(std::string("image one"), r.get_names()[0]);
+  BOOST_REQUIRE_EQUAL(std::string("image two"), r.get_names()[1]);
+  BOOST_REQUIRE_EQUAL(arr, r.get_images()[0].ptr<int>());
+  BOOST_REQUIRE_EQUAL(2, r.get_images()[1].get_width());
+  BOOST_REQUIRE_EQUAL(3, r.get_images()[1].get_height());
+  BOOST_REQUIRE_EQUAL(17u, r.get_images()[1].get_sequence());
+  for (int i = 0; i < 5; ++i) { BOOST_REQUIRE_EQUAL(i, arr[i]); }
+  for (int i = 0; i < 6; ++i) { BOOST_REQUIRE_EQUAL(10 + i, r.get_images()[1].ptr<int>()[i]); }
+
+  // Payloads must match the directory and the size their headers imply
+  {
+    zmq::message_t d0, p0(5 * sizeof(int)), p1(5 * sizeof(int));
+    d0.copy(&dir);
+    out.send(d0, ZMQ_SNDMORE);
+    out.send(p0, ZMQ_SNDMORE);
+    out.send(p1, 0);
+    ib::image_group bad;
+    BOOST_REQUIRE_THROW(ib::io::recv(in, bad, 0), ib::ib_error);
+    ib::io::discard_remainder(in);
+  }
+  {
+    zmq::message_t d1(dir.size()), p0(5 * sizeof(int)), p1(4 * sizeof(int));
+    memcpy(d1.data(), dir.data(), dir.size());
+    ib::io::store_le<uint64_t>(static_cast<char*>(d1.data()) + 16 + 48 + 8, 4 * sizeof(int));
+    out.send(d1, ZMQ_SNDMORE);
+    out.send(p0, ZMQ_SNDMORE);
+    out.send(p1, 0);
+    ib::image_group bad;
+    try {
+      ib::io::recv(in, bad, 0);
+      BOOST_FAIL("expected ib_error");
+    } catch (const ib::ib_error &e) {
+      BOOST_REQUIRE_EQUAL(ib::ib_error::ECONVERSION, e.get_reason());
+    }
+    ib::io::discard_remainder(in);
+  }
+
+  // Multi-part format is still detected
+  g.set_packed(false);
+  BOOST_REQUIRE(ib::io::send(out, g, 0));
+  BOOST_REQUIRE(ib::io::recv(in, r, 0));
+  BOOST_REQUIRE(!r.is_packed());
+  BOOST_REQUIRE_EQUAL(std::string("packed"), r.get_id());
+  BOOST_REQUIRE_EQUAL(2, r.size());
+}
+
+BOOST_AUTO_TEST_CASE(receive_into_buffer_pool)
+{
+  BOOST_REQUIRE_EQUAL(4096, ib::buffer_pool::size_class(1));
+  BOOST_REQUIRE_EQUAL(5 * 65536, ib::buffer_pool::size_class(640 * 480));
+  BOOST_REQUIRE_EQUAL(10240, ib::buffer_pool::size_class(9000));
+
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://buffer_pool");
+  out.connect("inproc://buffer_pool");
+
+  ib::buffer_pool_ptr pool(new ib::buffer_pool());
+
+  ib::image src(100, 100, 100 * sizeof(int));
+  for (int i = 0; i < 100 * 100; ++i) { src.ptr<int>()[i] = i; }
+
+  ib::image dst;
+  dst.set_buffer_pool(pool);
+
+  // Steady state alternates between two buffers.
+  for (int k = 0; k < 10; ++k) {
+    src.set_sequence(k);
+    BOOST_REQUIRE(ib::io::send(out, src, 0));
+    BOOST_REQUIRE(ib::io::recv(in, dst, 0));
+    BOOST_REQUIRE_EQUAL(k, dst.get_sequence());
+    BOOST_REQUIRE_EQUAL(src.size(), dst.size());
+    BOOST_REQUIRE_EQUAL(0u, reinterpret_cast<size_t>(dst.ptr<char>()) % ib::buffer_pool::alignment);
+    BOOST_REQUIRE_EQUAL(9999, dst.ptr<int>()[9999]);
+  }
+  BOOST_REQUIRE_EQUAL(2, pool->get_num_allocations());
+
+  // Received images keep the pool alive.
+  ib::image keep(dst);
+  pool.reset();
+  dst = ib::image();
+  BOOST_REQUIRE_EQUAL(5, keep.ptr<int>()[5]);
+}
+
+
+/** Encode and decode with the LZ codec and compare. Returns the encoded size or 
+  * zero if the data does not shrink. */
+size_t lz_roundtrip(const std::vector<unsigned char> &src)
+{
+  ib::lz_codec c;
+  const ib::codec_layout l = {static_cast<int>(src.size()), 1, static_cast<int>(src.size()), ib::image::FORMAT_GRAY_8};
+
+  std::vector<unsigned char> coded(c.get_max_encoded_size(l, src.size()));
+  const size_t n = c.encode(l, src.data(), src.size(), coded.data(), coded.size());
+  if (n == 0) {
+    return 0;
+  }
+  BOOST_REQUIRE(n < src.size());
+
+  std::vector<unsigned char> decoded(src.size() + 1, 0xcd);
+  BOOST_REQUIRE(c.decode(l, coded.data(), n, decoded.data(), src.size()));
+  BOOST_REQUIRE(std::equal(src.begin(), src.end(), decoded.begin()));
+  BOOST_REQUIRE_EQUAL(0xcd, decoded.back());
+
+  // Truncated input and wrong sizes are rejected.
+  BOOST_REQUIRE(!c.decode(l, coded.data(), n - 1, decoded.data(), src.size()));
+  if (!src.empty()) {
+    BOOST_REQUIRE(!c.decode(l, coded.data(), n, decoded.data(), src.size() - 1));
+  }
+  return n;
+}
+
+BOOST_AUTO_TEST_CASE(lz_codec)
+{
+  std::vector<unsigned char> v;
+  for (size_t n = 0; n < 40; ++n) {
+    v.assign(n, 7);
+    lz_roundtrip(v);
+  }
+  BOOST_REQUIRE(lz_roundtrip(v) > 0);
+
+  // Runs, periodic patterns and references beyond the largest offset.
+  v.clear();
+  for (int i = 0; i < 200000; ++i) {
+    v.push_back(static_cast<unsigned char>((i / 1000) % 3 == 0 ? 0 : (i % 7) * 31));
+  }
+  BOOST_REQUIRE(lz_roundtrip(v) < v.size() / 10);
+
+  // Random data does not shrink.
+  v.resize(10000);
+  unsigned r = 12345;
+  for (size_t i = 0; i < v.size(); ++i) { r = r * 1103515245 + 12345; v[i] = static_cast<unsigned char>(r >> 16); }
+  BOOST_REQUIRE_EQUAL(0u, lz_roundtrip(v));
+
+  BOOST_REQUIRE(ib::codec_registry::create(ib::CODEC_LZ));
+  BOOST_REQUIRE(!ib::codec_registry::create(ib::CODEC_USER));
+}
+
+BOOST_AUTO_TEST_CASE(send_receive_compressed_image)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://compressed");
+  out.connect("inproc://compressed");
+
+  ib::image src(320, 240, 320);
+  src.set_format(ib::image::FORMAT_GRAY_8);
+  src.set_codec(ib::codec_ptr(new ib::lz_codec()));
+  for (int y = 0; y < 240; ++y) {
+    for (int x = 0; x < 320; ++x) { src.ptr<unsigned char>()[y * 320 + x] = static_cast<unsigned char>(x / 16 + y / 16); }
+  }
+
+  // Header carries the codec, payload shrinks.
+  BOOST_REQUIRE(ib::io::send(out, src, 0));
+  zmq::message_t hdr, payload;
+  in.recv(&hdr);
+  in.recv(&payload);
+  BOOST_REQUIRE_EQUAL(static_cast<size_t>(ib::io::image_header::wire_size_coded), hdr.size());
+  BOOST_REQUIRE_EQUAL(0x82, static_cast<unsigned char*>(hdr.data())[0]);
+  BOOST_REQUIRE_EQUAL(ib::CODEC_LZ, static_cast<unsigned char*>(hdr.data())[32]);
+  BOOST_REQUIRE(payload.size() < src.size() / 4);
+
+  // Decoding is transparent and draws from the pool of the image.
+  ib::buffer_pool_ptr pool(new ib::buffer_pool());
+  ib::image dst;
+  dst.set_buffer_pool(pool);
+  for (int k = 0; k < 10; ++k) {
+    src.set_sequence(k);
+    BOOST_REQUIRE(ib::io::send(out, src, 0));
+    BOOST_REQUIRE(ib::io::recv(in, dst, 0));
+    BOOST_REQUIRE_EQUAL(k, dst.get_sequence());
+    BOOST_REQUIRE_EQUAL(ib::image::FORMAT_GRAY_8, dst.get_format());
+    BOOST_REQUIRE_EQUAL(src.size(), dst.size());
+    BOOST_REQUIRE_EQUAL(0, memcmp(src.ptr<char>(), dst.ptr<char>(), src.size()));
+  }
+  BOOST_REQUIRE_EQUAL(ib::CODEC_LZ, dst.get_codec()->get_id());
+  BOOST_REQUIRE_EQUAL(2, pool->get_num_allocations());
+
+  // Decoding into pre-allocated user memory.
+  std::vector<unsigned char> mem(src.size());
+  ib::image user(320, 240, 320, mem.data(), ib::share_mem());
+  BOOST_REQUIRE(ib::io::send(out, src, 0));
+  BOOST_REQUIRE(ib::io::recv(in, user, 0));
+  BOOST_REQUIRE(std::equal(mem.begin(), mem.end(), src.ptr<unsigned char>()));
+
+  // Incompressible data is sent uncompressed.
+  unsigned r = 1;
+  for (size_t i = 0; i < src.size(); ++i) { r = r * 1103515245 + 12345; src.ptr<unsigned char>()[i] = static_cast<unsigned char>(r >> 16); }
+  BOOST_REQUIRE(ib::io::send(out, src, 0));
+  in.recv(&hdr);
+  in.recv(&payload);
+  BOOST_REQUIRE_EQUAL(static_cast<size_t>(ib::io::image_header::wire_size), hdr.size());
+  BOOST_REQUIRE_EQUAL(src.size(), payload.size());
+}
+
+BOOST_AUTO_TEST_CASE(send_receive_planar_image)
+{
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("tcp://127.0.0.1:6420");
+  out.connect("tcp://127.0.0.1:6420");
+
+  const ib::image::eformat formats[] = {ib::image::FORMAT_NV12, ib::image::FORMAT_I420};
+  for (int f = 0; f < 2; ++f) {
+    // Chroma planes follow the luma plane, so payloads exceed step*height.
+    ib::image src(64, 48, 64, formats[f]);
+    BOOST_REQUIRE_EQUAL(64 * 72, src.size());
+    for (size_t i = 0; i < src.size(); ++i) { src.ptr<unsigned char>()[i] = static_cast<unsigned char>(i / 64); }
+
+    ib::buffer_pool_ptr pool(new ib::buffer_pool());
+    ib::image dst;
+    dst.set_buffer_pool(pool);
+    BOOST_REQUIRE(ib::io::send(out, src, 0));
+    BOOST_REQUIRE(ib::io::recv(in, dst, 0));
+    BOOST_REQUIRE_EQUAL(formats[f], dst.get_format());
+    BOOST_REQUIRE_EQUAL(src.size(), dst.size());
+    BOOST_REQUIRE_EQUAL(0, memcmp(src.ptr<char>(), dst.ptr<char>(), src.size()));
+
+    src.set_codec(ib::codec_ptr(new ib::lz_codec()));
+    for (int k = 0; k < 2; ++k) {
+      ib::image coded;
+      if (k == 1) {
+        coded.set_buffer_pool(pool);
+      }
+      BOOST_REQUIRE(ib::io::send(out, src, 0));
+      BOOST_REQUIRE(ib::io::recv(in, coded, 0));
+      BOOST_REQUIRE_EQUAL(ib::CODEC_LZ, coded.get_codec()->get_id());
+      BOOST_REQUIRE_EQUAL(src.size(), coded.size());
+      BOOST_REQUIRE_EQUAL(0, memcmp(src.ptr<char>(), coded.ptr<char>(), src.size()));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(tile_delta_codec)
+{
+  const int w = 100, h = 50;
+  const ib::codec_layout l = {w, h, w, ib::image::FORMAT_GRAY_8};
+  ib::tile_delta_codec enc(4, 16, 8), dec;
+
+  std::vector<unsigned char> frame(w * h, 10), decoded(w * h);
+  std::vector<unsigned char> coded(enc.get_max_encoded_size(l, frame.size()));
+  std::vector<std::vector<unsigned char> > stream;
+
+  // Keyframe, then deltas of a single changed pixel, then another keyframe.
+  for (int k = 0; k < 5; ++k) {
+    frame[(k * 13) % h * w + 99] = static_cast<unsigned char>(k);
+    const size_t n = enc.encode(l, frame.data(), frame.size(), coded.data(), coded.size());
+    BOOST_REQUIRE(n > 0);
+    BOOST_REQUIRE_EQUAL(k % 4 == 0, enc.is_keyframe(coded.data(), n));
+    if (k % 4 == 0) {
+      BOOST_REQUIRE_EQUAL(ib::tile_delta_codec::header_size + frame.size(), n);
+    } else {
+      // Header, bitmap of 7x7 tiles and a single clipped tile of 4x8 bytes.
+      BOOST_REQUIRE_EQUAL(ib::tile_delta_codec::header_size + 7 + 4 * 8, n);
+    }
+    stream.push_back(std::vector<unsigned char>(coded.begin(), coded.begin() + n));
+
+    BOOST_REQUIRE(dec.decode(l, stream.back().data(), n, decoded.data(), decoded.size()));
+    BOOST_REQUIRE(frame == decoded);
+  }
+
+  // A late decoder waits for the keyframe, a gap suspends decoding until the next one.
+  ib::tile_delta_codec late;
+  BOOST_REQUIRE(!late.decode(l, stream[1].data(), stream[1].size(), decoded.data(), decoded.size()));
+  BOOST_REQUIRE(late.decode(l, stream[0].data(), stream[0].size(), decoded.data(), decoded.size()));
+  BOOST_REQUIRE(!late.decode(l, stream[2].data(), stream[2].size(), decoded.data(), decoded.size()));
+  BOOST_REQUIRE(!late.decode(l, stream[3].data(), stream[3].size(), decoded.data(), decoded.size()));
+  BOOST_REQUIRE(late.decode(l, stream[4].data(), stream[4].size(), decoded.data(), decoded.size()));
+  BOOST_REQUIRE(frame == decoded);
+
+  // A keyframe is sent on request.
+  enc.request_keyframe();
+  const size_t n = enc.encode(l, frame.data(), frame.size(), coded.data(), coded.size());
+  BOOST_REQUIRE(enc.is_keyframe(coded.data(), n));
+
+  // Truncated delta frames are rejected.
+  ib::tile_delta_codec other;
+  BOOST_REQUIRE(other.decode(l, stream[0].data(), stream[0].size(), decoded.data(), decoded.size()));
+  BOOST_REQUIRE(!other.decode(l, stream[1].data(), stream[1].size() - 1, decoded.data(), decoded.size()));
+}
+
+
+BOOST_AUTO_TEST_CASE(rvl_codec)
+{
+  const int w = 64, h = 48;
+  const ib::codec_layout l = {w, h, 2 * w, ib::image::FORMAT_DEPTH_16};
+  ib::rvl_codec c;
+
+  // Tilted plane with invalid regions and extreme values.
+  std::vector<uint16_t> depth(w * h);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      depth[y * w + x] = (x < 5 || (x > 30 && x < 40)) ? 0 : static_cast<uint16_t>(1000 + 3 * y + x / 4);
+    }
+  }
+  depth[100] = 65535;
+  depth[101] = 1;
+  depth.back() = 0;
+
+  const size_t n = depth.size() * 2;
+  std::vector<unsigned char> coded(c.get_max_encoded_size(l, n));
+  const size_t bytes = c.encode(l, depth.data(), n, coded.data(), coded.size());
+  BOOST_REQUIRE(bytes > 0 && bytes < n / 3);
+
+  std::vector<uint16_t> decoded(depth.size());
+  BOOST_REQUIRE(c.decode(l, coded.data(), bytes, decoded.data(), n));
+  BOOST_REQUIRE(depth == decoded);
+  BOOST_REQUIRE(!c.decode(l, coded.data(), bytes - 4, decoded.data(), n));
+
+  // Empty frames shrink to a few words, padded rows are not supported.
+  std::vector<uint16_t> empty(w * h, 0);
+  BOOST_REQUIRE(c.encode(l, empty.data(), n, coded.data(), coded.size()) <= 8);
+  const ib::codec_layout padded = {w - 1, h, 2 * w, ib::image::FORMAT_DEPTH_16};
+  BOOST_REQUIRE_EQUAL(0u, c.encode(padded, depth.data(), n, coded.data(), coded.size()));
+
+  // Depth images are compressed by default.
+  zmq::context_t ctx(1);
+  zmq::socket_t out(ctx, ZMQ_PAIR), in(ctx, ZMQ_PAIR);
+  in.bind("inproc://rvl");
+  out.connect("inproc://rvl");
+
+  ib::image src(w, h, 2 * w, depth.data(), ib::copy_mem());
+  src.set_format(ib::image::FORMAT_DEPTH_16);
+  BOOST_REQUIRE(ib::io::send(out, src, 0));
+  zmq::message_t hdr, payload;
+  in.recv(&hdr);
+  in.recv(&payload);
+  BOOST_REQUIRE_EQUAL(ib::CODEC_RVL, static_cast<unsigned char*>(hdr.data())[32]);
+  BOOST_REQUIRE_EQUAL(bytes, payload.size());
+
+  ib::image dst;
+  BOOST_REQUIRE(ib::io::send(out, src, 0));
+  BOOST_REQUIRE(ib::io::recv(in, dst, 0));
+  BOOST_REQUIRE_EQUAL(0, memcmp(depth.data(), dst.ptr<char>(), n));
+
+  ib::codec_ptr rvl = ib::image::get_default_codec(ib::image::FORMAT_DEPTH_16);
+  ib::image::set_default_codec(ib::image::FORMAT_DEPTH_16, ib::codec_ptr());
+  BOOST_REQUIRE(ib::io::send(out, src, 0));
+  in.recv(&hdr);
+  in.recv(&payload);
+  BOOST_REQUIRE_EQUAL(static_cast<size_t>(ib::io::image_header::wire_size), hdr.size());
+  ib::image::set_default_codec(ib::image::FORMAT_DEPTH_16, rvl);
+}
+
+BOOST_AUTO_TEST_CASE(demosaic)
+{
+  const ib::image::eformat formats[] = {
+    ib::image::FORMAT_BAYER_RGGB_8, ib::image::FORMAT_BAYER_BGGR_8, 
+    ib::image::FORMAT_BAYER_GRBG_8, ib::image::FORMAT_BAYER_GBRG_8
+  };
+
+  // Bilinear interpolation reproduces linear color ramps away from borders.
+  const int w = 100, h = 50;
+  for (int f = 0; f < 4; ++f) {
+    ib::image raw(w, h, w);
+    raw.set_format(formats[f]);
+    raw.set_sequence(7);
+
+    const ib::bayer::pattern p = ib::bayer::pattern::from_format(formats[f]);
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        const int bgr[3] = {250 - x - y, x + 2 * y + 5, x + y};
+        int c = 1;
+        switch (p.site(x, y)) {
+        case ib::bayer::SITE_RED: c = 2; break;
+        case ib::bayer::SITE_BLUE: c = 0; break;
+        default: break;
+        }
+        raw.ptr<uint8_t>()[y * w + x] = static_cast<uint8_t>(bgr[c]);
+      }
+    }
+
+    ib::image bgr;
+    ib::demosaic(raw, bgr);
+    BOOST_REQUIRE_EQUAL(ib::image::FORMAT_BGR_888, bgr.get_format());
+    BOOST_REQUIRE_EQUAL(w, bgr.get_width());
+    BOOST_REQUIRE_EQUAL(w * 3, bgr.get_step());
+    BOOST_REQUIRE_EQUAL(7u, bgr.get_sequence());
+
+    int max_err = 0;
+    for (int y = 1; y < h - 1; ++y) {
+      for (int x = 1; x < w - 1; ++x) {
+        const uint8_t *o = bgr.ptr<uint8_t>() + y * w * 3 + x * 3;
+        max_err = std::max(max_err, abs(o[0] - (250 - x - y)));
+        max_err = std::max(max_err, abs(o[1] - (x + 2 * y + 5)));
+        max_err = std::max(max_err, abs(o[2] - (x + y)));
+      }
+    }
+    BOOST_REQUIRE_LE(max_err, 1);
+  }
+
+  // Vectorized 8 bit path, 16 bit path and any number of threads agree on arbitrary data.
+  const int rw = 203, rh = 300;
+  std::vector<uint8_t> raw8(rw * rh);
+  std::vector<uint16_t> raw16(rw * rh);
+  unsigned state = 1;
+  for (size_t i = 0; i < raw8.size(); ++i) {
+    state = state * 1103515245 + 12345;
+    raw8[i] = static_cast<uint8_t>(state >> 16);
+    raw16[i] = raw8[i];
+  }
+
+  for (int f = 0; f < 4; ++f) {
+    std::vector<uint8_t> one(rw * rh * 3), many(rw * rh * 3);
+    std::vector<uint16_t> wide(rw * rh * 3);
+
+    ib::demosaic_bgr(raw8.data(), rw, rw, rh, formats[f], one.data(), rw * 3, 1);
+    ib::demosaic_bgr(raw8.data(), rw, rw, rh, formats[f], many.data(), rw * 3, 4);
+    ib::demosaic_bgr(raw16.data(), rw * 2, rw, rh, 
+                     static_cast<ib::image::eformat>(formats[f] + 4), wide.data(), rw * 6, 3);
+
+    BOOST_REQUIRE(one == many);
+    BOOST_REQUIRE(std::equal(one.begin(), one.end(), wide.begin()));
+  }
+
+  ib::image gray(4, 4, 4);
+  gray.set_format(ib::image::FORMAT_GRAY_8);
+  ib::image out;
+  BOOST_REQUIRE_THROW(ib::demosaic(gray, out), ib::ib_error);
+}
+
+BOOST_AUTO_TEST_CASE(convert_image)
+{
+  // Known values
+  ib::image rgb(2, 1, 6, ib::image::FORMAT_RGB_888);
+  const uint8_t px[6] = {10, 20, 30, 200, 100, 0};
+  memcpy(rgb.ptr<void>(), px, 6);
+  rgb.set_sequence(3);
+
+  ib::image out;
+  ib::convert_image(rgb, out, ib::image::FORMAT_BGRA_8888);
+  BOOST_REQUIRE_EQUAL(ib::image::FORMAT_BGRA_8888, out.get_format());
+  BOOST_REQUIRE_EQUAL(8, out.get_step());
+  BOOST_REQUIRE_EQUAL(3u, out.get_sequence());
+  const uint8_t bgra[8] = {30, 20, 10, 255, 0, 100, 200, 255};
+  BOOST_REQUIRE(memcmp(bgra, out.ptr<void>(), 8) == 0);
+
+  ib::convert_image(rgb, out, ib::image::FORMAT_GRAY_8);
+  BOOST_REQUIRE_EQUAL(18, out.ptr<uint8_t>()[0]);
+  BOOST_REQUIRE_EQUAL(118, out.ptr<uint8_t>()[1]);
+
+  ib::image depth(3, 1, 6, ib::image::FORMAT_DEPTH_16);
+  depth.ptr<uint16_t>()[0] = 0;
+  depth.ptr<uint16_t>()[1] = 4000;
+  depth.ptr<uint16_t>()[2] = 9000;
+  ib::convert_options o;
+  o.depth_max = 4000;
+  ib::convert_image(depth, out, ib::image::FORMAT_GRAY_8, o);
+  BOOST_REQUIRE_EQUAL(0, out.ptr<uint8_t>()[0]);
+  BOOST_REQUIRE_EQUAL(255, out.ptr<uint8_t>()[1]);
+  BOOST_REQUIRE_EQUAL(255, out.ptr<uint8_t>()[2]);
+
+  ib::image yuyv(4, 1, 8, ib::image::FORMAT_YUYV);
+  const uint8_t yuv[8] = {235, 128, 16, 128, 81, 90, 81, 240};
+  memcpy(yuyv.ptr<void>(), yuv, 8);
+  ib::convert_image(yuyv, out, ib::image::FORMAT_RGB_888);
+  const uint8_t white_black_red[12] = {255, 255, 255, 0, 0, 0, 255, 0, 0, 255, 0, 0};
+  BOOST_REQUIRE(memcmp(white_black_red, out.ptr<void>(), 12) == 0);
+
+  BOOST_REQUIRE(!ib::can_convert(ib::image::FORMAT_GRAY_8, ib::image::FORMAT_DEPTH_16));
+  BOOST_REQUIRE_THROW(ib::convert_image(out, yuyv, ib::image::FORMAT_NV12), ib::ib_error);
+
+  // Vectorized, portable and parallel conversions agree on arbitrary data with padded rows
+  const ib::image::eformat formats[] = {
+    ib::image::FORMAT_RGB_888, ib::image::FORMAT_BGR_888, ib::image::FORMAT_RGBA_8888, 
+    ib::image::FORMAT_BGRA_8888, ib::image::FORMAT_GRAY_8, ib::image::FORMAT_DEPTH_16, 
+    ib::image::FORMAT_YUYV, ib::image::FORMAT_UYVY, ib::image::FORMAT_NV12, ib::image::FORMAT_I420
+  };
+  const int w = 134, h = 131, n = sizeof(formats) / sizeof(formats[0]);
+
+  unsigned state = 1;
+  int pairs = 0;
+  for (int f = 0; f < n; ++f) {
+    ib::image src(w, h, w * ib::get_bytes_per_pixel(formats[f]) + 16, formats[f]);
+    for (size_t i = 0; i < src.size(); ++i) {
+      state = state * 1103515245 + 12345;
+      src.ptr<uint8_t>()[i] = static_cast<uint8_t>(state >> 16);
+    }
+
+    for (int t = 0; t < n; ++t) {
+      if (!ib::can_convert(formats[f], formats[t])) {
+        continue;
+      }
+      ++pairs;
+
+      ib::convert_options o;
+      o.num_threads = 1;
+      o.depth_max = 3000;
+      ib::image simd, parallel, ssse3, scalar;
+      ib::convert_image(src, simd, formats[t], o);
+      o.num_threads = 2;
+      ib::convert_image(src, parallel, formats[t], o);
+      o.num_threads = 1;
+      ib::set_simd_limit(ib::SIMD_SSSE3);
+      ib::convert_image(src, ssse3, formats[t], o);
+      ib::set_simd_limit(ib::SIMD_NONE);
+      ib::convert_image(src, scalar, formats[t], o);
+      ib::set_simd_limit(ib::SIMD_NEON);
+
+      BOOST_REQUIRE_EQUAL(scalar.size(), simd.size());
+      BOOST_REQUIRE_MESSAGE(memcmp(scalar.ptr<void>(), simd.ptr<void>(), simd.size()) == 0, 
+                            "formats " << formats[f] << " to " << formats[t]);
+      BOOST_REQUIRE(memcmp(scalar.ptr<void>(), parallel.ptr<void>(), simd.size()) == 0);
+      BOOST_REQUIRE(memcmp(scalar.ptr<void>(), ssse3.ptr<void>(), simd.size()) == 0);
+    }
+  }
+  BOOST_REQUIRE_EQUAL(57, pairs);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,254 @@
+/*! \file test_mux.cpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#include <boost/test/unit_test.hpp>
+
+#include <imagebabble/imagebabble.hpp>
+#include <imagebabble/mux.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_mux)
+
+namespace ib = imagebabble;
+
+/** Wait until the server sees a subscriber on the given channel. */
+void wait_for_subscriber(ib::mux_server &s, const std::string &name)
+{
+  for (int i = 0; i < 100 && s.get_num_subscribers(name) == 0; ++i) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE(s.get_num_subscribers(name) > 0);
+}
+
+/** Block the server socket by filling the pipe to a client that does not read. */
+template<class T>
+void fill_pipe(ib::mux_server &s, ib::mux_channel<T> &c, const T &t)
+{
+  while (s.get_num_pending() == 0) {
+    c.publish(t);
+  }
+}
+
+/** Send queued messages while dispatching them, until nothing is left. */
+void drain(ib::mux_server &s, ib::mux_client &c)
+{
+  for (;;) {
+    const bool flushed = s.flush();
+    if (!c.dispatch(100) && flushed) {
+      break;
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(channels)
+{
+  ib::context_ptr ctx = ib::make_context();
+
+  ib::mux_server s(ctx);
+  ib::mux_channel<int> ints = s.add_channel<int>("ints");
+  ib::mux_channel< std::vector<float> > floats = s.add_channel< std::vector<float> >("floats");
+  BOOST_REQUIRE_THROW(s.add_channel<double>("ints"), ib::ib_error);
+  BOOST_REQUIRE_EQUAL(2, s.get_num_channels());
+  BOOST_REQUIRE_EQUAL("floats", floats.get_name());
+  s.startup("inproc://test-mux-channels");
+
+  int i = 0;
+  std::vector<float> f;
+  ib::mux_client c(ctx);
+  c.add_channel<int>("ints", [&](const int &v) { i = v; });
+  c.startup("inproc://test-mux-channels");
+  c.add_channel< std::vector<float> >("floats", [&](const std::vector<float> &v) { f = v; });
+  BOOST_REQUIRE_THROW(c.add_channel<int>("ints", [](const int &) {}), ib::ib_error);
+
+  // Channels are fast protocol topics.
+  ib::fast_client<int> fc(ctx);
+  fc.subscribe("ints");
+  fc.startup("inproc://test-mux-channels");
+
+  wait_for_subscriber(s, "floats");
+  for (int k = 0; k < 100 && s.get_num_subscribers("ints") < 2; ++k) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  BOOST_REQUIRE_EQUAL(2, s.get_num_subscribers("ints"));
+  BOOST_REQUIRE_EQUAL(0, s.get_num_subscribers("other"));
+
+  BOOST_REQUIRE(!s.add_channel<int>("other").publish(3));
+  BOOST_REQUIRE(ints.publish(42));
+  BOOST_REQUIRE(floats.publish(std::vector<float>(10, 1.5f)));
+  BOOST_REQUIRE(s.flush());
+
+  BOOST_REQUIRE(c.dispatch(1000));
+  BOOST_REQUIRE(c.dispatch(1000));
+  BOOST_REQUIRE(!c.dispatch(10));
+  BOOST_REQUIRE_EQUAL(42, i);
+  BOOST_REQUIRE(f == std::vector<float>(10, 1.5f));
+
+  std::string topic;
+  int j = 0;
+  BOOST_REQUIRE(fc.receive(topic, j, 1000));
+  BOOST_REQUIRE_EQUAL("ints", topic);
+  BOOST_REQUIRE_EQUAL(42, j);
+
+  fc.shutdown();
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(weights)
+{
+  ib::context_ptr ctx = ib::make_context();
+
+  // Messages of about 1000 bytes, a channel of weight one sends a single message per round.
+  ib::mux_server s(ctx);
+  s.set_quantum(1100);
+  s.set_max_pending_outbound(1);
+  ib::mux_channel< std::vector<float> > a = s.add_channel< std::vector<float> >("a", 3, 100);
+  ib::mux_channel< std::vector<float> > b = s.add_channel< std::vector<float> >("b", 1, 100);
+  s.startup("inproc://test-mux-weights");
+
+  std::string order;
+  ib::mux_client c(ctx);
+  c.set_max_pending_inbound(1);
+  c.add_channel< std::vector<float> >("a", [&](const std::vector<float> &) { order += 'a'; });
+  c.add_channel< std::vector<float> >("b", [&](const std::vector<float> &) { order += 'b'; });
+  c.startup("inproc://test-mux-weights");
+  wait_for_subscriber(s, "a");
+  wait_for_subscriber(s, "b");
+
+  const std::vector<float> data(250, 1.f);
+  fill_pipe(s, a, data);
+  for (int i = 0; i < 40; ++i) {
+    BOOST_REQUIRE(a.publish(data));
+    BOOST_REQUIRE(b.publish(data));
+  }
+  BOOST_REQUIRE_EQUAL(0, a.get_num_dropped());
+
+  drain(s, c);
+  BOOST_REQUIRE_EQUAL(0, s.get_num_pending());
+
+  // Skip messages sent before queueing. While both channels are backlogged, 
+  // 'a' sends three messages for each of 'b'.
+  const std::string scheduled = order.substr(order.size() - 81, 40);
+  const size_t na = std::count(scheduled.begin(), scheduled.end(), 'a');
+  BOOST_REQUIRE(na >= 28 && na <= 32);
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(no_starvation)
+{
+  ib::context_ptr ctx = ib::make_context();
+
+  ib::mux_server s(ctx);
+  s.set_max_pending_outbound(1);
+  ib::mux_channel< std::vector<float> > large = s.add_channel< std::vector<float> >("large", 1, 10);
+  ib::mux_channel<int> small = s.add_channel<int>("small", 1, 10);
+  s.startup("inproc://test-mux-starvation");
+
+  std::string order;
+  ib::mux_client c(ctx);
+  c.set_max_pending_inbound(1);
+  c.add_channel< std::vector<float> >("large", [&](const std::vector<float> &) { order += 'L'; });
+  c.add_channel<int>("small", [&](const int &) { order += 's'; });
+  c.startup("inproc://test-mux-starvation");
+  wait_for_subscriber(s, "large");
+  wait_for_subscriber(s, "small");
+
+  // Large messages exceed the quantum and are sent every few rounds only.
+  const std::vector<float> frame(100000, 1.f);
+  fill_pipe(s, large, frame);
+  for (int i = 0; i < 10; ++i) {
+    large.publish(frame);
+  }
+  BOOST_REQUIRE_EQUAL(10, large.get_num_pending());
+  BOOST_REQUIRE(large.get_num_dropped() > 0);
+
+  for (int i = 0; i < 10; ++i) {
+    BOOST_REQUIRE(small.publish(i));
+  }
+
+  drain(s, c);
+
+  // Small messages are sent within a single round and overtake most queued large ones.
+  const size_t first_small = order.find('s');
+  BOOST_REQUIRE(first_small != std::string::npos);
+  BOOST_REQUIRE_EQUAL(std::string(10, 's'), order.substr(first_small, 10));
+  BOOST_REQUIRE(order.size() - first_small - 10 >= 5);
+
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(head_of_line_blocking)
+{
+  ib::context_ptr ctx = ib::make_context();
+
+  ib::mux_server s(ctx);
+  s.set_max_pending_outbound(1);
+  ib::mux_channel<int> a = s.add_channel<int>("a", 1, 10);
+  ib::mux_channel<int> b = s.add_channel<int>("b", 1, 10);
+  s.startup("inproc://test-mux-head-of-line");
+
+  // Subscriber of 'a' that does not read.
+  ib::fast_client<int> slow(ctx);
+  slow.set_max_pending_inbound(1);
+  slow.subscribe("a");
+  slow.startup("inproc://test-mux-head-of-line");
+
+  int received = -1;
+  ib::mux_client c(ctx);
+  c.add_channel<int>("b", [&](const int &v) { received = v; });
+  c.startup("inproc://test-mux-head-of-line");
+  wait_for_subscriber(s, "a");
+  wait_for_subscriber(s, "b");
+
+  fill_pipe(s, a, 1);
+
+  // 'b' waits behind 'a', although its own subscriber is idle.
+  BOOST_REQUIRE(b.publish(2));
+  BOOST_REQUIRE(!s.flush());
+  BOOST_REQUIRE_EQUAL(1, b.get_num_pending());
+  BOOST_REQUIRE(!c.dispatch(50));
+
+  // Once the slow subscriber catches up, all parts of all messages arrive.
+  int v = 0;
+  while (!s.flush()) {
+    while (slow.receive(v, 10)) {
+      BOOST_REQUIRE_EQUAL(1, v);
+    }
+  }
+  BOOST_REQUIRE(c.dispatch(1000));
+  BOOST_REQUIRE_EQUAL(2, received);
+
+  slow.shutdown();
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -52,6 +52,24 @@ void server_fnc(int times, size_t nclients, int timeout, int &count)
   s.shutdown();
 }
 
+void server_window_fnc(int times, size_t nclients, size_t window, int &count) 
+{
+  ib::reliable_server<int> s;
+  s.set_window_size(window);
+  s.startup();
+
+  count = 0;
+  for (int i = 0; i < times; ++i) {
+    if (s.publish(1, -1, nclients)) {
+      count += 1;
+    }
+  }
+
+  BOOST_REQUIRE(s.flush(1000));
+  s.publish(-1, 1000, nclients);
+  s.shutdown();
+}
+
 void client_fnc(int timeout, int &count)
 {
   ib::reliable_client<int> c;
@@ -97,6 +115,76 @@ void client_once_fnc(int &count)
   c.shutdown();
 }
 
+/** Client speaking the reliable protocol on a raw socket, so that tests control
+  * when it acknowledges frames. */
+class raw_client {
+public:
+  raw_client(zmq::context_t &ctx, const char *addr)
+    : _s(ctx, ZMQ_DEALER)
+  {
+    int linger = 0;
+    _s.setsockopt(ZMQ_LINGER, &linger, sizeof(int));
+    _s.connect(addr);
+    send_type(IB_EXCHANGE_PROTO_RELIABLE_REGISTER, 0);
+  }
+
+  /** Receive a message. Returns its type and fills id, slot and value of payloads. */
+  std::string recv(int64_t &id, uint32_t &slot, int &v)
+  {
+    std::string version, type;
+    if (!ib::io::is_data_pending(_s, 1000)) {
+      return std::string();
+    }
+    ib::io::recv(_s, version, 0);
+    BOOST_REQUIRE_EQUAL(IB_EXCHANGE_PROTO_RELIABLE_VERSION, version);
+    ib::io::recv(_s, type, 0);
+    if (type == IB_EXCHANGE_PROTO_RELIABLE_PAYLOAD) {
+      ib::io::recv(_s, id, 0);
+#ifndef IB_LEGACY_TEXT_ENCODING
+      ib::io::recv(_s, slot, 0);
+#endif
+      ib::io::recv(_s, v, 0);
+    }
+    return type;
+  }
+
+  /** Receive a payload and return its id. */
+  int64_t recv_payload(uint32_t &slot)
+  {
+    int64_t id = -1;
+    int v;
+    BOOST_REQUIRE_EQUAL(IB_EXCHANGE_PROTO_RELIABLE_PAYLOAD, recv(id, slot, v));
+    return id;
+  }
+
+  /** Acknowledge all frames up to and including id. */
+  void ack(int64_t id, uint32_t slot)
+  {
+    send_type(IB_EXCHANGE_PROTO_RELIABLE_ACK, ZMQ_SNDMORE);
+#ifdef IB_LEGACY_TEXT_ENCODING
+    ib::io::send(_s, id, 0);
+#else
+    ib::io::send(_s, id, ZMQ_SNDMORE);
+    ib::io::send(_s, slot, 0);
+#endif
+  }
+
+  /** Tell the server to forget about this client. */
+  void disconnect()
+  {
+    send_type(IB_EXCHANGE_PROTO_RELIABLE_DISCONNECT, 0);
+  }
+
+private:
+  void send_type(const char *type, int flags)
+  {
+    ib::io::send(_s, IB_EXCHANGE_PROTO_RELIABLE_VERSION, ZMQ_SNDMORE);
+    ib::io::send(_s, type, flags);
+  }
+
+  zmq::socket_t _s;
+};
+
 BOOST_AUTO_TEST_CASE(one_client)
 {
   
@@ -133,6 +221,27 @@ BOOST_AUTO_TEST_CASE(multiple_clients)
   }
 }
 
+BOOST_AUTO_TEST_CASE(windowed_clients)
+{
+  const size_t nclients = 3;
+
+  int sum_sent = 0;
+  int sum_received[nclients];
+
+  boost::thread_group g;
+  g.create_thread(boost::bind(server_window_fnc, 1000, nclients, 8, boost::ref(sum_sent)));
+  for (size_t i = 0; i < nclients; ++i) {
+    g.create_thread(boost::bind(client_fnc, -1, boost::ref(sum_received[i])));
+  }
+
+  g.join_all();
+
+  BOOST_REQUIRE_EQUAL(1000, sum_sent);
+  for (size_t i = 0; i < nclients; ++i) {
+    BOOST_REQUIRE_EQUAL(sum_sent, sum_received[i]);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(no_clients)
 {
   int sum_sent = 0;
@@ -186,4 +295,132 @@ BOOST_AUTO_TEST_CASE(missing_server)
 
 }
 
+BOOST_AUTO_TEST_CASE(reconnect_into_reused_slot)
+{
+  ib::context_ptr ctx = ib::make_context();
+  ib::reliable_server<int> s(ctx);
+  s.set_window_size(2);
+  s.startup("inproc://test-reliable-reuse");
+
+  raw_client a(*ctx, "inproc://test-reliable-reuse");
+  raw_client b(*ctx, "inproc://test-reliable-reuse");
+
+  uint32_t slot_a = 0, slot_b = 0;
+  BOOST_REQUIRE(s.publish(1, 0, 2));
+  BOOST_REQUIRE_EQUAL(0, a.recv_payload(slot_a));
+  BOOST_REQUIRE_EQUAL(0, b.recv_payload(slot_b));
+  a.ack(0, slot_a);
+  b.ack(0, slot_b);
+
+  // The reconnecting client takes over the slot released by the disconnect.
+  a.disconnect();
+  BOOST_REQUIRE(s.flush(0));
+  raw_client c(*ctx, "inproc://test-reliable-reuse");
+
+  uint32_t slot_c = 0;
+  BOOST_REQUIRE(s.publish(1, 0, 2));
+  BOOST_REQUIRE_EQUAL(1, c.recv_payload(slot_c));
+  BOOST_REQUIRE_EQUAL(1, b.recv_payload(slot_b));
+#ifndef IB_LEGACY_TEXT_ENCODING
+  BOOST_REQUIRE_EQUAL(slot_a, slot_c);
+#endif
+
+  // ACKs of the previous owner of the slot are ignored.
+  b.ack(1, slot_b);
+  a.ack(1, slot_a);
+  BOOST_REQUIRE(!s.flush(50));
+
+  // The new owner does not owe frames sent before it registered.
+  c.ack(1, slot_c);
+  BOOST_REQUIRE(s.flush(1000));
+
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(drop_unresponsive_client)
+{
+  ib::context_ptr ctx = ib::make_context();
+  ib::reliable_server<int> s(ctx);
+  s.set_window_size(2);
+  s.startup("inproc://test-reliable-drop");
+
+  raw_client a(*ctx, "inproc://test-reliable-drop");
+  raw_client b(*ctx, "inproc://test-reliable-drop");
+
+  // 'a' never acknowledges. Frames leaving the window stay unacknowledged 
+  // until 'a' falls behind by 10 frames plus the window size.
+  const int64_t threshold = 10 + 2;
+  uint32_t slot_a = 0, slot_b = 0;
+  BOOST_REQUIRE(s.publish(1, 0, 2));
+  BOOST_REQUIRE_EQUAL(0, b.recv_payload(slot_b));
+  b.ack(0, slot_b);
+  for (int64_t i = 1; i <= threshold; ++i) {
+    BOOST_REQUIRE_EQUAL(i == threshold, s.publish(1, 0, 1));
+    BOOST_REQUIRE_EQUAL(i, b.recv_payload(slot_b));
+    b.ack(i, slot_b);
+  }
+
+  // Frames outstanding for 'a' were settled when it was dropped. 
+  BOOST_REQUIRE(s.flush(1000));
+
+  int64_t id = -1;
+  int v = 0;
+  for (int64_t i = 0; i < threshold; ++i) {
+    BOOST_REQUIRE_EQUAL(i, a.recv_payload(slot_a));
+  }
+  BOOST_REQUIRE_EQUAL(IB_EXCHANGE_PROTO_RELIABLE_DISCONNECT, a.recv(id, slot_a, v));
+
+  // Late ACKs of the dropped client are ignored and 'b' is served alone.
+  a.ack(threshold - 1, slot_a);
+  BOOST_REQUIRE(!s.publish(1, 0, 2));
+  BOOST_REQUIRE(s.publish(1, 0, 1));
+  BOOST_REQUIRE_EQUAL(threshold + 1, b.recv_payload(slot_b));
+  b.ack(threshold + 1, slot_b);
+  BOOST_REQUIRE(s.flush(1000));
+
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(shared_context)
+{
+  ib::context_factory f;
+  f.set_io_threads(2);
+  f.set_cpu_affinity(std::vector<int>(1, 0));
+  BOOST_REQUIRE_THROW(f.set_io_threads(-1), ib::ib_error);
+
+  // Affinities ZMQ rejects, as without draft options, are skipped.
+  ib::context_factory rejected;
+  rejected.set_cpu_affinity(std::vector<int>(1, -1));
+  BOOST_REQUIRE_NO_THROW(rejected.create());
+
+  ib::context_ptr ctx = f.get_shared();
+  BOOST_REQUIRE(ctx == f.get_shared());
+
+  ib::reliable_server<int> s(ctx);
+  s.set_io_affinity(2);
+  s.startup("inproc://test-reliable-shared");
+
+  int sum_received = 0;
+  boost::thread t([&]() {
+    ib::reliable_client<int> c(ctx);
+    c.set_io_affinity(1);
+    c.startup("inproc://test-reliable-shared");
+
+    int j = -1;
+    while (c.receive(j, 2000) && j >= 0) {
+      sum_received += j;
+    }
+    c.shutdown();
+  });
+
+  for (int i = 0; i < 10; ++i) {
+    BOOST_REQUIRE(s.publish(1, 2000, 1));
+  }
+  s.publish(-1, 2000, 1);
+  t.join();
+  s.shutdown();
+
+  BOOST_REQUIRE_EQUAL(10, sum_received);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+/*! \file test_shm.cpp
+
+    Copyright (c) 2013, PROFACTOR GmbH, Christoph Heindl
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+          notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+          notice, this list of conditions and the following disclaimer in the
+          documentation and/or other materials provided with the distribution.
+        * Neither the name of PROFACTOR GmbH nor the
+          names of its contributors may be used to endorse or promote products
+          derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL PROFACTOR GmbH BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
+*/
+
+#include <boost/test/unit_test.hpp>
+
+#include <imagebabble/imagebabble.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_shm)
+
+namespace ib = imagebabble;
+
+BOOST_AUTO_TEST_CASE(slot_references)
+{
+  ib::shm_ring_ptr w = ib::shm_ring::create("ib-test-slots", 2, 100);
+  ib::shm_ring_ptr r = ib::shm_ring::open("ib-test-slots");
+
+  BOOST_REQUIRE_EQUAL(2, r->get_num_slots());
+  BOOST_REQUIRE_LE(100, r->get_slot_capacity());
+  BOOST_REQUIRE_EQUAL(w->get_session(), r->get_session());
+
+  size_t a, b, c;
+  uint32_t ga, gb, gc;
+  BOOST_REQUIRE(w->claim(a, ga));
+  BOOST_REQUIRE(!r->acquire(a, ga)); // not yet published
+
+  w->publish(a);
+  BOOST_REQUIRE(r->acquire(a, ga));
+  BOOST_REQUIRE(!r->acquire(a, ga + 1));
+  ib::shm_ring::release(0, w->get_hint(a));
+
+  // Slot a is still referenced by the reader.
+  BOOST_REQUIRE(w->claim(b, gb));
+  BOOST_REQUIRE_NE(a, b);
+  BOOST_REQUIRE(!w->claim(c, gc));
+
+  ib::shm_ring::release(0, r->get_hint(a));
+  BOOST_REQUIRE(w->claim(c, gc));
+  BOOST_REQUIRE_EQUAL(a, c);
+  BOOST_REQUIRE_EQUAL(ga + 1, gc);
+
+  // Reused slot does not hand out the old generation.
+  w->publish(c);
+  BOOST_REQUIRE(!r->acquire(a, ga));
+
+  ib::shm_ring::release(0, w->get_hint(b));
+  ib::shm_ring::release(0, w->get_hint(c));
+}
+
+BOOST_AUTO_TEST_CASE(image_transport)
+{
+  ib::fast_server<ib::image> s;
+  s.set_shm_options(4, 640 * 480);
+  s.startup("shm://ib-test-images");
+
+  ib::fast_client<ib::image> c;
+  c.startup("shm://ib-test-images");
+
+  ib::image img(640, 480, 640);
+  memset(img.ptr<char>(), 7, img.size());
+  img.set_sequence(1);
+
+  // Wait for subscription to be established.
+  ib::image recv_img;
+  while (!c.receive(recv_img, 10)) {
+    s.publish(img);
+  }
+
+  BOOST_REQUIRE_EQUAL(640, recv_img.get_width());
+  BOOST_REQUIRE_EQUAL(480, recv_img.get_height());
+  BOOST_REQUIRE_EQUAL(1u, recv_img.get_sequence());
+  BOOST_REQUIRE_EQUAL(img.size(), recv_img.size());
+  BOOST_REQUIRE(memcmp(img.ptr<char>(), recv_img.ptr<char>(), img.size()) == 0);
+
+  // Images allocated from the ring are published without copying.
+  ib::image slot_img;
+  BOOST_REQUIRE(s.get_shm_ring()->allocate_image(320, 240, 320, slot_img));
+  memset(slot_img.ptr<char>(), 9, slot_img.size());
+  slot_img.set_sequence(2);
+  BOOST_REQUIRE(s.publish(slot_img));
+
+  BOOST_REQUIRE(c.receive(recv_img, 1000));
+  BOOST_REQUIRE_EQUAL(2u, recv_img.get_sequence());
+  BOOST_REQUIRE_EQUAL(320 * 240, recv_img.size());
+  BOOST_REQUIRE_EQUAL(9, recv_img.ptr<char>()[320 * 240 - 1]);
+
+  // Slots of planar images include the chroma planes.
+  BOOST_REQUIRE(s.get_shm_ring()->allocate_image(320, 240, 320, ib::image::FORMAT_NV12, slot_img));
+  BOOST_REQUIRE_EQUAL(320 * 360, slot_img.size());
+  memset(slot_img.ptr<char>(), 7, slot_img.size());
+  BOOST_REQUIRE(s.publish(slot_img));
+
+  ib::image planar;
+  BOOST_REQUIRE(c.receive(planar, 1000));
+  BOOST_REQUIRE_EQUAL(ib::image::FORMAT_NV12, planar.get_format());
+  BOOST_REQUIRE_EQUAL(320 * 360, planar.size());
+  BOOST_REQUIRE_EQUAL(7, planar.ptr<char>()[320 * 360 - 1]);
+
+  c.shutdown();
+  s.shutdown();
+
+  // Received images remain valid after shutdown.
+  BOOST_REQUIRE_EQUAL(9, recv_img.ptr<char>()[0]);
+}
+
+BOOST_AUTO_TEST_CASE(images_only)
+{
+  ib::fast_server<int> s;
+  s.startup("shm://ib-test-int");
+
+  ib::fast_client<int> c;
+  c.startup("shm://ib-test-int");
+  while (!s.has_subscribers()) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  BOOST_REQUIRE_THROW(s.publish(1), ib::ib_error);
+  BOOST_REQUIRE_THROW(s.startup("tcp://127.0.0.1:6003"), ib::ib_error);
+  c.shutdown();
+  s.shutdown();
+}
+
+BOOST_AUTO_TEST_SUITE_END()